@@ -1 +1,119 @@
 #include "AABB.h"
+#include "Simd.h"
+
+/*
+ shared core of the batched tests, calls emit(first, bits, width) for every group of boxes,
+ bit b of bits tells whether box first + b overlaps the query
+*/
+template <typename Emit>
+static void overlapBatch(const AABB& query, const AABBLanes& boxes, bool testZ, Emit emit)
+{
+	int i = 0;
+
+#if SIMD_AVX2
+	const __m256 qMinX8 = _mm256_set1_ps(query.minX);
+	const __m256 qMinY8 = _mm256_set1_ps(query.minY);
+	const __m256 qMinZ8 = _mm256_set1_ps(query.minZ);
+	const __m256 qMaxX8 = _mm256_set1_ps(query.maxX);
+	const __m256 qMaxY8 = _mm256_set1_ps(query.maxY);
+	const __m256 qMaxZ8 = _mm256_set1_ps(query.maxZ);
+	for (; i + 8 <= boxes.count; i += 8)
+	{
+		__m256 hit = _mm256_and_ps(
+			_mm256_and_ps(_mm256_cmp_ps(qMinX8, _mm256_loadu_ps(boxes.maxX + i), _CMP_LT_OQ),
+				_mm256_cmp_ps(qMaxX8, _mm256_loadu_ps(boxes.minX + i), _CMP_GT_OQ)),
+			_mm256_and_ps(_mm256_cmp_ps(qMinY8, _mm256_loadu_ps(boxes.maxY + i), _CMP_LT_OQ),
+				_mm256_cmp_ps(qMaxY8, _mm256_loadu_ps(boxes.minY + i), _CMP_GT_OQ)));
+
+		if (testZ)
+		{
+			hit = _mm256_and_ps(hit,
+				_mm256_and_ps(_mm256_cmp_ps(qMinZ8, _mm256_loadu_ps(boxes.maxZ + i), _CMP_LT_OQ),
+					_mm256_cmp_ps(qMaxZ8, _mm256_loadu_ps(boxes.minZ + i), _CMP_GT_OQ)));
+		}
+
+		emit(i, (unsigned int)_mm256_movemask_ps(hit), 8);
+	}
+#endif
+
+#if SIMD_SSE
+	const __m128 qMinX4 = _mm_set1_ps(query.minX);
+	const __m128 qMinY4 = _mm_set1_ps(query.minY);
+	const __m128 qMinZ4 = _mm_set1_ps(query.minZ);
+	const __m128 qMaxX4 = _mm_set1_ps(query.maxX);
+	const __m128 qMaxY4 = _mm_set1_ps(query.maxY);
+	const __m128 qMaxZ4 = _mm_set1_ps(query.maxZ);
+	for (; i + 4 <= boxes.count; i += 4)
+	{
+		__m128 hit = _mm_and_ps(
+			_mm_and_ps(_mm_cmplt_ps(qMinX4, _mm_loadu_ps(boxes.maxX + i)),
+				_mm_cmpgt_ps(qMaxX4, _mm_loadu_ps(boxes.minX + i))),
+			_mm_and_ps(_mm_cmplt_ps(qMinY4, _mm_loadu_ps(boxes.maxY + i)),
+				_mm_cmpgt_ps(qMaxY4, _mm_loadu_ps(boxes.minY + i))));
+
+		if (testZ)
+		{
+			hit = _mm_and_ps(hit,
+				_mm_and_ps(_mm_cmplt_ps(qMinZ4, _mm_loadu_ps(boxes.maxZ + i)),
+					_mm_cmpgt_ps(qMaxZ4, _mm_loadu_ps(boxes.minZ + i))));
+		}
+
+		emit(i, (unsigned int)_mm_movemask_ps(hit), 4);
+	}
+#endif
+
+	for (; i < boxes.count; i++)
+	{
+		bool hit =
+			query.minX < boxes.maxX[i] && query.maxX > boxes.minX[i] &&
+			query.minY < boxes.maxY[i] && query.maxY > boxes.minY[i];
+
+		if (testZ)
+			hit = hit && query.minZ < boxes.maxZ[i] && query.maxZ > boxes.minZ[i];
+
+		emit(i, hit ? 1u : 0u, 1);
+	}
+}
+
+void overlapMask(const AABB& query, const AABBLanes& boxes, unsigned int* mask, bool testZ)
+{
+	for (int w = 0; w < (boxes.count + 31) / 32; w++)
+		mask[w] = 0;
+
+	// groups never straddle a word, they start at multiples of their own width
+	overlapBatch(query, boxes, testZ, [mask](int first, unsigned int bits, int)
+		{
+			mask[first >> 5] |= bits << (first & 31);
+		});
+}
+
+int overlapIndices(const AABB& query, const AABBLanes& boxes, int* indices, bool testZ)
+{
+	int hitCount = 0;
+
+	// branchless compaction, every slot is written and the cursor only moves on a hit
+	overlapBatch(query, boxes, testZ, [indices, &hitCount](int first, unsigned int bits, int width)
+		{
+			for (int b = 0; b < width; b++)
+			{
+				indices[hitCount] = first + b;
+				hitCount += (bits >> b) & 1;
+			}
+		});
+
+	return hitCount;
+}
+
+void frustumPlanes(const glm::mat4& viewProjection, glm::vec4* planes)
+{
+	// planes from the rows of the clip matrix (glm is column major)
+	glm::vec4 rows[4];
+	for (int r = 0; r < 4; r++)
+		rows[r] = glm::vec4(viewProjection[0][r], viewProjection[1][r], viewProjection[2][r], viewProjection[3][r]);
+	planes[0] = rows[3] + rows[0];
+	planes[1] = rows[3] - rows[0];
+	planes[2] = rows[3] + rows[1];
+	planes[3] = rows[3] - rows[1];
+	planes[4] = rows[3] + rows[2];
+	planes[5] = rows[3] - rows[2];
+}
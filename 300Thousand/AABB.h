@@ -91,3 +91,28 @@ public:
 	
 };
 
+/*
+ batched overlap of one query box against N boxes stored as soa float lanes.
+ same strict xy test as AABB::overlap, testZ adds the z axis for a full 3d test (the z lanes may be null otherwise).
+ the kernel runs 8 boxes per avx2 instruction, 4 with sse, with a scalar tail.
+*/
+struct AABBLanes
+{
+	const float* minX;
+	const float* minY;
+	const float* minZ;
+	const float* maxX;
+	const float* maxY;
+	const float* maxZ;
+	int count;
+};
+
+// bit k of mask[k / 32] is set when box k overlaps, mask needs (count + 31) / 32 words
+void overlapMask(const AABB& query, const AABBLanes& boxes, unsigned int* mask, bool testZ = false);
+
+// writes the indices of the overlapping boxes in ascending order, returns how many, indices needs count entries
+int overlapIndices(const AABB& query, const AABBLanes& boxes, int* indices, bool testZ = false);
+
+// gribb / hartmann, the 6 planes (left, right, bottom, top, near, far) of a clip matrix as (normal, d),
+// inside is dot(normal, p) + d >= 0. the normals are not unit length
+void frustumPlanes(const glm::mat4& viewProjection, glm::vec4* planes);
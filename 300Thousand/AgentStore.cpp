@@ -0,0 +1,258 @@
+#include "AgentStore.h"
+#include <algorithm>
+#include <cmath>
+
+/*
+ lane kernels, each one works on a single float lane so x, y and z share the same code.
+ the avx2 loop handles 8 agents per instruction, sse 4, and the scalar loop is the reference.
+*/
+
+static void integrateLane(float* pos, float* prev, const float* vel, int laneCount, float deltaTime)
+{
+	int i = 0;
+
+#if SIMD_AVX2
+	const __m256 dt8 = _mm256_set1_ps(deltaTime);
+	for (; i + 8 <= laneCount; i += 8)
+	{
+		__m256 p = _mm256_loadu_ps(pos + i);
+		_mm256_storeu_ps(prev + i, p);
+		_mm256_storeu_ps(pos + i, _mm256_add_ps(p, _mm256_mul_ps(_mm256_loadu_ps(vel + i), dt8)));
+	}
+#endif
+
+#if SIMD_SSE
+	const __m128 dt4 = _mm_set1_ps(deltaTime);
+	for (; i + 4 <= laneCount; i += 4)
+	{
+		__m128 p = _mm_loadu_ps(pos + i);
+		_mm_storeu_ps(prev + i, p);
+		_mm_storeu_ps(pos + i, _mm_add_ps(p, _mm_mul_ps(_mm_loadu_ps(vel + i), dt4)));
+	}
+#endif
+
+	for (; i < laneCount; i++)
+	{
+		prev[i] = pos[i];
+		pos[i] += vel[i] * deltaTime;
+	}
+}
+
+static void boundsLane(const float* pos, float* minLane, float* maxLane, int laneCount, float restMin, float restMax)
+{
+	int i = 0;
+
+#if SIMD_AVX2
+	const __m256 lo8 = _mm256_set1_ps(restMin);
+	const __m256 hi8 = _mm256_set1_ps(restMax);
+	for (; i + 8 <= laneCount; i += 8)
+	{
+		__m256 p = _mm256_loadu_ps(pos + i);
+		_mm256_storeu_ps(minLane + i, _mm256_add_ps(lo8, p));
+		_mm256_storeu_ps(maxLane + i, _mm256_add_ps(hi8, p));
+	}
+#endif
+
+#if SIMD_SSE
+	const __m128 lo4 = _mm_set1_ps(restMin);
+	const __m128 hi4 = _mm_set1_ps(restMax);
+	for (; i + 4 <= laneCount; i += 4)
+	{
+		__m128 p = _mm_loadu_ps(pos + i);
+		_mm_storeu_ps(minLane + i, _mm_add_ps(lo4, p));
+		_mm_storeu_ps(maxLane + i, _mm_add_ps(hi4, p));
+	}
+#endif
+
+	for (; i < laneCount; i++)
+	{
+		minLane[i] = restMin + pos[i];
+		maxLane[i] = restMax + pos[i];
+	}
+}
+
+static void sweptBoundsLane(const float* pos, const float* prev, float* minLane, float* maxLane, int laneCount, float restMin, float restMax)
+{
+	int i = 0;
+
+#if SIMD_AVX2
+	const __m256 lo8 = _mm256_set1_ps(restMin);
+	const __m256 hi8 = _mm256_set1_ps(restMax);
+	for (; i + 8 <= laneCount; i += 8)
+	{
+		__m256 p = _mm256_loadu_ps(pos + i);
+		__m256 q = _mm256_loadu_ps(prev + i);
+		_mm256_storeu_ps(minLane + i, _mm256_add_ps(lo8, _mm256_min_ps(p, q)));
+		_mm256_storeu_ps(maxLane + i, _mm256_add_ps(hi8, _mm256_max_ps(p, q)));
+	}
+#endif
+
+#if SIMD_SSE
+	const __m128 lo4 = _mm_set1_ps(restMin);
+	const __m128 hi4 = _mm_set1_ps(restMax);
+	for (; i + 4 <= laneCount; i += 4)
+	{
+		__m128 p = _mm_loadu_ps(pos + i);
+		__m128 q = _mm_loadu_ps(prev + i);
+		_mm_storeu_ps(minLane + i, _mm_add_ps(lo4, _mm_min_ps(p, q)));
+		_mm_storeu_ps(maxLane + i, _mm_add_ps(hi4, _mm_max_ps(p, q)));
+	}
+#endif
+
+	for (; i < laneCount; i++)
+	{
+		minLane[i] = restMin + std::min(pos[i], prev[i]);
+		maxLane[i] = restMax + std::max(pos[i], prev[i]);
+	}
+}
+
+vec3 AgentView::currPos() const
+{
+	return vec3(store.posX[index], store.posY[index], store.posZ[index]);
+}
+
+vec3 AgentView::prevPos() const
+{
+	return vec3(store.prevX[index], store.prevY[index], store.prevZ[index]);
+}
+
+vec3 AgentView::velocity() const
+{
+	return vec3(store.velX[index], store.velY[index], store.velZ[index]);
+}
+
+AABB AgentView::aabb() const
+{
+	return store.aabb(index);
+}
+
+int AgentView::collisionStatus() const
+{
+	return store.collisionStatus[index];
+}
+
+SceneObject AgentView::object() const
+{
+	SceneObject object(index, currPos(), prevPos(), velocity(), aabb());
+	object.collisionStatus = collisionStatus();
+	return object;
+}
+
+AgentStore::AgentStore()
+	: restAABB(0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f), count(0)
+{
+}
+
+void AgentStore::clear()
+{
+	count = 0;
+	resizeLanes(0);
+}
+
+void AgentStore::setRestAABB(const AABB& aabb)
+{
+	restAABB = aabb;
+}
+
+int AgentStore::add(const SceneObject& object)
+{
+	int i = count;
+	count++;
+	resizeLanes((count + SIMD_WIDTH - 1) / SIMD_WIDTH * SIMD_WIDTH);
+
+	posX[i] = object.currPos.x;
+	posY[i] = object.currPos.y;
+	posZ[i] = object.currPos.z;
+	prevX[i] = object.prevPos.x;
+	prevY[i] = object.prevPos.y;
+	prevZ[i] = object.prevPos.z;
+	velX[i] = object.velocity.x;
+	velY[i] = object.velocity.y;
+	velZ[i] = object.velocity.z;
+	minX[i] = object.aabb.minX;
+	minY[i] = object.aabb.minY;
+	minZ[i] = object.aabb.minZ;
+	maxX[i] = object.aabb.maxX;
+	maxY[i] = object.aabb.maxY;
+	maxZ[i] = object.aabb.maxZ;
+	collisionStatus[i] = object.collisionStatus;
+
+	return i;
+}
+
+int AgentStore::size() const
+{
+	return count;
+}
+
+AgentView AgentStore::operator[](int i) const
+{
+	return AgentView(*this, i);
+}
+
+void AgentStore::integrate(float deltaTime)
+{
+	int laneCount = posX.size();
+	integrateLane(posX.data(), prevX.data(), velX.data(), laneCount, deltaTime);
+	integrateLane(posY.data(), prevY.data(), velY.data(), laneCount, deltaTime);
+	integrateLane(posZ.data(), prevZ.data(), velZ.data(), laneCount, deltaTime);
+}
+
+void AgentStore::updateAABBs(const vec3 scale)
+{
+	int laneCount = posX.size();
+	boundsLane(posX.data(), minX.data(), maxX.data(), laneCount, restAABB.minX_0 * scale.x, restAABB.maxX_0 * scale.x);
+	boundsLane(posY.data(), minY.data(), maxY.data(), laneCount, restAABB.minY_0 * scale.y, restAABB.maxY_0 * scale.y);
+	boundsLane(posZ.data(), minZ.data(), maxZ.data(), laneCount, restAABB.minZ_0 * scale.z, restAABB.maxZ_0 * scale.z);
+}
+
+void AgentStore::updateSweptAABBs(const vec3 scale)
+{
+	int laneCount = posX.size();
+	sweptBoundsLane(posX.data(), prevX.data(), minX.data(), maxX.data(), laneCount, restAABB.minX_0 * scale.x, restAABB.maxX_0 * scale.x);
+	sweptBoundsLane(posY.data(), prevY.data(), minY.data(), maxY.data(), laneCount, restAABB.minY_0 * scale.y, restAABB.maxY_0 * scale.y);
+	sweptBoundsLane(posZ.data(), prevZ.data(), minZ.data(), maxZ.data(), laneCount, restAABB.minZ_0 * scale.z, restAABB.maxZ_0 * scale.z);
+}
+
+void AgentStore::resetCollisionStatus()
+{
+	std::fill(collisionStatus.begin(), collisionStatus.end(), 0);
+}
+
+AABBLanes AgentStore::lanes() const
+{
+	return { minX.data(), minY.data(), minZ.data(), maxX.data(), maxY.data(), maxZ.data(), count };
+}
+
+AABB AgentStore::aabb(int i) const
+{
+	AABB aabb = restAABB;
+	aabb.minX = minX[i];
+	aabb.minY = minY[i];
+	aabb.minZ = minZ[i];
+	aabb.maxX = maxX[i];
+	aabb.maxY = maxY[i];
+	aabb.maxZ = maxZ[i];
+	return aabb;
+}
+
+void AgentStore::updateAABB(int i, const vec3 scale)
+{
+	minX[i] = restAABB.minX_0 * scale.x + posX[i];
+	maxX[i] = restAABB.maxX_0 * scale.x + posX[i];
+	minY[i] = restAABB.minY_0 * scale.y + posY[i];
+	maxY[i] = restAABB.maxY_0 * scale.y + posY[i];
+	minZ[i] = restAABB.minZ_0 * scale.z + posZ[i];
+	maxZ[i] = restAABB.maxZ_0 * scale.z + posZ[i];
+}
+
+void AgentStore::resizeLanes(int laneCount)
+{
+	vector<float>* lanes[] = { &posX, &posY, &posZ, &prevX, &prevY, &prevZ, &velX, &velY, &velZ,
+		&minX, &minY, &minZ, &maxX, &maxY, &maxZ };
+
+	for (vector<float>* lane : lanes)
+		lane->resize(laneCount, 0.0f);
+
+	collisionStatus.resize(laneCount, 0);
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include <vector>
+#include <glm/glm.hpp>
+#include "AABB.h"
+#include "SceneObject.h"
+#include "Simd.h"
+
+using namespace std;
+using namespace glm;
+
+class AgentStore;
+
+/*
+ read access to one agent, for the code that still thinks in SceneObject terms (bvh, renderer)
+*/
+struct AgentView
+{
+	AgentView(const AgentStore& store, int index) : store(store), index(index) {};
+
+	vec3 currPos() const;
+	vec3 prevPos() const;
+	vec3 velocity() const;
+	AABB aabb() const;
+	int collisionStatus() const;
+	SceneObject object() const;
+
+	const AgentStore& store;
+	int index;
+};
+
+/*
+ structure of arrays agent storage.
+ every attribute lives in its own contiguous float lane so the per-frame kernels only stream the
+ bytes they touch. all agents share the rest box of the mesh, so the *_0 extents are stored once.
+ lanes are padded to SIMD_WIDTH, the padding agents sit at the origin with zero velocity.
+*/
+class AgentStore
+{
+public:
+	AgentStore();
+	void clear();
+	void setRestAABB(const AABB& aabb);
+	int add(const SceneObject& object);
+	int size() const;
+	AgentView operator[](int i) const;
+
+	// per-frame kernels, walls and other obstacles are Simulation::obstacles
+	void integrate(float deltaTime);
+	void updateAABBs(const vec3 scale);
+
+	// continuous collision variant: the boxes cover the whole move from prev to curr for the broad-phase
+	void updateSweptAABBs(const vec3 scale);
+	void resetCollisionStatus();
+
+	// bounds of all agents for the batched overlap kernel
+	AABBLanes lanes() const;
+
+	// single agent helpers for the collision response
+	AABB aabb(int i) const;
+	void updateAABB(int i, const vec3 scale);
+
+	vector<float> posX, posY, posZ;
+	vector<float> prevX, prevY, prevZ;
+	vector<float> velX, velY, velZ;
+	vector<float> minX, minY, minZ;
+	vector<float> maxX, maxY, maxZ;
+	vector<int> collisionStatus;  // default is 0, and if collision, then set to 1
+
+	AABB restAABB;
+
+private:
+	void resizeLanes(int laneCount);
+
+	int count;
+};
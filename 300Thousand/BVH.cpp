@@ -1,39 +1,562 @@
 #include "BVH.h"
+#include "DynamicAABBTree.h"
+#include "BVHSnapshot.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <chrono>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static double elapsedMs(Clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// objects per lbvh work block, blocks (not threads) split the passes so any thread count sorts the same
+static const int LBVH_BLOCK = 16384;
+
+static int leadingZeros64(unsigned long long x)
+{
+#ifdef _MSC_VER
+	unsigned long bit;
+	return _BitScanReverse64(&bit, x) ? 63 - (int)bit : 64;
+#else
+	return x == 0 ? 64 : __builtin_clzll(x);
+#endif
+}
+
+// spreads the low 10 bits of v so there are two zero bits between each of them
+static unsigned int expandBits(unsigned int v)
+{
+	v = (v * 0x00010001u) & 0xFF0000FFu;
+	v = (v * 0x00000101u) & 0x0F00F00Fu;
+	v = (v * 0x00000011u) & 0xC30C30C3u;
+	v = (v * 0x00000005u) & 0x49249249u;
+	return v;
+}
+
+static float halfArea(const float* bounds)
+{
+	float dx = bounds[3] - bounds[0];
+	float dy = bounds[4] - bounds[1];
+	float dz = bounds[5] - bounds[2];
+	return dx * dy + dy * dz + dz * dx;
+}
+
+static float boxArea(const AABB& aabb)
+{
+	float dx = aabb.maxX - aabb.minX;
+	float dy = aabb.maxY - aabb.minY;
+	float dz = aabb.maxZ - aabb.minZ;
+	return dx * dy + dy * dz + dz * dx;
+}
+
+static void resetBounds(float* bounds)
+{
+	bounds[0] = bounds[1] = bounds[2] = FLT_MAX;
+	bounds[3] = bounds[4] = bounds[5] = -FLT_MAX;
+}
+
+static void growBounds(float* bounds, const float* other)
+{
+	for (int a = 0; a < 3; a++)
+	{
+		bounds[a] = std::min(bounds[a], other[a]);
+		bounds[a + 3] = std::max(bounds[a + 3], other[a + 3]);
+	}
+}
+
+BVH::BVH()
+	: rootIndex(-1), buildCost(0.0f), buildTime(0.0), refitTime(0.0), wideDepth(0), dynamic(false)
+{
+	bindQueryData();
+}
 
-BVH::BVH(vector<SceneObject> objects)
+BVH::BVH(const AgentStore& agents)
+	: rootIndex(-1), buildCost(0.0f), buildTime(0.0), refitTime(0.0), wideDepth(0), dynamic(false)
 {
+	bindQueryData();
+	buildInsertion(agents);
+}
+
+BVH::~BVH()
+{
+}
+
+void BVH::clear()
+{
+	if (dynamicTree)
+		dynamicTree->clear();
+	dynamic = false;
+	bvhNodes.clear();
+	primitiveIndices.clear();
+	refitOrder.clear();
+	flatNodes.clear();
+	flatPrimitives.clear();
+	flatPrimBounds.clear();
+	flatSource.clear();
+	wideNodes.clear();
+	wideSource.clear();
+	wideDepth = 0;
+	bindQueryData();
+	rootIndex = -1;
+	buildCost = 0.0f;
+}
+
+void BVH::buildInsertion(const AgentStore& agents)
+{
+	Clock::time_point start = Clock::now();
+	clear();
+
 	// set objects into bvh node list
-	for (SceneObject object : objects)
+	for (int i = 0; i < agents.size(); i++)
+	{
+		addNode(agents[i].object());
+	}
+	buildCost = getSAHCost();
+	flatten();
+	buildTime = elapsedMs(start);
+}
+
+void BVH::build(const AABBLanes& boxes, const BVHBuildSettings& buildSettings)
+{
+	Clock::time_point start = Clock::now();
+	clear();
+	settings = buildSettings;
+	settings.binCount = std::max(2, settings.binCount);
+	settings.maxLeafSize = std::max(1, settings.maxLeafSize);
+
+	int count = boxes.count;
+	if (count == 0)
+		return;
+
+	// gather the boxes once, the split loops only touch this array
+	primBounds.resize(count * 6);
+	buildPrimitives.resize(count);
+	primitiveIndices.resize(count);
+	for (int i = 0; i < count; i++)
+	{
+		BuildPrimitive& prim = buildPrimitives[i];
+		float* b = prim.bounds;
+		b[0] = boxes.minX[i]; b[1] = boxes.minY[i]; b[2] = boxes.minZ[i];
+		b[3] = boxes.maxX[i]; b[4] = boxes.maxY[i]; b[5] = boxes.maxZ[i];
+		for (int a = 0; a < 3; a++)
+			prim.centroid[a] = (b[a] + b[a + 3]) * 0.5f;
+		prim.object = i;
+		std::copy(b, b + 6, &primBounds[i * 6]);
+	}
+
+	// a binary tree over n leaves has 2n - 1 nodes at most
+	bins.resize(settings.binCount);
+	rightArea.resize(settings.binCount);
+	bvhNodes.reserve(2 * count - 1);
+	rootIndex = buildRange(0, count, -1);
+
+	for (int k = 0; k < count; k++)
+		primitiveIndices[k] = buildPrimitives[k].object;
+	buildCost = getSAHCost();
+	flatten();
+	buildTime = elapsedMs(start);
+}
+
+void BVH::rangeBounds(int begin, int end, float* bounds, float* centroidBounds) const
+{
+	resetBounds(bounds);
+	resetBounds(centroidBounds);
+	for (int k = begin; k < end; k++)
+	{
+		const BuildPrimitive& prim = buildPrimitives[k];
+		growBounds(bounds, prim.bounds);
+
+		const float* c = prim.centroid;
+		for (int a = 0; a < 3; a++)
+		{
+			centroidBounds[a] = std::min(centroidBounds[a], c[a]);
+			centroidBounds[a + 3] = std::max(centroidBounds[a + 3], c[a]);
+		}
+	}
+}
+
+int BVH::buildRange(int begin, int end, int parent)
+{
+	float bounds[6];
+	float centroidBounds[6];
+	rangeBounds(begin, end, bounds, centroidBounds);
+
+	int nodeIndex = bvhNodes.size();
+	AABB aabb(bounds[0], bounds[1], bounds[2], bounds[3], bounds[4], bounds[5]);
+	bvhNodes.push_back(BVHNode(aabb, parent, -1, -1, nodeIndex, -1));
+
+	int count = end - begin;
+	if (count <= settings.maxLeafSize)
+	{
+		// leave node
+		bvhNodes[nodeIndex].indexMapToScene = buildPrimitives[begin].object;
+		bvhNodes[nodeIndex].firstPrimitive = begin;
+		bvhNodes[nodeIndex].primitiveCount = count;
+		return nodeIndex;
+	}
+
+	// bin the centroids on every axis and keep the cheapest plane, cost = area * count on both sides
+	// small ranges do not need more bins than objects, most nodes of the tree are small
+	int binCount = std::min(settings.binCount, std::max(2, count));
+	float bestCost = FLT_MAX;
+	int bestAxis = -1;
+	int bestSplit = 0;
+	for (int a = 0; a < 3; a++)
+	{
+		float extent = centroidBounds[a + 3] - centroidBounds[a];
+		if (extent <= 0.0f)
+			continue;
+
+		for (int b = 0; b < binCount; b++)
+		{
+			resetBounds(bins[b].bounds);
+			bins[b].count = 0;
+		}
+
+		float scale = binCount / extent;
+		for (int k = begin; k < end; k++)
+		{
+			const BuildPrimitive& prim = buildPrimitives[k];
+			int b = std::min(binCount - 1, (int)((prim.centroid[a] - centroidBounds[a]) * scale));
+			growBounds(bins[b].bounds, prim.bounds);
+			bins[b].count++;
+		}
+
+		// right to left sweep for the areas, left to right for the costs
+		float sweep[6];
+		resetBounds(sweep);
+		for (int b = binCount - 1; b > 0; b--)
+		{
+			growBounds(sweep, bins[b].bounds);
+			rightArea[b] = sweep[3] >= sweep[0] ? halfArea(sweep) : 0.0f;
+		}
+
+		resetBounds(sweep);
+		int leftCount = 0;
+		for (int b = 0; b < binCount - 1; b++)
+		{
+			growBounds(sweep, bins[b].bounds);
+			leftCount += bins[b].count;
+
+			int rightCount = count - leftCount;
+			if (leftCount == 0 || rightCount == 0)
+				continue;
+
+			float cost = halfArea(sweep) * leftCount + rightArea[b + 1] * rightCount;
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				bestAxis = a;
+				bestSplit = b + 1;
+			}
+		}
+	}
+
+	int mid = (begin + end) / 2;
+	if (bestAxis != -1)
 	{
-		addNode(object);
+		float lo = centroidBounds[bestAxis];
+		float scale = binCount / (centroidBounds[bestAxis + 3] - lo);
+		BuildPrimitive* split = std::partition(buildPrimitives.data() + begin, buildPrimitives.data() + end, [&](const BuildPrimitive& prim)
+			{
+				return std::min(binCount - 1, (int)((prim.centroid[bestAxis] - lo) * scale)) < bestSplit;
+			});
+		mid = split - buildPrimitives.data();
 	}
 
-	glGenVertexArrays(INSTANCE_NUM - 1, vaos);
-	int count = 0;
-	//std::cout << "````````````````" << std::endl;
-	for (int i = 0; i < bvhNodes.size(); i++)
+	// all centroids on one spot, any halving is as good as another
+	if (mid == begin || mid == end)
+		mid = (begin + end) / 2;
+
+	int left = buildRange(begin, mid, nodeIndex);
+	int right = buildRange(mid, end, nodeIndex);
+	bvhNodes[nodeIndex].leftChildNode = left;
+	bvhNodes[nodeIndex].rightChildNode = right;
+
+	return nodeIndex;
+}
+
+void BVH::buildLBVH(const AABBLanes& boxes, ThreadPool& pool)
+{
+	Clock::time_point start = Clock::now();
+	clear();
+
+	int count = boxes.count;
+	if (count == 0)
+		return;
+
+	int blockCount = (count + LBVH_BLOCK - 1) / LBVH_BLOCK;
+	primBounds.resize(count * 6);
+	mortonCodes.resize(count);
+	mortonObjects.resize(count);
+	blockBounds.resize(blockCount * 6);
+
+	// centroid bounds, one partial per block
+	pool.parallelFor(blockCount, [this, &boxes, count](int blockBegin, int blockEnd, int)
+		{
+			for (int block = blockBegin; block < blockEnd; block++)
+			{
+				float* bounds = &blockBounds[block * 6];
+				resetBounds(bounds);
+				for (int i = block * LBVH_BLOCK; i < std::min(count, (block + 1) * LBVH_BLOCK); i++)
+				{
+					float c[3] = { (boxes.minX[i] + boxes.maxX[i]) * 0.5f, (boxes.minY[i] + boxes.maxY[i]) * 0.5f, (boxes.minZ[i] + boxes.maxZ[i]) * 0.5f };
+					for (int a = 0; a < 3; a++)
+					{
+						bounds[a] = std::min(bounds[a], c[a]);
+						bounds[a + 3] = std::max(bounds[a + 3], c[a]);
+					}
+				}
+			}
+		}, 1);
+
+	float centroidBounds[6];
+	resetBounds(centroidBounds);
+	for (int block = 0; block < blockCount; block++)
+		growBounds(centroidBounds, &blockBounds[block * 6]);
+
+	// 10 bits per axis over the centroid bounds, a flat axis maps to 0
+	float scale[3];
+	for (int a = 0; a < 3; a++)
 	{
-		if (bvhNodes[i].indexMapToScene == -1)
+		float extent = centroidBounds[a + 3] - centroidBounds[a];
+		scale[a] = extent > 0.0f ? 1023.0f / extent : 0.0f;
+	}
+
+	pool.parallelFor(count, [this, &boxes, &centroidBounds, &scale](int begin, int end, int)
 		{
-			//std::cout << i << std::endl;
-			glBindVertexArray(vaos[count]);
-			vbos[count] = BVH::createAABBVbo(bvhNodes[i].aabb);
-			glEnableVertexAttribArray(0);
-			glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
-			glBindVertexArray(0);
-			count++;
+			for (int i = begin; i < end; i++)
+			{
+				float* b = &primBounds[i * 6];
+				b[0] = boxes.minX[i]; b[1] = boxes.minY[i]; b[2] = boxes.minZ[i];
+				b[3] = boxes.maxX[i]; b[4] = boxes.maxY[i]; b[5] = boxes.maxZ[i];
+
+				unsigned int q[3];
+				for (int a = 0; a < 3; a++)
+					q[a] = (unsigned int)std::min(1023.0f, std::max(0.0f, ((b[a] + b[a + 3]) * 0.5f - centroidBounds[a]) * scale[a]));
+
+				mortonCodes[i] = (expandBits(q[0]) << 2) | (expandBits(q[1]) << 1) | expandBits(q[2]);
+				mortonObjects[i] = i;
+			}
+		});
+
+	sortMortonCodes(pool);
+
+	// every internal node finds its range and split on its own
+	int leafStart = count - 1;
+	bvhNodes.resize(2 * count - 1, BVHNode(AABB(0, 0, 0, 0, 0, 0), -1, -1, -1, 0, -1));
+	primitiveIndices.resize(count);
+	pool.parallelFor(count - 1, [this](int begin, int end, int)
+		{
+			for (int i = begin; i < end; i++)
+				emitInternalNode(i);
+		});
+
+	// leaves, then walk up, the second child to arrive fits the parent
+	if (fitVisitCapacity < count)
+	{
+		fitVisits.reset(new atomic<int>[count]);
+		fitVisitCapacity = count;
+	}
+	for (int i = 0; i < count - 1; i++)
+		fitVisits[i].store(0, memory_order_relaxed);
+
+	pool.parallelFor(count, [this, leafStart](int begin, int end, int)
+		{
+			for (int j = begin; j < end; j++)
+			{
+				int object = mortonObjects[j];
+				const float* b = &primBounds[object * 6];
+				BVHNode& leaf = bvhNodes[leafStart + j];
+				leaf.aabb = AABB(b[0], b[1], b[2], b[3], b[4], b[5]);
+				leaf.index = leafStart + j;
+				leaf.indexMapToScene = object;
+				leaf.firstPrimitive = j;
+				leaf.primitiveCount = 1;
+				primitiveIndices[j] = object;
+
+				int node = leaf.parentNode;
+				while (node != -1 && fitVisits[node].fetch_add(1, memory_order_acq_rel) == 1)
+				{
+					BVHNode& parent = bvhNodes[node];
+					parent.aabb = bvhNodes[parent.leftChildNode].aabb.unions(bvhNodes[parent.rightChildNode].aabb);
+					node = parent.parentNode;
+				}
+			}
+		});
+
+	rootIndex = 0;
+	buildCost = getSAHCost();
+	flatten();
+	buildTime = elapsedMs(start);
+}
+
+void BVH::sortMortonCodes(ThreadPool& pool)
+{
+	// lsd radix sort, 8 bit digits, stable, every block counts and scatters its own slice
+	int count = mortonCodes.size();
+	int blockCount = (count + LBVH_BLOCK - 1) / LBVH_BLOCK;
+	sortCodes.resize(count);
+	sortObjects.resize(count);
+	blockHistogram.resize(blockCount * 256);
+
+	for (int shift = 0; shift < 30; shift += 8)
+	{
+		pool.parallelFor(blockCount, [this, count, shift](int blockBegin, int blockEnd, int)
+			{
+				for (int block = blockBegin; block < blockEnd; block++)
+				{
+					int* histogram = &blockHistogram[block * 256];
+					std::fill(histogram, histogram + 256, 0);
+					for (int i = block * LBVH_BLOCK; i < std::min(count, (block + 1) * LBVH_BLOCK); i++)
+						histogram[(mortonCodes[i] >> shift) & 0xFF]++;
+				}
+			}, 1);
+
+		// digit major, block minor, so equal digits keep the block order
+		int offset = 0;
+		for (int digit = 0; digit < 256; digit++)
+		{
+			for (int block = 0; block < blockCount; block++)
+			{
+				int n = blockHistogram[block * 256 + digit];
+				blockHistogram[block * 256 + digit] = offset;
+				offset += n;
+			}
 		}
+
+		pool.parallelFor(blockCount, [this, count, shift](int blockBegin, int blockEnd, int)
+			{
+				for (int block = blockBegin; block < blockEnd; block++)
+				{
+					int* cursor = &blockHistogram[block * 256];
+					for (int i = block * LBVH_BLOCK; i < std::min(count, (block + 1) * LBVH_BLOCK); i++)
+					{
+						int k = cursor[(mortonCodes[i] >> shift) & 0xFF]++;
+						sortCodes[k] = mortonCodes[i];
+						sortObjects[k] = mortonObjects[i];
+					}
+				}
+			}, 1);
+
+		mortonCodes.swap(sortCodes);
+		mortonObjects.swap(sortObjects);
 	}
-	//std::cout << "````````````````" << std::endl;
+}
 
-	//std::cout << count << " --------- " << std::endl;
+int BVH::commonPrefix(int i, int j) const
+{
+	int count = mortonCodes.size();
+	if (j < 0 || j >= count)
+		return -1;
+
+	// equal codes fall back to the leaf position, so every key is unique
+	unsigned long long a = ((unsigned long long)mortonCodes[i] << 32) | (unsigned int)i;
+	unsigned long long b = ((unsigned long long)mortonCodes[j] << 32) | (unsigned int)j;
+	return leadingZeros64(a ^ b);
 }
 
-BVH::~BVH()
+void BVH::emitInternalNode(int i)
+{
+	int leafStart = mortonCodes.size() - 1;
+
+	// direction of the range: towards the neighbour sharing the longer prefix
+	int d = commonPrefix(i, i + 1) - commonPrefix(i, i - 1) >= 0 ? 1 : -1;
+	int minPrefix = commonPrefix(i, i - d);
+
+	// upper bound of the range length, then binary search for the other end
+	int maxLength = 2;
+	while (commonPrefix(i, i + maxLength * d) > minPrefix)
+		maxLength *= 2;
+
+	int length = 0;
+	for (int t = maxLength / 2; t >= 1; t /= 2)
+	{
+		if (commonPrefix(i, i + (length + t) * d) > minPrefix)
+			length += t;
+	}
+	int j = i + length * d;
+
+	// split: the last leaf that still shares more than the prefix of the whole range
+	int nodePrefix = commonPrefix(i, j);
+	int split = 0;
+	for (int t = (length + 1) / 2; ; t = (t + 1) / 2)
+	{
+		if (commonPrefix(i, i + (split + t) * d) > nodePrefix)
+			split += t;
+		if (t == 1)
+			break;
+	}
+	int gamma = i + split * d + std::min(d, 0);
+
+	int left = std::min(i, j) == gamma ? leafStart + gamma : gamma;
+	int right = std::max(i, j) == gamma + 1 ? leafStart + gamma + 1 : gamma + 1;
+
+	BVHNode& node = bvhNodes[i];
+	node.index = i;
+	node.indexMapToScene = -1;
+	node.firstPrimitive = -1;
+	node.primitiveCount = 0;
+	node.leftChildNode = left;
+	node.rightChildNode = right;
+	if (i == 0)
+		node.parentNode = -1;
+
+	// each node has exactly one parent, so no two threads write the same child
+	bvhNodes[left].parentNode = i;
+	bvhNodes[right].parentNode = i;
+}
+
+AABB BVH::primitiveAABB(int object) const
 {
-	glDeleteVertexArrays(INSTANCE_NUM - 1, vaos);
-	glDeleteBuffers(INSTANCE_NUM - 1, vbos);
-	std::fill_n(draw_status, INSTANCE_NUM - 1, 0);
+	const float* b = &primBounds[object * 6];
+	return AABB(b[0], b[1], b[2], b[3], b[4], b[5]);
+}
+
+float BVH::getSAHCost() const
+{
+	if (dynamic)
+		return dynamicTree->getSAHCost();
+	if (bvhNodes.empty() && queryFlatCount == 0)
+		return 0.0f;
+
+	// one box test per visited node plus one per object in a visited leaf, a node is visited with
+	// the probability area(node) / area(root). a snapshot has only its flat nodes, slot 0 is the root
+	if (bvhNodes.empty())
+	{
+		const BVHFlatNode& root = queryFlat[0];
+		float rootBounds[6] = { root.min[0], root.min[1], root.min[2], root.max[0], root.max[1], root.max[2] };
+		float rootArea = std::max(halfArea(rootBounds), FLT_MIN);
+		float cost = 0.0f;
+		for (int slot = 0; slot < queryFlatCount; slot++)
+		{
+			const BVHFlatNode& flat = queryFlat[slot];
+			float bounds[6] = { flat.min[0], flat.min[1], flat.min[2], flat.max[0], flat.max[1], flat.max[2] };
+			float p = halfArea(bounds) / rootArea;
+			cost += flat.count == 0 ? p : p * (1 + flat.count);
+		}
+		return cost;
+	}
+
+	const AABB& root = bvhNodes[rootIndex].aabb;
+	float rootBounds[6] = { root.minX, root.minY, root.minZ, root.maxX, root.maxY, root.maxZ };
+	float rootArea = std::max(halfArea(rootBounds), FLT_MIN);
+
+	float cost = 0.0f;
+	for (const BVHNode& node : bvhNodes)
+	{
+		float bounds[6] = { node.aabb.minX, node.aabb.minY, node.aabb.minZ, node.aabb.maxX, node.aabb.maxY, node.aabb.maxZ };
+		float p = halfArea(bounds) / rootArea;
+		cost += node.indexMapToScene == -1 ? p : p * (1 + node.primitiveCount);
+	}
+
+	return cost;
 }
 
 void BVH::addNode(SceneObject object)
@@ -42,6 +565,8 @@ void BVH::addNode(SceneObject object)
 	{
 		// create root node
 		BVHNode node(object.aabb, -1, -1, -1, 0, object.index);
+		node.firstPrimitive = primitiveIndices.size();
+		primitiveIndices.push_back(object.index);
 		bvhNodes.push_back(node);
 		rootIndex = 0;
 	}
@@ -71,6 +596,8 @@ void BVH::addNode(SceneObject object)
 
 		// create new leave node
 		BVHNode leave_node(aabb_1, branch_node_index, -1, -1, node_1_index, object.index);
+		leave_node.firstPrimitive = primitiveIndices.size();
+		primitiveIndices.push_back(object.index);
 		bvhNodes.push_back(leave_node);
 
 		// crate branch node with new aabb (use -1 as the branch node)
@@ -102,46 +629,6 @@ void BVH::addNode(SceneObject object)
 	}
 }
 
-void BVH::updateNode(int objectNodeIndex, int parentNodeIndex)
-{
-	AABB aabb_1 = bvhNodes[objectNodeIndex].aabb;
-
-	// find closet node 2
-	int node_2_index = findClosestNode(aabb_1, rootIndex);
-	BVHNode node_2 = bvhNodes[node_2_index];
-	AABB aabb_2 = node_2.aabb;
-	int node_2_parent_index = node_2.parentNode;
-
-	// create new bounding box
-	AABB aabb_new = aabb_1.unions(aabb_2);
-
-	// update branch node (no need to update leave node because its parent is the same)
-	bvhNodes[parentNodeIndex].leftChildNode = node_2_index;
-	bvhNodes[parentNodeIndex].rightChildNode = objectNodeIndex;
-	bvhNodes[parentNodeIndex].parentNode = node_2_parent_index;
-
-	// update closest node
-	bvhNodes[node_2_index].parentNode = parentNodeIndex;
-
-	// update parent node
-	if (node_2_index == rootIndex) {
-		rootIndex = parentNodeIndex;
-	}
-	else
-	{
-		// parent root is not null
-		if (bvhNodes[node_2_parent_index].leftChildNode == node_2_index)
-		{
-			bvhNodes[node_2_parent_index].leftChildNode = parentNodeIndex;
-		}
-		else if (bvhNodes[node_2_parent_index].rightChildNode == node_2_index)
-		{
-			bvhNodes[node_2_parent_index].rightChildNode = parentNodeIndex;
-		}
-		refitParentAABBInBVH(node_2_parent_index);
-	}
-}
-
 int BVH::findClosestNode(AABB aabb, int nodeIndex)
 {
 	// first compare with root, then with other branch node
@@ -186,24 +673,6 @@ void BVH::refitParentAABBInBVH(int nodeIndex)
 		refitParentAABBInBVH(bvhNodes[nodeIndex].parentNode);
 }
 
-void BVH::traverseBVHByLayer(int index, int curr_layer, int target_layer)
-{
-	if (curr_layer == target_layer && bvhNodes[index].indexMapToScene == -1)
-	{
-		// set the layer mark
-		draw_status[index] = 1;
-		return;
-	}
-
-	if (bvhNodes[index].indexMapToScene == -1)
-	{
-		// branch node
-		traverseBVHByLayer(bvhNodes[index].leftChildNode, curr_layer + 1, target_layer);
-		traverseBVHByLayer(bvhNodes[index].rightChildNode, curr_layer + 1, target_layer);
-	}
-	
-}
-
 void BVH::traverseBVH(int index)
 {
 	// print node
@@ -222,265 +691,259 @@ void BVH::traverseBVH(int index)
 	}
 }
 
-// should access whether draw the bvh
-void BVH::updateBVH()
+void BVH::refit(const AABBLanes& boxes, bool rotate)
 {
-	if (bvhNodes.size() == 1)
+	Clock::time_point start = Clock::now();
+	if (dynamic)
+	{
+		dynamicTree->refit(boxes);
+		refitTime = elapsedMs(start);
 		return;
+	}
 
-	if (bvhNodes.size() == 3)
+	// a snapshot is refit in its flat slots, the nodes are only unpacked for the first rotation
+	if (snapshot)
+		unpackSnapshot();
+	if (bvhNodes.empty() && !flatNodes.empty())
 	{
-		bvhNodes[2].aabb = bvhNodes[0].aabb.unions(bvhNodes[1].aabb);
-		return;
+		if (!rotate)
+		{
+			refitFlatSlots(boxes);
+			refitTime = elapsedMs(start);
+			return;
+		}
+		unpackNodes();
 	}
+	if (rootIndex == -1)
+		return;
+
+	if (refitOrder.empty())
+		computeRefitOrder();
 
-	for (int i = 0; i < bvhNodes.size(); i++)
+	// children come before their parents in refitOrder, so every branch sees refitted children
+	primBounds.resize(boxes.count * 6);
+	bool rotated = false;
+	for (int nodeIndex : refitOrder)
 	{
-		BVHNode node = bvhNodes[i];
+		BVHNode& node = bvhNodes[nodeIndex];
 		if (node.indexMapToScene != -1)
 		{
-			// leave node
-			int parent_index = node.parentNode;
-			int left_child_index = bvhNodes[parent_index].leftChildNode;
-			int right_child_index = bvhNodes[parent_index].rightChildNode;
-			int parent_of_parent_index = bvhNodes[parent_index].parentNode;
-			int p_of_p_left_child_index = bvhNodes[parent_of_parent_index].leftChildNode;
-			int p_of_p_right_child_index = bvhNodes[parent_of_parent_index].rightChildNode;
-
-			if (i == left_child_index)
-			{
-				// set right child as the leave node, fake delete the parent node and current node
-				// update another leaves node
-				bvhNodes[right_child_index].parentNode = parent_of_parent_index;
-
-				// update parent's parnets child node as the another leaves node
-				if (parent_index == p_of_p_left_child_index)
-					bvhNodes[parent_of_parent_index].leftChildNode = right_child_index;
-				else if (parent_index == p_of_p_right_child_index)
-					bvhNodes[parent_of_parent_index].rightChildNode = right_child_index;
-			}
-			else if (i == right_child_index)
+			// leave node, union of its objects
+			float bounds[6];
+			resetBounds(bounds);
+			for (int k = node.firstPrimitive; k < node.firstPrimitive + node.primitiveCount; k++)
 			{
-				// set left child as the leave node, remove the parent with same method
-				bvhNodes[left_child_index].parentNode = parent_of_parent_index;
-
-				if (parent_index == p_of_p_left_child_index)
-					bvhNodes[parent_of_parent_index].leftChildNode = left_child_index;
-				else if (parent_index == p_of_p_right_child_index)
-					bvhNodes[parent_of_parent_index].rightChildNode = left_child_index;
+				int object = primitiveIndices[k];
+				float* b = &primBounds[object * 6];
+				b[0] = boxes.minX[object]; b[1] = boxes.minY[object]; b[2] = boxes.minZ[object];
+				b[3] = boxes.maxX[object]; b[4] = boxes.maxY[object]; b[5] = boxes.maxZ[object];
+				growBounds(bounds, b);
 			}
-
-			// update parent aabb 
-			refitParentAABBInBVH(parent_of_parent_index);
-
-			// add the fake delte two nodes
-			updateNode(i, parent_index);
+			node.aabb = AABB(bounds[0], bounds[1], bounds[2], bounds[3], bounds[4], bounds[5]);
+		}
+		else
+		{
+			node.aabb = bvhNodes[node.leftChildNode].aabb.unions(bvhNodes[node.rightChildNode].aabb);
+			if (rotate && rotateNode(nodeIndex))
+				rotated = true;
 		}
 	}
 
-	// update bvh data to draw
-	int count = 0;
-	for (int i = 0; i < bvhNodes.size(); i++)
+	// a rotation moves subtrees between levels, the order and the layouts are rebuilt
+	if (rotated)
 	{
-		if (bvhNodes[i].indexMapToScene == -1)
-		{
-			std::cout << vbos[count] << std::endl;
-			// update the aabb box vertex data
-			vector<glm::vec3> vertices = BVH::generateAABBvertices(bvhNodes[i].aabb);
-
-			// update aabb vbo
-			glBindBuffer(GL_ARRAY_BUFFER, vbos[count]);
-			glBufferSubData(GL_ARRAY_BUFFER, 0, 24 * sizeof(glm::vec3), vertices.data());
-			glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-			count++;
-		}
+		refitOrder.clear();
+		flatten();
 	}
+	else
+		refitFlatBounds();
+	refitTime = elapsedMs(start);
 }
 
-GLuint BVH::createAABBVbo(AABB aabb)
+void BVH::refitFlatSlots(const AABBLanes& boxes)
 {
-	vector<glm::vec3> boundingBoxVertices = generateAABBvertices(aabb);
-
-	GLuint vbo;
-	glGenBuffers(1, &vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * 24, boundingBoxVertices.data(), GL_STATIC_DRAW);
+	// children sit behind their parent, so going backwards every branch sees refitted children
+	for (int slot = (int)flatNodes.size() - 1; slot >= 0; slot--)
+	{
+		BVHFlatNode& flat = flatNodes[slot];
+		float bounds[6];
+		if (flat.count > 0)
+		{
+			resetBounds(bounds);
+			for (int k = flat.offset; k < flat.offset + flat.count; k++)
+			{
+				int object = flatPrimitives[k];
+				float* b = &flatPrimBounds[k * 6];
+				b[0] = boxes.minX[object]; b[1] = boxes.minY[object]; b[2] = boxes.minZ[object];
+				b[3] = boxes.maxX[object]; b[4] = boxes.maxY[object]; b[5] = boxes.maxZ[object];
+				growBounds(bounds, b);
+			}
+		}
+		else
+		{
+			const BVHFlatNode& first = flatNodes[slot + 1];
+			const BVHFlatNode& second = flatNodes[flat.offset];
+			for (int a = 0; a < 3; a++)
+			{
+				bounds[a] = std::min(first.min[a], second.min[a]);
+				bounds[a + 3] = std::max(first.max[a], second.max[a]);
+			}
+		}
+		std::copy(bounds, bounds + 3, flat.min);
+		std::copy(bounds + 3, bounds + 6, flat.max);
+	}
 
-	return vbo;
+	// the wide child slots are only known once the wide nodes were collapsed from the flat ones
+	if (wideSource.empty())
+		collapseWide();
+	else
+		refitWideBounds();
+	bindQueryData();
 }
 
-vector<vec3> BVH::generateAABBvertices(const AABB aabb)
+bool BVH::rotateNode(int nodeIndex)
 {
-	//std::cout << aabb.minX << ", " << aabb.minY << ", " << aabb.minZ << ", " << aabb.maxX << ", " << aabb.maxY << ", " << aabb.maxZ << std::endl;
-	vector<glm::vec3> boundingBoxVerties;
-
-	/*boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.maxY, aabb.maxZ));
-	boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.minY, aabb.maxZ));
-	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.maxY, aabb.maxZ));
-
-	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.maxY, aabb.maxZ));
-	boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.minY, aabb.maxZ));
-	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.minY, aabb.maxZ));
-
-	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.maxY, aabb.maxZ));
-	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.minY, aabb.maxZ));
-	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.maxY, aabb.minZ));
-
-	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.maxY, aabb.minZ));
-	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.minY, aabb.maxZ));
-	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.minY, aabb.minZ));
-
-	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.maxY, aabb.minZ));
-	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.minY, aabb.minZ));
-	boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.minY, aabb.minZ));
-
-	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.maxY, aabb.minZ));
-	boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.minY, aabb.minZ));
-	boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.maxY, aabb.minZ));
-
-	boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.maxY, aabb.minZ));
-	boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.minY, aabb.minZ));
-	boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.maxY, aabb.maxZ));
-
-	boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.maxY, aabb.maxZ));
-	boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.minY, aabb.minZ));
-	boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.minY, aabb.maxZ));
-
-	boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.maxY, aabb.minZ));
-	boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.maxY, aabb.maxZ));
-	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.maxY, aabb.minZ));
-
-	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.maxY, aabb.minZ));
-	boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.maxY, aabb.maxZ));
-	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.maxY, aabb.maxZ));
-
-	boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.minY, aabb.minZ));
-	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.minY, aabb.minZ));
-	boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.minY, aabb.maxZ));
-
-	boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.minY, aabb.maxZ));
-	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.minY, aabb.minZ));
-	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.minY, aabb.maxZ));*/
-
-	// front face
-	boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.maxY, aabb.maxZ));  // top left
-	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.maxY, aabb.maxZ));  // top right
-	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.minY, aabb.maxZ));  // bottom right
-	boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.minY, aabb.maxZ));  // bottom left
-
-	// right face
-	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.maxY, aabb.maxZ));
-	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.maxY, aabb.minZ));
-	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.minY, aabb.minZ));
-	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.minY, aabb.maxZ));
+	// kensler rotations: swap one child with a grandchild on the other side when that shrinks the
+	// area of the child that changes, the node itself keeps the same objects and box
+	int children[2] = { bvhNodes[nodeIndex].leftChildNode, bvhNodes[nodeIndex].rightChildNode };
+
+	float bestGain = 0.0f;
+	int bestChild = -1;      // child that stays and gets a new grandchild
+	int bestGrandchild = -1; // 0 = left, 1 = right grandchild that moves up
+	for (int side = 0; side < 2; side++)
+	{
+		const BVHNode& keep = bvhNodes[children[1 - side]];
+		if (keep.indexMapToScene != -1)
+			continue;
+
+		const AABB& moving = bvhNodes[children[side]].aabb;
+		float before = boxArea(keep.aabb);
+		int grandchildren[2] = { keep.leftChildNode, keep.rightChildNode };
+		for (int g = 0; g < 2; g++)
+		{
+			// the moving child replaces grandchild g, so keep becomes moving + the other grandchild
+			float gain = before - boxArea(moving.unions(bvhNodes[grandchildren[1 - g]].aabb));
+			if (gain > bestGain)
+			{
+				bestGain = gain;
+				bestChild = 1 - side;
+				bestGrandchild = g;
+			}
+		}
+	}
 
-	// back face
-	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.maxY, aabb.minZ));
-	boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.maxY, aabb.minZ));
-	boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.minY, aabb.minZ));
-	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.minY, aabb.minZ));
+	if (bestChild == -1)
+		return false;
 
-	// left face
-	boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.maxY, aabb.minZ));
-	boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.maxY, aabb.maxZ));
-	boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.minY, aabb.maxZ));
-	boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.minY, aabb.minZ));
+	int keepIndex = children[bestChild];
+	int movingIndex = children[1 - bestChild];
+	BVHNode& keep = bvhNodes[keepIndex];
+	int upIndex = bestGrandchild == 0 ? keep.leftChildNode : keep.rightChildNode;
 
-	// top face
-	boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.maxY, aabb.minZ));
-	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.maxY, aabb.minZ));
-	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.maxY, aabb.maxZ));
-	boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.maxY, aabb.maxZ));
+	if (bestGrandchild == 0)
+		keep.leftChildNode = movingIndex;
+	else
+		keep.rightChildNode = movingIndex;
+	bvhNodes[movingIndex].parentNode = keepIndex;
 
-	// bottom face
-	boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.minY, aabb.minZ));
-	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.minY, aabb.minZ));
-	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.minY, aabb.maxZ));
-	boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.minY, aabb.maxZ));
+	if (bestChild == 0)
+		bvhNodes[nodeIndex].rightChildNode = upIndex;
+	else
+		bvhNodes[nodeIndex].leftChildNode = upIndex;
+	bvhNodes[upIndex].parentNode = nodeIndex;
 
-	return boundingBoxVerties;
+	keep.aabb = bvhNodes[keep.leftChildNode].aabb.unions(bvhNodes[keep.rightChildNode].aabb);
+	return true;
 }
 
-void BVH::drawBVH()
+void BVH::computeRefitOrder()
 {
-	for (int i = 0; i < INSTANCE_NUM - 1; i++)
+	// post-order without recursion, the trees can be deep after many rotations
+	refitOrder.clear();
+	refitOrder.reserve(bvhNodes.size());
+	vector<int> stack(1, rootIndex);
+	while (!stack.empty())
 	{
-		glBindVertexArray(vaos[i]);
-		glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-		//glDrawArrays(GL_TRIANGLES, 0, 36);
-		glDrawArrays(GL_QUADS, 0, 24);
-		glBindVertexArray(0);
-	}
-}
-
-void BVH::drawBVHInLayer(int draw_layer)
-{
-	// set the layer mark
-	traverseBVHByLayer(rootIndex, 0, draw_layer);
+		int nodeIndex = stack.back();
+		stack.pop_back();
+		refitOrder.push_back(nodeIndex);
 
-	for (int i = 0; i < INSTANCE_NUM - 1; i++)
-	{
-		if (draw_status[2*i + 2] == 1)
+		if (bvhNodes[nodeIndex].indexMapToScene == -1)
 		{
-			glBindVertexArray(vaos[i]);
-			glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-			//glDrawArrays(GL_TRIANGLES, 0, 36);
-			glDrawArrays(GL_QUADS, 0, 24);
-			glBindVertexArray(0);
+			stack.push_back(bvhNodes[nodeIndex].leftChildNode);
+			stack.push_back(bvhNodes[nodeIndex].rightChildNode);
 		}
 	}
 
+	// reversed pre-order puts every child before its parent
+	std::reverse(refitOrder.begin(), refitOrder.end());
 }
 
-int BVH::getRootIndex()
+float BVH::getBuildSAHCost() const
 {
-	return rootIndex;
+	return buildCost;
 }
 
-vector<int> BVH::CollisionDetection(AABB aabb, int sceneIndex)
+double BVH::getBuildTime() const
 {
-	vector<int> collisionObjects;  // record the sceneIndex of the collisions
-	int nodeIndex = 0;
+	return buildTime;
+}
 
-	// map to the bvh index
-	if (sceneIndex == 0)
-		nodeIndex = 0;
-	else
-		nodeIndex = (sceneIndex - 1) * 2 + 1;
+double BVH::getRefitTime() const
+{
+	return refitTime;
+}
 
-	searchCollision(aabb, nodeIndex, rootIndex, collisionObjects);
+int BVH::getPrimitiveCount() const
+{
+	// the query copy has every object of the static trees, a snapshot has nothing else
+	return dynamic ? dynamicTree->getProxyCount() : queryPrimitiveCount;
+}
 
-	return collisionObjects;
+void BVH::updateDynamic(const AgentStore& agents, const BVHBuildSettings& buildSettings)
+{
+	if (!dynamic)
+	{
+		// the static trees and their query copies are dropped, the proxies start from scratch
+		clear();
+		if (!dynamicTree)
+			dynamicTree.reset(new DynamicAABBTree());
+		dynamic = true;
+	}
 
+	Clock::time_point start = Clock::now();
+	dynamicTree->margin = buildSettings.fatMargin;
+	dynamicTree->predictTime = buildSettings.predictTime;
+	dynamicTree->update(agents);
+	refitTime = elapsedMs(start);
 }
 
-void BVH::searchCollision(AABB aabb, int nodeIndex, int searchNodeIndex, vector<int>& collisions)
+bool BVH::isDynamic() const
 {
-	if (nodeIndex == searchNodeIndex)
-		return;
-
-	BVHNode node = bvhNodes[searchNodeIndex];
+	return dynamic;
+}
 
-	if (aabb.overlap(node.aabb))
-	{
-		// overlap with the box
-		if (node.indexMapToScene == -1)
-		{
-			// branch collision
-			searchCollision(aabb, nodeIndex, node.leftChildNode, collisions);
-			searchCollision(aabb, nodeIndex, node.rightChildNode, collisions);
-		}
-		else
-		{
-			// leave collisoin
-			// care about the replication situation (a,b) vs (b,a)
-			if (nodeIndex < searchNodeIndex)
-				collisions.push_back(node.indexMapToScene);
-		}
-	}
+int BVH::getReinsertCount() const
+{
+	return dynamic ? dynamicTree->getReinsertCount() : 0;
 }
 
+int BVH::getRootIndex() const
+{
+	return dynamic ? dynamicTree->getRootIndex() : rootIndex;
+}
 
+int BVH::getNodeCount() const
+{
+	return dynamic ? dynamicTree->getNodeCount() : bvhNodes.size();
+}
 
+const BVHNode& BVH::getNode(int index) const
+{
+	return dynamic ? dynamicTree->getNode(index) : bvhNodes[index];
+}
 
+int BVH::getPrimitive(int k) const
+{
+	return primitiveIndices[k];
+}
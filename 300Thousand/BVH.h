@@ -1,27 +1,31 @@
 #pragma once
-#include "AABB.h";
-#include <GL/glew.h>
-#include <GLFW/glfw3.h>
+#include "AABB.h"
 #include <vector>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtx/transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include "SceneObject.h"
-#include "Constants.hpp"
-#include "ShaderLocs.h"
+#include "AgentStore.h"
+#include "ThreadPool.h"
+#include <atomic>
+#include <memory>
+#include <string>
 
 using namespace std;
 using namespace glm;
 
 /*
  when node is root, its parentNode = -1, when node is leaf, its childnode = -1, -1 equals null
+ no gl in here so the tree also runs headless, drawing lives in BVHRenderer
+ a leaf holds primitiveCount objects from primitiveIndices[firstPrimitive], indexMapToScene is the first one
 */
 
 struct BVHNode
 {
 	BVHNode(AABB aabb, int parenetNode, int leftChildNode, int rightChildNode, int index, int indexInMapToScene)
-		: aabb(aabb), parentNode(parenetNode), leftChildNode(leftChildNode), rightChildNode(rightChildNode), index(index), indexMapToScene(indexInMapToScene) {};
+		: aabb(aabb), parentNode(parenetNode), leftChildNode(leftChildNode), rightChildNode(rightChildNode), index(index), indexMapToScene(indexInMapToScene),
+		firstPrimitive(-1), primitiveCount(indexInMapToScene == -1 ? 0 : 1) {};
 
 	AABB aabb;
 	int parentNode;
@@ -29,35 +33,265 @@ struct BVHNode
 	int rightChildNode;
 	int index;
 	int indexMapToScene;
+	int firstPrimitive;
+	int primitiveCount;
 };
 
+/*
+ 32 byte node of the query copy of the tree, in depth first order. a branch has count 0, its first child
+ is the next node and offset is the second one. a leaf holds count objects from offset in the flat
+ primitives. the first child of a branch is always the smaller subtree, that bounds the query stack.
+*/
+
+struct BVHFlatNode
+{
+	float min[3];
+	int offset;
+	float max[3];
+	int count;
+};
+static_assert(sizeof(BVHFlatNode) == 32, "two nodes per cache line");
+
+static const int BVH_STACK_SIZE = 64;  // deeper than log2 of any node count
+
+/*
+ node of the 4 wide query tree, collapsed from the flat one, one cache line. only x and y like
+ AABB::overlap. the children are quantized to 8 bits inside the parent box: child bound =
+ origin + q * scale, rounded outwards so a child never looks smaller than it is. a child with count 0
+ is the wide node child[k], otherwise a leaf of count objects from flat primitive slot child[k].
+*/
+
+struct BVHWideNode
+{
+	float origin[2];
+	float scale[2];
+	unsigned char lo[2][4];   // [axis][child], lo and hi are loaded together
+	unsigned char hi[2][4];
+	int child[4];
+	unsigned short count[4];
+	int childMask;            // bit per used child
+	int unused;
+};
+static_assert(sizeof(BVHWideNode) == 64, "one node per cache line");
+
+static const int BVH_SELF_TASKS = 256;  // subtree pairs findPairs splits the descent into
+static const int BVH_CULL_TASKS = 64;   // subtrees the threaded frustum query splits the descent into
+
+static const int BVH_WIDE_STACK_SIZE = 256;  // deeper wide trees (long insertion builds) use the binary query
+
+enum BVHBuildType { BVH_INSERTION = 0, BVH_BINNED_SAH = 1, BVH_LBVH = 2, BVH_DYNAMIC = 3 };
+
+struct BVHBuildSettings
+{
+	int binCount = 16;      // sah candidates per axis
+	int maxLeafSize = 1;    // objects per leaf, leaves split until they are at most this big
+	float fatMargin = 0.5f;     // dynamic tree: fat box growth on every side
+	float predictTime = 0.1f;   // dynamic tree: seconds of velocity the fat box is stretched by
+};
+
+// what queries cost, summed over every query that is handed the same stats
+struct BVHQueryStats
+{
+	long long queries = 0;
+	long long nodesVisited = 0;  // binary, wide or dynamic nodes, whichever the query walked
+	long long boxTests = 0;      // node and child boxes plus the exact object boxes
+	long long results = 0;
+
+	void add(int visited, int tests, int found)
+	{
+		queries++;
+		nodesVisited += visited;
+		boxTests += tests;
+		results += found;
+	}
+};
+
+class DynamicAABBTree;
+class MappedFile;
+
 class BVH
 {
 public:
-	BVH(const vector<SceneObject>);
+	BVH();
+	BVH(const AgentStore& agents);  // insertion build
 	~BVH();
+
+	// top-down binned sah build over a span of boxes, nodes come out depth first with the left child
+	// right after its parent, the vectors are kept between builds
+	void build(const AABBLanes& boxes, const BVHBuildSettings& settings = BVHBuildSettings());
+	void buildInsertion(const AgentStore& agents);
+
+	// linear bvh: 30 bit morton codes of the box centers, radix sort, karras hierarchy and a bottom-up
+	// fit, every step split over the pool. internal nodes are 0 .. n - 2 (root 0), leaves n - 1 .. 2n - 2
+	// in morton order. the tree is the same for any thread count.
+	void buildLBVH(const AABBLanes& boxes, ThreadPool& pool);
+
+	// switches to the incremental tree (DynamicAABBTree) and moves its proxies, one per agent. until the
+	// next build the node accessors, query and findPairs all work on that tree, there is no flat or
+	// wide copy of it and refit goes to DynamicAABBTree::refit
+	void updateDynamic(const AgentStore& agents, const BVHBuildSettings& settings = BVHBuildSettings());
+	bool isDynamic() const;
+	int getReinsertCount() const;  // proxies the last updateDynamic() put back into the tree
+	void clear();
+	float getSAHCost() const;  // expected box tests of a random query, relative to the root area
 	void addNode(SceneObject object);
-	void updateNode(int addIndex, int parnetIndex);
-	void updateBVH();
-	void traverseBVHByLayer(int index, int curr_layer, int target_layer);
+
+	// keeps the topology and recomputes the boxes bottom-up from the moved objects, one pass over the
+	// nodes and the flat and wide copies. with rotate every branch also tries the local rotation that
+	// shrinks it most, a rotation moves subtrees around in the depth first copies, so they are laid out
+	// again like after a build: rotate every few refits, not every one. the sah cost drifts up over
+	// time, compare getSAHCost() against getBuildSAHCost() to decide on a full rebuild
+	void refit(const AABBLanes& boxes, bool rotate = true);
+	float getBuildSAHCost() const;
+	int getPrimitiveCount() const;
+	double getBuildTime() const;  // ms of the last full build
+	double getRefitTime() const;  // ms of the last refit or dynamic update
 	void traverseBVH(int index);
 	int findClosestNode(AABB aabb, int nodeIndex);
 	void refitParentAABBInBVH(int node_2_parent_index);
-	void drawBVH();
-	void drawBVHInLayer(int layer);
-	vector<int> CollisionDetection(AABB aabb, int sceneIndex);
-	void searchCollision(AABB aabb, int nodeIndex, int searchNodeIndex, vector<int>& collisions);
-	int getRootIndex();
-	static GLuint createAABBVbo(AABB aabb);
-	static vector<vec3> generateAABBvertices(AABB aabb);
-
-	GLuint vaos[INSTANCE_NUM - 1];
-	GLuint vbos[INSTANCE_NUM - 1];
-	int draw_status[2 * INSTANCE_NUM - 1] = {0};
+
+	// objects whose box overlaps aabb and whose index is above sceneIndex (so every pair reports once,
+	// -1 for all of them). writes up to capacity indices into results and returns how many there are,
+	// a result above capacity means the buffer was too small. no allocation, safe from any thread.
+	// walks the 4 wide tree, queryBinary walks the flat binary one and finds the same objects. with
+	// stats the walk is added to it, the counters stay in registers until the end
+	int query(const AABB& aabb, int sceneIndex, int* results, int capacity, BVHQueryStats* stats = nullptr) const;
+	int queryBinary(const AABB& aabb, int sceneIndex, int* results, int capacity, BVHQueryStats* stats = nullptr) const;
+
+	// single queries behind BVHQueryBatch, on the flat tree or the dynamic one, full 3d unlike query().
+	// frustum planes are (normal, d) with the inside where dot(normal, p) + d >= 0. frustum and radius
+	// return how many objects they found and write up to capacity like query(). raycast returns the
+	// object hit first or -1, hitDistance in units of direction. nearest writes up to k (distance, object)
+	// closest first and returns how many, excludeObject is skipped (the agent asking, for steering)
+	int queryFrustum(const vec4* planes, int planeCount, int* results, int capacity) const;
+	int queryRadius(const vec3& center, float radius, int* results, int capacity) const;
+	int raycast(const vec3& origin, const vec3& direction, float maxDistance, float& hitDistance) const;
+	int nearest(const vec3& point, int k, int excludeObject, pair<float, int>* neighbours) const;
+
+	// queryFrustum across the pool into visible, in tree order so the list is the same for any thread
+	// count. subtrees inside every plane are taken without another test, outside ones are dropped at
+	// their root, only the boundary reaches the per object test
+	void queryFrustum(const vec4* planes, int planeCount, vector<int>& visible, ThreadPool& pool);
+
+	// all overlapping pairs in one descent of the tree against itself, appended as (lower, higher)
+	// object index, each pair once. the same list for any thread count
+	void findPairs(vector<pair<int, int>>& pairs, ThreadPool& pool);
+	int getFlatNodeCount() const;
+	int getWideNodeCount() const;
+	const BVHFlatNode& getFlatNode(int slot) const;
+	int getRootIndex() const;
+	int getNodeCount() const;
+	const BVHNode& getNode(int index) const;
+	int getPrimitive(int k) const;  // object index of leaf slot k
+
+	// the query copy as a file (BVHSnapshot.h). loadSnapshot maps it and the queries read the mapped
+	// nodes in place, no parsing. it returns false and leaves the tree alone when the file is missing, of
+	// another version or node layout, for another object count or sceneKey, fails its checksum or has a
+	// child link or leaf range out of bounds, the caller builds instead. the links are always checked, one
+	// pass over the nodes and primitives. verifyPayload = false skips the payload checksum, the primitive
+	// bounds stay untouched until a query needs them. a refit copies the mapped nodes into the vectors and
+	// refits them in their flat slots, there are no bvhNodes behind a snapshot until the first refit
+	// with rotations unpacks them from the flat nodes
+	bool saveSnapshot(const string& path, unsigned long long sceneKey) const;
+	bool loadSnapshot(const string& path, int objectCount, unsigned long long sceneKey, bool verifyPayload = true);
+	bool isSnapshot() const;
+	static unsigned long long snapshotKey(const AABBLanes& boxes, int buildType);  // hash of the boxes the tree was built over
 
 private:
+	struct BuildBin
+	{
+		float bounds[6];  // min xyz, max xyz
+		int count;
+	};
+
+	struct BuildPrimitive
+	{
+		float bounds[6];
+		float centroid[3];
+		int object;
+	};
+
+	int buildRange(int begin, int end, int parent);
+	void sortMortonCodes(ThreadPool& pool);
+	int commonPrefix(int i, int j) const;  // karras delta, -1 outside the leaf range
+	void emitInternalNode(int i);
+	AABB primitiveAABB(int object) const;  // only for trees from build() or refit()
+	bool rotateNode(int nodeIndex);
+	void computeRefitOrder();
+	void flatten();          // query copy from bvhNodes, after every build and topology change
+	void refitFlatBounds();  // boxes only, after a refit without rotations
+	void collapseWide();     // wide tree from the flat one
+	void refitWideBounds();  // requantize from the flat boxes
+	void bindQueryData();    // query views on the vectors, drops a snapshot
+	void unpackSnapshot();   // the mapped query data into the vectors
+	void unpackNodes();      // bvhNodes from the flat nodes, for a tree from a snapshot
+	void refitFlatSlots(const AABBLanes& boxes);  // bounds only, for a tree without bvhNodes
+	int queryWide(const AABB& aabb, int sceneIndex, int* results, int capacity, BVHQueryStats* stats) const;
+	bool expandSelfTask(int a, int b, vector<pair<int, int>>& out) const;  // flat node pair one level down
+	void leafPairs(int a, int b, vector<pair<int, int>>& pairs) const;
+	void rangeBounds(int begin, int end, float* bounds, float* centroidBounds) const;
+
 	vector<BVHNode> bvhNodes;
 	//vector<SceneObject> objects;
+	vector<int> primitiveIndices;
 	int rootIndex;
+	float buildCost;           // sah cost right after the last full build
+	double buildTime;
+	double refitTime;
+	vector<int> refitOrder;    // children before parents, empty when the topology changed
+
+	// query copy
+	vector<BVHFlatNode> flatNodes;
+	vector<int> flatPrimitives;     // object per leaf slot, in flat leaf order
+	vector<float> flatPrimBounds;   // 6 floats per leaf slot
+	vector<int> flatSource;         // bvhNodes index per flat node
+	vector<int> subtreeSize;
+	vector<pair<int, int>> flattenStack;
+	vector<BVHWideNode> wideNodes;  // root 0
+	vector<int> wideSource;         // flat node per wide child, -1 for unused
+	vector<int> wideLevel;
+	int wideDepth;
+
+	// what the queries read, the vectors above or a mapped snapshot
+	const BVHFlatNode* queryFlat;
+	int queryFlatCount;
+	const int* queryPrimitives;
+	int queryPrimitiveCount;
+	const float* queryPrimBounds;
+	const BVHWideNode* queryWideNodes;
+	int queryWideCount;
+	int queryWideDepth;
+	unique_ptr<MappedFile> snapshot;
+
+	// self collision scratch
+	vector<pair<int, int>> selfTasks;
+	vector<pair<int, int>> selfTaskScratch;
+	vector<vector<pair<int, int>>> taskPairs;   // per pool chunk
+	vector<vector<pair<int, int>>> taskStacks;
+
+	// threaded frustum scratch
+	vector<pair<int, int>> cullTasks;         // node, plane mask
+	vector<pair<int, int>> cullTaskScratch;
+	vector<vector<int>> cullResults;          // per pool chunk
+
+	unique_ptr<DynamicAABBTree> dynamicTree;
+	bool dynamic;
+
+	// build scratch
+	BVHBuildSettings settings;
+	vector<BuildPrimitive> buildPrimitives;  // partitioned in place, so a range stays contiguous in memory
+	vector<float> primBounds;     // 6 floats per object, min xyz max xyz, for the leaf tests
+	vector<BuildBin> bins;
+	vector<float> rightArea;
+
+	// lbvh scratch
+	vector<unsigned int> mortonCodes;     // sorted with mortonObjects
+	vector<int> mortonObjects;
+	vector<unsigned int> sortCodes;       // radix sort ping-pong
+	vector<int> sortObjects;
+	vector<int> blockHistogram;           // 256 digits per sort block
+	vector<float> blockBounds;            // 6 floats of centroid bounds per block
+	unique_ptr<atomic<int>[]> fitVisits;  // children done per internal node
+	int fitVisitCapacity = 0;
 };
 
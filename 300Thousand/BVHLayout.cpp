@@ -0,0 +1,457 @@
+#include "BVH.h"
+#include "DynamicAABBTree.h"
+#include "Simd.h"
+#include "BVHSnapshot.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+static int childCount(int childMask)
+{
+	return (childMask & 1) + ((childMask >> 1) & 1) + ((childMask >> 2) & 1) + ((childMask >> 3) & 1);
+}
+
+void BVH::flatten()
+{
+	flatNodes.clear();
+	flatPrimitives.clear();
+	flatPrimBounds.clear();
+	flatSource.clear();
+	wideNodes.clear();
+	wideSource.clear();
+	if (rootIndex == -1)
+	{
+		bindQueryData();
+		return;
+	}
+
+	if (refitOrder.empty())
+		computeRefitOrder();
+
+	// nodes per subtree, children come first in refitOrder
+	subtreeSize.resize(bvhNodes.size());
+	for (int nodeIndex : refitOrder)
+	{
+		const BVHNode& node = bvhNodes[nodeIndex];
+		subtreeSize[nodeIndex] = node.indexMapToScene != -1 ? 1 : 1 + subtreeSize[node.leftChildNode] + subtreeSize[node.rightChildNode];
+	}
+
+	// depth first, the smaller child right after its parent and the bigger one behind it. a query walks
+	// into the adjacent child and pushes the other, every push at least halves the subtree it walks
+	// into, so the pending stack never gets deeper than log2 of the node count
+	int nodeCount = refitOrder.size();
+	flatNodes.resize(nodeCount);
+	flatSource.resize(nodeCount);
+
+	vector<pair<int, int>>& stack = flattenStack;  // node, flat slot of the parent that jumps here
+	stack.clear();
+	stack.push_back(make_pair(rootIndex, -1));
+	int slot = 0;
+	while (!stack.empty())
+	{
+		int nodeIndex = stack.back().first;
+		int jumpFrom = stack.back().second;
+		stack.pop_back();
+
+		const BVHNode& node = bvhNodes[nodeIndex];
+		BVHFlatNode& flat = flatNodes[slot];
+		flatSource[slot] = nodeIndex;
+		if (jumpFrom != -1)
+			flatNodes[jumpFrom].offset = slot;
+
+		if (node.indexMapToScene == -1)
+		{
+			int first = node.leftChildNode;
+			int second = node.rightChildNode;
+			if (subtreeSize[first] > subtreeSize[second])
+				std::swap(first, second);
+			flat.count = 0;
+			stack.push_back(make_pair(second, slot));
+			stack.push_back(make_pair(first, -1));
+		}
+		else
+		{
+			flat.offset = flatPrimitives.size();
+			flat.count = node.primitiveCount;
+			for (int k = node.firstPrimitive; k < node.firstPrimitive + node.primitiveCount; k++)
+			{
+				int object = primitiveIndices[k];
+				flatPrimitives.push_back(object);
+			}
+		}
+		slot++;
+	}
+
+	flatPrimBounds.resize(flatPrimitives.size() * 6);
+	refitFlatBounds();
+	collapseWide();
+	bindQueryData();
+}
+
+void BVH::bindQueryData()
+{
+	// the queries only read through these, so a mapped snapshot can stand in for the vectors
+	snapshot.reset();
+	queryFlat = flatNodes.data();
+	queryFlatCount = flatNodes.size();
+	queryPrimitives = flatPrimitives.data();
+	queryPrimitiveCount = flatPrimitives.size();
+	queryPrimBounds = flatPrimBounds.data();
+	queryWideNodes = wideNodes.data();
+	queryWideCount = wideNodes.size();
+	queryWideDepth = wideDepth;
+}
+
+void BVH::refitFlatBounds()
+{
+	// same topology, only the boxes moved
+	int nodeCount = flatNodes.size();
+	for (int slot = 0; slot < nodeCount; slot++)
+	{
+		const AABB& aabb = bvhNodes[flatSource[slot]].aabb;
+		BVHFlatNode& flat = flatNodes[slot];
+		flat.min[0] = aabb.minX; flat.min[1] = aabb.minY; flat.min[2] = aabb.minZ;
+		flat.max[0] = aabb.maxX; flat.max[1] = aabb.maxY; flat.max[2] = aabb.maxZ;
+
+		// object boxes per leaf slot, a one object leaf is its own box (insertion trees keep no primBounds)
+		if (flat.count == 1)
+		{
+			float* b = &flatPrimBounds[flat.offset * 6];
+			std::copy(flat.min, flat.min + 3, b);
+			std::copy(flat.max, flat.max + 3, b + 3);
+		}
+		else
+		{
+			for (int k = flat.offset; k < flat.offset + flat.count; k++)
+				std::copy(&primBounds[flatPrimitives[k] * 6], &primBounds[flatPrimitives[k] * 6] + 6, &flatPrimBounds[k * 6]);
+		}
+	}
+
+	refitWideBounds();
+}
+
+void BVH::collapseWide()
+{
+	wideNodes.clear();
+	wideSource.clear();
+	wideDepth = 0;
+	if (flatNodes.empty())
+		return;
+
+	// every wide node takes the two children of a binary branch and keeps opening the biggest
+	// branch among its children until it has 4, so the wide tree skips about two of three levels
+	vector<pair<int, int>>& stack = flattenStack;  // flat slot, wide node
+	stack.clear();
+	wideNodes.resize(1);
+	wideLevel.assign(1, 1);
+	stack.push_back(make_pair(0, 0));
+	while (!stack.empty())
+	{
+		int slot = stack.back().first;
+		int wideIndex = stack.back().second;
+		stack.pop_back();
+
+		int children[4];
+		int childCount = 0;
+		if (flatNodes[slot].count > 0)
+		{
+			children[childCount++] = slot;  // a single leaf root
+		}
+		else
+		{
+			children[childCount++] = slot + 1;
+			children[childCount++] = flatNodes[slot].offset;
+		}
+
+		while (childCount < 4)
+		{
+			int open = -1;
+			float openArea = -1.0f;
+			for (int k = 0; k < childCount; k++)
+			{
+				const BVHFlatNode& child = flatNodes[children[k]];
+				float area = (child.max[0] - child.min[0]) * (child.max[1] - child.min[1]);
+				if (child.count == 0 && area > openArea)
+				{
+					open = k;
+					openArea = area;
+				}
+			}
+			if (open == -1)
+				break;
+
+			int branch = children[open];
+			children[open] = branch + 1;
+			children[childCount++] = flatNodes[branch].offset;
+		}
+
+		BVHWideNode node;
+		node.childMask = 0;
+		for (int k = 0; k < 4; k++)
+		{
+			node.child[k] = -1;
+			node.count[k] = 0;
+		}
+
+		for (int k = 0; k < childCount; k++)
+		{
+			node.childMask |= 1 << k;
+			const BVHFlatNode& child = flatNodes[children[k]];
+			if (child.count > 0)
+			{
+				node.child[k] = child.offset;
+				node.count[k] = child.count;
+			}
+			else
+			{
+				node.child[k] = wideNodes.size();
+				wideNodes.push_back(BVHWideNode());
+				wideLevel.push_back(wideLevel[wideIndex] + 1);
+				stack.push_back(make_pair(children[k], node.child[k]));
+			}
+		}
+
+		wideNodes[wideIndex] = node;
+		wideSource.resize(wideNodes.size() * 4, -1);
+		for (int k = 0; k < 4; k++)
+			wideSource[wideIndex * 4 + k] = k < childCount ? children[k] : -1;
+		wideDepth = std::max(wideDepth, wideLevel[wideIndex]);
+	}
+
+	refitWideBounds();
+}
+
+// dequantized child bound, the query computes the same with simd
+static inline float wideBound(float origin, float scale, int q)
+{
+	return origin + (float)q * scale;
+}
+
+void BVH::refitWideBounds()
+{
+	// children are stored 8 bit relative to the box of their parent, rounded outwards
+	int nodeCount = wideNodes.size();
+	for (int wideIndex = 0; wideIndex < nodeCount; wideIndex++)
+	{
+		BVHWideNode& node = wideNodes[wideIndex];
+		const int* source = &wideSource[wideIndex * 4];
+		for (int a = 0; a < 2; a++)
+		{
+			float lo = FLT_MAX;
+			float hi = -FLT_MAX;
+			for (int k = 0; k < 4; k++)
+			{
+				if (source[k] == -1)
+					continue;
+				lo = std::min(lo, flatNodes[source[k]].min[a]);
+				hi = std::max(hi, flatNodes[source[k]].max[a]);
+			}
+
+			// q = 254 already reaches the top, so 255 has one step to spare for rounding
+			float scale = std::max((hi - lo) / 254.0f, (std::abs(lo) + std::abs(hi)) * 1e-6f + 1e-30f);
+			while (wideBound(lo, scale, 254) < hi)
+				scale = std::nextafter(scale, FLT_MAX);
+			node.origin[a] = lo;
+			node.scale[a] = scale;
+
+			for (int k = 0; k < 4; k++)
+			{
+				if (source[k] == -1)
+				{
+					node.lo[a][k] = 255;
+					node.hi[a][k] = 0;
+					continue;
+				}
+
+				const BVHFlatNode& child = flatNodes[source[k]];
+				int qlo = std::min(std::max((int)std::floor((child.min[a] - lo) / scale), 0), 255);
+				int qhi = std::min(std::max((int)std::ceil((child.max[a] - lo) / scale), 0), 255);
+				while (qlo > 0 && wideBound(lo, scale, qlo) > child.min[a])
+					qlo--;
+				while (qhi < 255 && wideBound(lo, scale, qhi) < child.max[a])
+					qhi++;
+
+				// one more step each way, the simd path may round the bound differently
+				node.lo[a][k] = (unsigned char)std::max(qlo - 1, 0);
+				node.hi[a][k] = (unsigned char)std::min(qhi + 1, 255);
+			}
+		}
+	}
+}
+
+int BVH::queryWide(const AABB& aabb, int sceneIndex, int* results, int capacity, BVHQueryStats* stats) const
+{
+	const BVHWideNode* nodes = queryWideNodes;
+	const int* primitives = queryPrimitives;
+	const float* bounds = queryPrimBounds;
+	int stack[BVH_WIDE_STACK_SIZE];
+	int top = 0;
+	int found = 0;
+	int nodeIndex = 0;
+	int visited = 0;
+	int tests = 0;
+
+#if SIMD_SSE
+	const __m128 queryMinX = _mm_set1_ps(aabb.minX);
+	const __m128 queryMaxX = _mm_set1_ps(aabb.maxX);
+	const __m128 queryMinY = _mm_set1_ps(aabb.minY);
+	const __m128 queryMaxY = _mm_set1_ps(aabb.maxY);
+	const __m128i zero = _mm_setzero_si128();
+#endif
+
+	while (true)
+	{
+		const BVHWideNode& node = nodes[nodeIndex];
+		visited++;
+		tests += childCount(node.childMask);
+
+		// all four children against the query in one go
+#if SIMD_SSE
+		__m128i bytes = _mm_loadu_si128((const __m128i*)&node.lo[0][0]);  // lo x, lo y, hi x, hi y
+		__m128i words = _mm_unpacklo_epi8(bytes, zero);
+		__m128i wordsHi = _mm_unpackhi_epi8(bytes, zero);
+		__m128 loX = _mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero));
+		__m128 loY = _mm_cvtepi32_ps(_mm_unpackhi_epi16(words, zero));
+		__m128 hiX = _mm_cvtepi32_ps(_mm_unpacklo_epi16(wordsHi, zero));
+		__m128 hiY = _mm_cvtepi32_ps(_mm_unpackhi_epi16(wordsHi, zero));
+		__m128 originX = _mm_set1_ps(node.origin[0]);
+		__m128 originY = _mm_set1_ps(node.origin[1]);
+		__m128 scaleX = _mm_set1_ps(node.scale[0]);
+		__m128 scaleY = _mm_set1_ps(node.scale[1]);
+		__m128 hit = _mm_and_ps(
+			_mm_and_ps(_mm_cmplt_ps(queryMinX, _mm_add_ps(originX, _mm_mul_ps(hiX, scaleX))), _mm_cmpgt_ps(queryMaxX, _mm_add_ps(originX, _mm_mul_ps(loX, scaleX)))),
+			_mm_and_ps(_mm_cmplt_ps(queryMinY, _mm_add_ps(originY, _mm_mul_ps(hiY, scaleY))), _mm_cmpgt_ps(queryMaxY, _mm_add_ps(originY, _mm_mul_ps(loY, scaleY)))));
+		int mask = _mm_movemask_ps(hit) & node.childMask;
+#else
+		int mask = 0;
+		for (int k = 0; k < 4; k++)
+		{
+			if (aabb.minX < wideBound(node.origin[0], node.scale[0], node.hi[0][k]) && aabb.maxX > wideBound(node.origin[0], node.scale[0], node.lo[0][k]) &&
+				aabb.minY < wideBound(node.origin[1], node.scale[1], node.hi[1][k]) && aabb.maxY > wideBound(node.origin[1], node.scale[1], node.lo[1][k]))
+				mask |= 1 << k;
+		}
+		mask &= node.childMask;
+#endif
+
+		for (int k = 0; k < 4; k++)
+		{
+			if (!(mask & (1 << k)))
+				continue;
+
+			if (node.count[k] == 0)
+			{
+				stack[top++] = node.child[k];
+				continue;
+			}
+
+			// the quantized box is a little bigger, every object is tested exactly
+			for (int p = node.child[k]; p < node.child[k] + node.count[k]; p++)
+			{
+				int object = primitives[p];
+				const float* b = &bounds[p * 6];
+				if (object <= sceneIndex)
+					continue;
+				tests++;
+				if (!(aabb.minX < b[3] && aabb.maxX > b[0] && aabb.minY < b[4] && aabb.maxY > b[1]))
+					continue;
+				if (found < capacity)
+					results[found] = object;
+				found++;
+			}
+		}
+
+		if (top == 0)
+			break;
+		nodeIndex = stack[--top];
+	}
+
+	if (stats)
+		stats->add(visited, tests, found);
+	return found;
+}
+
+int BVH::query(const AABB& aabb, int sceneIndex, int* results, int capacity, BVHQueryStats* stats) const
+{
+	if (dynamic)
+		return dynamicTree->query(aabb, sceneIndex, results, capacity, stats);
+
+	// every level of the wide tree can leave 3 children on the stack
+	if (queryWideCount > 0 && queryWideDepth * 3 + 1 <= BVH_WIDE_STACK_SIZE)
+		return queryWide(aabb, sceneIndex, results, capacity, stats);
+	return queryBinary(aabb, sceneIndex, results, capacity, stats);
+}
+
+int BVH::queryBinary(const AABB& aabb, int sceneIndex, int* results, int capacity, BVHQueryStats* stats) const
+{
+	if (dynamic)
+		return dynamicTree->query(aabb, sceneIndex, results, capacity, stats);
+	if (queryFlatCount == 0)
+		return 0;
+
+	// xy only like AABB::overlap, the agents move on the ground plane
+	const BVHFlatNode* nodes = queryFlat;
+	const int* primitives = queryPrimitives;
+	const float* bounds = queryPrimBounds;
+	int stack[BVH_STACK_SIZE];
+	int top = 0;
+	int found = 0;
+	int nodeIndex = 0;
+	int visited = 0;
+	int tests = 0;
+	while (true)
+	{
+		const BVHFlatNode& node = nodes[nodeIndex];
+		visited++;
+		tests++;
+		if (aabb.minX < node.max[0] && aabb.maxX > node.min[0] && aabb.minY < node.max[1] && aabb.maxY > node.min[1])
+		{
+			if (node.count == 0)
+			{
+				stack[top++] = node.offset;
+				nodeIndex++;
+				continue;
+			}
+
+			// only the higher index of a pair reports, a single object leaf is its own box
+			for (int k = node.offset; k < node.offset + node.count; k++)
+			{
+				int object = primitives[k];
+				if (object <= sceneIndex)
+					continue;
+				if (node.count > 1)
+				{
+					tests++;
+					const float* b = &bounds[k * 6];
+					if (!(aabb.minX < b[3] && aabb.maxX > b[0] && aabb.minY < b[4] && aabb.maxY > b[1]))
+						continue;
+				}
+				if (found < capacity)
+					results[found] = object;
+				found++;
+			}
+		}
+
+		if (top == 0)
+			break;
+		nodeIndex = stack[--top];
+	}
+
+	if (stats)
+		stats->add(visited, tests, found);
+	return found;
+}
+
+int BVH::getFlatNodeCount() const
+{
+	return queryFlatCount;
+}
+
+int BVH::getWideNodeCount() const
+{
+	return queryWideCount;
+}
+
+const BVHFlatNode& BVH::getFlatNode(int slot) const
+{
+	return queryFlat[slot];
+}
@@ -0,0 +1,149 @@
+#include "BVHProfiler.h"
+#include <algorithm>
+
+static float overlapArea(const AABB& a, const AABB& b)
+{
+	// xy like the queries
+	float width = std::min(a.maxX, b.maxX) - std::max(a.minX, b.minX);
+	float height = std::min(a.maxY, b.maxY) - std::max(a.minY, b.minY);
+	return width > 0.0f && height > 0.0f ? width * height : 0.0f;
+}
+
+static float planeArea(const AABB& a)
+{
+	return (a.maxX - a.minX) * (a.maxY - a.minY);
+}
+
+BVHProfiler::BVHProfiler()
+	: frame(0)
+{
+}
+
+void BVHProfiler::measure(const BVH& bvh, const AABBLanes& queryBoxes, int sampleCount)
+{
+	metrics = BVHMetrics();
+	metrics.primitiveCount = bvh.getPrimitiveCount();
+	metrics.sahCost = bvh.getSAHCost();
+	metrics.buildSAHCost = bvh.getBuildSAHCost();
+	metrics.buildTime = bvh.getBuildTime();
+	metrics.refitTime = bvh.getRefitTime();
+	metrics.nodeBytes = (size_t)bvh.getNodeCount() * sizeof(BVHNode);
+	if (bvh.getFlatNodeCount() > 0)
+		metrics.flatBytes = (size_t)bvh.getFlatNodeCount() * sizeof(BVHFlatNode) + (size_t)metrics.primitiveCount * (sizeof(int) + 6 * sizeof(float));
+	metrics.wideBytes = (size_t)bvh.getWideNodeCount() * sizeof(BVHWideNode);
+
+	// depth first from the root, the dynamic tree has free nodes in its array that are never reached
+	float overlap = 0.0f;
+	float siblingArea = 0.0f;
+	long long leafDepthSum = 0;
+	walkStack.clear();
+	if (bvh.getRootIndex() != -1)
+		walkStack.push_back(make_pair(bvh.getRootIndex(), 0));
+	while (!walkStack.empty())
+	{
+		int nodeIndex = walkStack.back().first;
+		int depth = walkStack.back().second;
+		walkStack.pop_back();
+
+		const BVHNode& node = bvh.getNode(nodeIndex);
+		metrics.nodeCount++;
+		metrics.maxDepth = std::max(metrics.maxDepth, depth);
+		if (node.indexMapToScene != -1)
+		{
+			metrics.leafCount++;
+			leafDepthSum += depth;
+			if ((int)metrics.depthHistogram.size() <= depth)
+				metrics.depthHistogram.resize(depth + 1, 0);
+			metrics.depthHistogram[depth]++;
+			continue;
+		}
+
+		const AABB& left = bvh.getNode(node.leftChildNode).aabb;
+		const AABB& right = bvh.getNode(node.rightChildNode).aabb;
+		overlap += overlapArea(left, right);
+		siblingArea += std::min(planeArea(left), planeArea(right));
+		walkStack.push_back(make_pair(node.rightChildNode, depth + 1));
+		walkStack.push_back(make_pair(node.leftChildNode, depth + 1));
+	}
+	if (metrics.leafCount > 0)
+		metrics.averageLeafDepth = (float)leafDepthSum / metrics.leafCount;
+	if (siblingArea > 0.0f)
+		metrics.leafOverlapRatio = overlap / siblingArea;
+
+	// every stride-th box, the higher index rule of the broad-phase included
+	int boxCount = queryBoxes.count;
+	sampleCount = std::min(sampleCount, boxCount);
+	if (sampleCount > 0)
+	{
+		if (results.empty())
+			results.resize(256);
+		int stride = boxCount / sampleCount;
+		for (int s = 0; s < sampleCount; s++)
+		{
+			int i = s * stride;
+			AABB box(queryBoxes.minX[i], queryBoxes.minY[i], queryBoxes.minZ[i], queryBoxes.maxX[i], queryBoxes.maxY[i], queryBoxes.maxZ[i]);
+			bvh.query(box, i, results.data(), results.size(), &metrics.queries);
+		}
+	}
+
+	if (log.is_open())
+		writeJSON(log);
+	frame++;
+}
+
+const BVHMetrics& BVHProfiler::getMetrics() const
+{
+	return metrics;
+}
+
+int BVHProfiler::getFrame() const
+{
+	return frame;
+}
+
+void BVHProfiler::writeJSON(ostream& out) const
+{
+	const BVHQueryStats& q = metrics.queries;
+	double perQuery = q.queries > 0 ? 1.0 / q.queries : 0.0;
+	out << "{\"frame\":" << frame
+		<< ",\"nodes\":" << metrics.nodeCount
+		<< ",\"leaves\":" << metrics.leafCount
+		<< ",\"primitives\":" << metrics.primitiveCount
+		<< ",\"bytes\":{\"nodes\":" << metrics.nodeBytes << ",\"flat\":" << metrics.flatBytes << ",\"wide\":" << metrics.wideBytes << "}"
+		<< ",\"sahCost\":" << metrics.sahCost
+		<< ",\"buildSahCost\":" << metrics.buildSAHCost
+		<< ",\"maxDepth\":" << metrics.maxDepth
+		<< ",\"averageLeafDepth\":" << metrics.averageLeafDepth
+		<< ",\"depthHistogram\":[";
+	for (size_t d = 0; d < metrics.depthHistogram.size(); d++)
+		out << (d > 0 ? "," : "") << metrics.depthHistogram[d];
+	out << "]"
+		<< ",\"leafOverlapRatio\":" << metrics.leafOverlapRatio
+		<< ",\"buildMs\":" << metrics.buildTime
+		<< ",\"refitMs\":" << metrics.refitTime
+		<< ",\"queries\":{\"count\":" << q.queries
+		<< ",\"nodesVisited\":" << q.nodesVisited
+		<< ",\"boxTests\":" << q.boxTests
+		<< ",\"results\":" << q.results
+		<< ",\"nodesPerQuery\":" << q.nodesVisited * perQuery
+		<< ",\"testsPerQuery\":" << q.boxTests * perQuery
+		<< "}}\n";
+}
+
+bool BVHProfiler::openLog(const string& path)
+{
+	closeLog();
+	log.open(path.c_str(), ios::out | ios::trunc);
+	return log.is_open();
+}
+
+void BVHProfiler::closeLog()
+{
+	if (log.is_open())
+		log.close();
+}
+
+bool BVHProfiler::isLogging() const
+{
+	return log.is_open();
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <ostream>
+#include <fstream>
+#include "BVH.h"
+
+using namespace std;
+
+// one measurement of a tree, sizes in bytes, times in ms
+struct BVHMetrics
+{
+	int nodeCount = 0;
+	int leafCount = 0;
+	int primitiveCount = 0;
+	size_t nodeBytes = 0;    // BVHNode array of the builders, or of the dynamic tree
+	size_t flatBytes = 0;    // flat query nodes, primitive slots and their bounds
+	size_t wideBytes = 0;
+	float sahCost = 0.0f;
+	float buildSAHCost = 0.0f;
+	int maxDepth = 0;
+	float averageLeafDepth = 0.0f;
+	vector<int> depthHistogram;     // leaves per depth, the root is depth 0
+	float leafOverlapRatio = 0.0f;  // xy overlap of sibling boxes over the smaller of the two, all branches
+	double buildTime = 0.0;
+	double refitTime = 0.0;
+	BVHQueryStats queries;          // the sampled box queries
+};
+
+/*
+ how good a tree is and what it costs to use, to pick a build strategy and to catch a tree that
+ degrades over a long session. measure() walks the nodes once and sends a sample of the boxes through
+ BVH::query with stats, so the visit counts are those of the real query path. with a log open every
+ measure() appends the frame as one json object per line.
+*/
+
+class BVHProfiler
+{
+public:
+	BVHProfiler();
+
+	// sampleCount boxes spread evenly over queryBoxes, 0 measures the structure only
+	void measure(const BVH& bvh, const AABBLanes& queryBoxes, int sampleCount);
+	const BVHMetrics& getMetrics() const;
+	int getFrame() const;  // measure() calls so far
+
+	void writeJSON(ostream& out) const;  // the last measurement, one line
+	bool openLog(const string& path);
+	void closeLog();
+	bool isLogging() const;
+
+private:
+	BVHMetrics metrics;
+	int frame;
+	vector<pair<int, int>> walkStack;  // node, depth
+	vector<int> results;
+	ofstream log;
+};
@@ -0,0 +1,171 @@
+#include "BVHQueryBatch.h"
+#include <cfloat>
+
+BVHQueryBatch::BVHQueryBatch()
+{
+	offsets.push_back(0);
+}
+
+void BVHQueryBatch::clear()
+{
+	queries.clear();
+	offsets.assign(1, 0);
+	results.clear();
+	distances.clear();
+}
+
+int BVHQueryBatch::addFrustum(const mat4& viewProjection)
+{
+	SpatialQuery query = SpatialQuery();
+	query.type = QUERY_FRUSTUM;
+	frustumPlanes(viewProjection, query.planes);
+	queries.push_back(query);
+	return queries.size() - 1;
+}
+
+int BVHQueryBatch::addRadius(const vec3& center, float radius)
+{
+	SpatialQuery query = SpatialQuery();
+	query.type = QUERY_RADIUS;
+	query.point = center;
+	query.range = radius;
+	queries.push_back(query);
+	return queries.size() - 1;
+}
+
+int BVHQueryBatch::addRay(const vec3& origin, const vec3& direction, float maxDistance)
+{
+	SpatialQuery query = SpatialQuery();
+	query.type = QUERY_RAY;
+	query.point = origin;
+	query.direction = direction;
+	query.range = maxDistance;
+	queries.push_back(query);
+	return queries.size() - 1;
+}
+
+int BVHQueryBatch::addNearest(const vec3& point, int k, int excludeObject)
+{
+	SpatialQuery query = SpatialQuery();
+	query.type = QUERY_NEAREST;
+	query.point = point;
+	query.k = k;
+	query.exclude = excludeObject;
+	queries.push_back(query);
+	return queries.size() - 1;
+}
+
+int BVHQueryBatch::runQuery(const BVH& bvh, const SpatialQuery& query, int chunk)
+{
+	// appends to the arena of the chunk, returns how many it added
+	vector<int>& out = chunkResults[chunk];
+	vector<float>& outDistances = chunkDistances[chunk];
+	vector<int>& scratch = chunkScratch[chunk];
+
+	if (query.type == QUERY_RAY)
+	{
+		float distance;
+		int hit = bvh.raycast(query.point, query.direction, query.range, distance);
+		if (hit == -1)
+			return 0;
+		out.push_back(hit);
+		outDistances.push_back(distance);
+		return 1;
+	}
+
+	if (query.type == QUERY_NEAREST)
+	{
+		vector<pair<float, int>>& neighbours = chunkNeighbours[chunk];
+		neighbours.resize(std::max(query.k, 0));
+		int count = bvh.nearest(query.point, query.k, query.exclude, neighbours.data());
+		for (int i = 0; i < count; i++)
+		{
+			out.push_back(neighbours[i].second);
+			outDistances.push_back(neighbours[i].first);
+		}
+		return count;
+	}
+
+	// frustum and radius, the scratch buffer grows once when a query finds more than it holds
+	int found = 0;
+	for (int attempt = 0; attempt < 2; attempt++)
+	{
+		if (query.type == QUERY_FRUSTUM)
+			found = bvh.queryFrustum(query.planes, 6, scratch.data(), scratch.size());
+		else
+			found = bvh.queryRadius(query.point, query.range, scratch.data(), scratch.size());
+
+		if (found <= (int)scratch.size())
+			break;
+		scratch.resize(found);
+	}
+
+	out.insert(out.end(), scratch.begin(), scratch.begin() + found);
+	outDistances.insert(outDistances.end(), found, 0.0f);
+	return found;
+}
+
+void BVHQueryBatch::run(const BVH& bvh, ThreadPool& pool)
+{
+	int queryCount = queries.size();
+	int chunkCount = pool.getThreadCount();
+	chunkResults.resize(chunkCount);
+	chunkDistances.resize(chunkCount);
+	chunkScratch.resize(chunkCount);
+	chunkNeighbours.resize(chunkCount);
+	for (int c = 0; c < chunkCount; c++)
+	{
+		chunkResults[c].clear();
+		chunkDistances[c].clear();
+		if (chunkScratch[c].empty())
+			chunkScratch[c].resize(256);
+	}
+
+	// counts first, every chunk keeps its own arena
+	offsets.resize(queryCount + 1);
+	pool.parallelFor(queryCount, [this, &bvh](int begin, int end, int chunk)
+		{
+			for (int q = begin; q < end; q++)
+				offsets[q + 1] = runQuery(bvh, queries[q], chunk);
+		}, 64);
+
+	// chunks are contiguous query ranges, so joined in order the arenas line up with the offsets
+	offsets[0] = 0;
+	for (int q = 0; q < queryCount; q++)
+		offsets[q + 1] += offsets[q];
+
+	results.clear();
+	distances.clear();
+	results.reserve(offsets[queryCount]);
+	distances.reserve(offsets[queryCount]);
+	for (int c = 0; c < chunkCount; c++)
+	{
+		results.insert(results.end(), chunkResults[c].begin(), chunkResults[c].end());
+		distances.insert(distances.end(), chunkDistances[c].begin(), chunkDistances[c].end());
+	}
+}
+
+int BVHQueryBatch::getQueryCount() const
+{
+	return queries.size();
+}
+
+int BVHQueryBatch::getResultCount(int query) const
+{
+	return offsets[query + 1] - offsets[query];
+}
+
+const int* BVHQueryBatch::getResults(int query) const
+{
+	return results.data() + offsets[query];
+}
+
+const float* BVHQueryBatch::getDistances(int query) const
+{
+	return distances.data() + offsets[query];
+}
+
+int BVHQueryBatch::getTotalResults() const
+{
+	return results.size();
+}
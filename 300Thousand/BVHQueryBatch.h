@@ -0,0 +1,65 @@
+#pragma once
+#include <vector>
+#include <utility>
+#include <glm/glm.hpp>
+#include "BVH.h"
+#include "ThreadPool.h"
+
+using namespace std;
+using namespace glm;
+
+enum SpatialQueryType { QUERY_FRUSTUM = 0, QUERY_RADIUS = 1, QUERY_RAY = 2, QUERY_NEAREST = 3 };
+
+struct SpatialQuery
+{
+	int type;      // SpatialQueryType
+	vec4 planes[6];
+	vec3 point;    // radius center, ray origin, nearest point
+	vec3 direction;
+	float range;   // radius, ray length
+	int k;
+	int exclude;   // nearest: object left out, -1 for none
+};
+
+/*
+ batches of spatial queries against one bvh (culling lists, picking rays, steering neighbours).
+ add the queries, run() splits them over the pool and every query writes its objects into one shared
+ arena, getResults(q) / getResultCount(q) find them by offset. rays give at most one object, nearest
+ gives up to k ordered by distance, getDistances(q) holds the distances for both. the arena comes out
+ in query order, the same for any thread count, and is reused between runs.
+*/
+
+class BVHQueryBatch
+{
+public:
+	BVHQueryBatch();
+	void clear();
+
+	// every add returns the index of the query
+	int addFrustum(const mat4& viewProjection);
+	int addRadius(const vec3& center, float radius);
+	int addRay(const vec3& origin, const vec3& direction, float maxDistance);
+	int addNearest(const vec3& point, int k, int excludeObject = -1);
+
+	void run(const BVH& bvh, ThreadPool& pool);
+
+	int getQueryCount() const;
+	int getResultCount(int query) const;
+	const int* getResults(int query) const;
+	const float* getDistances(int query) const;  // rays and nearest, 0 for the others
+	int getTotalResults() const;
+
+private:
+	int runQuery(const BVH& bvh, const SpatialQuery& query, int chunk);
+
+	vector<SpatialQuery> queries;
+	vector<int> offsets;      // query count + 1, into results
+	vector<int> results;
+	vector<float> distances;
+
+	// per pool chunk, a chunk owns a contiguous range of queries
+	vector<vector<int>> chunkResults;
+	vector<vector<float>> chunkDistances;
+	vector<vector<int>> chunkScratch;
+	vector<vector<pair<float, int>>> chunkNeighbours;
+};
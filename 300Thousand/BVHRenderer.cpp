@@ -0,0 +1,260 @@
+#include "BVHRenderer.h"
+
+BVHRenderer::BVHRenderer()
+	: cubeBuffer(0), collidingCount(0)
+{
+}
+
+BVHRenderer::~BVHRenderer()
+{
+	// gl objects are released explicitly while the context is still alive, see release()
+}
+
+void BVHRenderer::init()
+{
+	// a 0..1 cube, the vertex shader stretches it over the min / max of the instance
+	vector<vec3> cube = generateAABBvertices(AABB(0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f));
+	glGenBuffers(1, &cubeBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, cubeBuffer);
+	glBufferData(GL_ARRAY_BUFFER, cube.size() * sizeof(vec3), cube.data(), GL_STATIC_DRAW);
+
+	BoxList* lists[2] = { &branches, &agentBoxes };
+	for (BoxList* list : lists)
+	{
+		glGenVertexArrays(1, &list->vao);
+		glGenBuffers(1, &list->instanceBuffer);
+		list->capacity = 0;
+
+		glBindVertexArray(list->vao);
+		glBindBuffer(GL_ARRAY_BUFFER, cubeBuffer);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+		glBindBuffer(GL_ARRAY_BUFFER, list->instanceBuffer);
+		for (int corner = 0; corner < 2; corner++)
+		{
+			glEnableVertexAttribArray(1 + corner);
+			glVertexAttribPointer(1 + corner, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(corner * 3 * sizeof(float)));
+			glVertexAttribDivisor(1 + corner, 1);
+		}
+		glBindVertexArray(0);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void BVHRenderer::upload(BoxList& list)
+{
+	if (cubeBuffer == 0)
+		init();
+
+	// grows like a vector, the same box count again is a plain sub data upload
+	int count = list.boxes.size() / 6;
+	glBindBuffer(GL_ARRAY_BUFFER, list.instanceBuffer);
+	if (count > list.capacity)
+	{
+		list.capacity = count;
+		glBufferData(GL_ARRAY_BUFFER, list.boxes.size() * sizeof(float), list.boxes.data(), GL_STREAM_DRAW);
+	}
+	else if (count > 0)
+		glBufferSubData(GL_ARRAY_BUFFER, 0, list.boxes.size() * sizeof(float), list.boxes.data());
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void BVHRenderer::update(const BVH& bvh)
+{
+	// breadth first over the branches, so every level is one range of the instance buffer
+	branches.boxes.clear();
+	layerStart.clear();
+	levelNodes.clear();
+	int root = bvh.getRootIndex();
+	if (root != -1 && bvh.getNodeCount() > 0 && bvh.getNode(root).indexMapToScene == -1)
+		levelNodes.push_back(root);
+
+	size_t levelBegin = 0;
+	while (levelBegin < levelNodes.size())
+	{
+		size_t levelEnd = levelNodes.size();
+		layerStart.push_back((int)levelBegin);
+		for (size_t k = levelBegin; k < levelEnd; k++)
+		{
+			const BVHNode& node = bvh.getNode(levelNodes[k]);
+			const AABB& aabb = node.aabb;
+			float box[6] = { aabb.minX, aabb.minY, aabb.minZ, aabb.maxX, aabb.maxY, aabb.maxZ };
+			branches.boxes.insert(branches.boxes.end(), box, box + 6);
+
+			int children[2] = { node.leftChildNode, node.rightChildNode };
+			for (int child : children)
+			{
+				if (bvh.getNode(child).indexMapToScene == -1)
+					levelNodes.push_back(child);
+			}
+		}
+		levelBegin = levelEnd;
+	}
+	layerStart.push_back((int)levelNodes.size());
+	upload(branches);
+}
+
+void BVHRenderer::updateAgents(const AgentStore& agents)
+{
+	// colliding agents first, each half is drawn with its own collisionType
+	int count = agents.size();
+	agentBoxes.boxes.resize(count * 6);
+	int slot = 0;
+	for (int pass = 0; pass < 2; pass++)
+	{
+		for (int i = 0; i < count; i++)
+		{
+			if ((agents.collisionStatus[i] != 0) != (pass == 0))
+				continue;
+			float* box = &agentBoxes.boxes[slot * 6];
+			box[0] = agents.minX[i]; box[1] = agents.minY[i]; box[2] = agents.minZ[i];
+			box[3] = agents.maxX[i]; box[4] = agents.maxY[i]; box[5] = agents.maxZ[i];
+			slot++;
+		}
+		if (pass == 0)
+			collidingCount = slot;
+	}
+	upload(agentBoxes);
+}
+
+void BVHRenderer::release()
+{
+	BoxList* lists[2] = { &branches, &agentBoxes };
+	for (BoxList* list : lists)
+	{
+		if (list->vao != 0)
+		{
+			glDeleteVertexArrays(1, &list->vao);
+			glDeleteBuffers(1, &list->instanceBuffer);
+		}
+		list->vao = 0;
+		list->instanceBuffer = 0;
+		list->capacity = 0;
+	}
+	if (cubeBuffer != 0)
+		glDeleteBuffers(1, &cubeBuffer);
+	cubeBuffer = 0;
+}
+
+vector<vec3> BVHRenderer::generateAABBvertices(const AABB aabb)
+{
+	//std::cout << aabb.minX << ", " << aabb.minY << ", " << aabb.minZ << ", " << aabb.maxX << ", " << aabb.maxY << ", " << aabb.maxZ << std::endl;
+	vector<glm::vec3> boundingBoxVerties;
+
+	/*boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.maxY, aabb.maxZ));
+	boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.minY, aabb.maxZ));
+	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.maxY, aabb.maxZ));
+
+	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.maxY, aabb.maxZ));
+	boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.minY, aabb.maxZ));
+	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.minY, aabb.maxZ));
+
+	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.maxY, aabb.maxZ));
+	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.minY, aabb.maxZ));
+	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.maxY, aabb.minZ));
+
+	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.maxY, aabb.minZ));
+	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.minY, aabb.maxZ));
+	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.minY, aabb.minZ));
+
+	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.maxY, aabb.minZ));
+	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.minY, aabb.minZ));
+	boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.minY, aabb.minZ));
+
+	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.maxY, aabb.minZ));
+	boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.minY, aabb.minZ));
+	boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.maxY, aabb.minZ));
+
+	boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.maxY, aabb.minZ));
+	boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.minY, aabb.minZ));
+	boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.maxY, aabb.maxZ));
+
+	boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.maxY, aabb.maxZ));
+	boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.minY, aabb.minZ));
+	boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.minY, aabb.maxZ));
+
+	boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.maxY, aabb.minZ));
+	boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.maxY, aabb.maxZ));
+	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.maxY, aabb.minZ));
+
+	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.maxY, aabb.minZ));
+	boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.maxY, aabb.maxZ));
+	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.maxY, aabb.maxZ));
+
+	boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.minY, aabb.minZ));
+	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.minY, aabb.minZ));
+	boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.minY, aabb.maxZ));
+
+	boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.minY, aabb.maxZ));
+	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.minY, aabb.minZ));
+	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.minY, aabb.maxZ));*/
+
+	// front face
+	boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.maxY, aabb.maxZ));  // top left
+	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.maxY, aabb.maxZ));  // top right
+	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.minY, aabb.maxZ));  // bottom right
+	boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.minY, aabb.maxZ));  // bottom left
+
+	// right face
+	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.maxY, aabb.maxZ));
+	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.maxY, aabb.minZ));
+	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.minY, aabb.minZ));
+	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.minY, aabb.maxZ));
+
+	// back face
+	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.maxY, aabb.minZ));
+	boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.maxY, aabb.minZ));
+	boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.minY, aabb.minZ));
+	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.minY, aabb.minZ));
+
+	// left face
+	boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.maxY, aabb.minZ));
+	boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.maxY, aabb.maxZ));
+	boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.minY, aabb.maxZ));
+	boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.minY, aabb.minZ));
+
+	// top face
+	boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.maxY, aabb.minZ));
+	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.maxY, aabb.minZ));
+	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.maxY, aabb.maxZ));
+	boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.maxY, aabb.maxZ));
+
+	// bottom face
+	boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.minY, aabb.minZ));
+	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.minY, aabb.minZ));
+	boundingBoxVerties.push_back(glm::vec3(aabb.maxX, aabb.minY, aabb.maxZ));
+	boundingBoxVerties.push_back(glm::vec3(aabb.minX, aabb.minY, aabb.maxZ));
+
+	return boundingBoxVerties;
+}
+
+void BVHRenderer::drawRange(const BoxList& list, int first, int count)
+{
+	if (list.vao == 0 || count <= 0)
+		return;
+
+	glBindVertexArray(list.vao);
+	glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+	glDrawArraysInstancedBaseInstance(GL_QUADS, 0, 24, count, first);
+	glBindVertexArray(0);
+}
+
+void BVHRenderer::draw()
+{
+	drawRange(branches, 0, branches.boxes.size() / 6);
+}
+
+void BVHRenderer::drawInLayer(int layer)
+{
+	if (layer >= 0 && layer + 1 < (int)layerStart.size())
+		drawRange(branches, layerStart[layer], layerStart[layer + 1] - layerStart[layer]);
+}
+
+void BVHRenderer::drawAgents(GLint collisionTypeLoc)
+{
+	int count = agentBoxes.boxes.size() / 6;
+	glUniform1i(collisionTypeLoc, 1);
+	drawRange(agentBoxes, 0, collidingCount);
+	glUniform1i(collisionTypeLoc, 0);
+	drawRange(agentBoxes, collidingCount, count - collidingCount);
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <GL/glew.h>
+#include <vector>
+#include <glm/glm.hpp>
+#include "AABB.h"
+#include "BVH.h"
+#include "AgentStore.h"
+
+using namespace std;
+using namespace glm;
+
+/*
+ gl side of the bvh and the agent boxes, drawn as lines. one unit cube and an instance buffer of
+ min / max corners per draw list, so a whole list is one instanced draw and one upload however many
+ boxes it holds. the branches are stored level by level, a layer of the tree is a contiguous range.
+ the tree itself has no gl so it can be built headless, the viewer hands it over here every frame.
+*/
+
+class BVHRenderer
+{
+public:
+	BVHRenderer();
+	~BVHRenderer();
+	void update(const BVH& bvh);
+	void updateAgents(const AgentStore& agents);  // the colliding agents first
+	void draw();
+	void drawInLayer(int layer);
+	void drawAgents(GLint collisionTypeLoc);      // two ranges, collisionType 1 then 0
+	void release();
+	static vector<vec3> generateAABBvertices(AABB aabb);
+
+private:
+	// the cube vertices and instanceBuffer feed vao, boxes holds min xyz, max xyz per instance
+	struct BoxList
+	{
+		GLuint vao = 0;
+		GLuint instanceBuffer = 0;
+		int capacity = 0;
+		vector<float> boxes;
+	};
+
+	void init();
+	void upload(BoxList& list);
+	void drawRange(const BoxList& list, int first, int count);
+
+	GLuint cubeBuffer;
+	BoxList branches;
+	BoxList agentBoxes;
+	vector<int> layerStart;   // first branch of every level, one extra entry for the end
+	vector<int> levelNodes;   // breadth first scratch
+	int collidingCount;
+};
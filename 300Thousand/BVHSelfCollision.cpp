@@ -0,0 +1,131 @@
+#include "BVH.h"
+#include "DynamicAABBTree.h"
+
+static inline bool flatOverlap(const BVHFlatNode& a, const BVHFlatNode& b)
+{
+	return a.min[0] < b.max[0] && a.max[0] > b.min[0] && a.min[1] < b.max[1] && a.max[1] > b.min[1];
+}
+
+void BVH::findPairs(vector<pair<int, int>>& pairs, ThreadPool& pool)
+{
+	if (dynamic)
+	{
+		dynamicTree->findPairs(pairs, pool);
+		return;
+	}
+	if (queryFlatCount == 0)
+		return;
+
+	// split the top of the descent into independent subtree pairs, a fixed count so the tasks (and the
+	// pair order) do not depend on the thread count. a task (a, a) is a subtree against itself
+	vector<pair<int, int>>& tasks = selfTasks;
+	vector<pair<int, int>>& next = selfTaskScratch;
+	tasks.assign(1, make_pair(0, 0));
+	for (int level = 0; level < 16 && tasks.size() < BVH_SELF_TASKS; level++)
+	{
+		next.clear();
+		bool split = false;
+		for (const pair<int, int>& task : tasks)
+		{
+			if (expandSelfTask(task.first, task.second, next))
+				split = true;
+			else
+				next.push_back(task);
+		}
+		tasks.swap(next);
+		if (!split)
+			break;
+	}
+
+	taskPairs.resize(pool.getThreadCount());
+	for (size_t c = 0; c < taskPairs.size(); c++)
+		taskPairs[c].clear();
+	taskStacks.resize(pool.getThreadCount());
+
+	pool.parallelFor(tasks.size(), [this, &tasks](int begin, int end, int chunk)
+		{
+			vector<pair<int, int>>& stack = taskStacks[chunk];
+			for (int t = begin; t < end; t++)
+			{
+				stack.assign(1, tasks[t]);
+				while (!stack.empty())
+				{
+					pair<int, int> task = stack.back();
+					stack.pop_back();
+					if (!expandSelfTask(task.first, task.second, stack))
+						leafPairs(task.first, task.second, taskPairs[chunk]);
+				}
+			}
+		}, 1);
+
+	// chunks are contiguous task ranges, joined in order
+	for (size_t c = 0; c < taskPairs.size(); c++)
+		pairs.insert(pairs.end(), taskPairs[c].begin(), taskPairs[c].end());
+}
+
+bool BVH::expandSelfTask(int a, int b, vector<pair<int, int>>& out) const
+{
+	// false when both sides are leaves (or a is one leaf against itself), those go to leafPairs
+	const BVHFlatNode& nodeA = queryFlat[a];
+	const BVHFlatNode& nodeB = queryFlat[b];
+	if (a == b)
+	{
+		if (nodeA.count > 0)
+			return false;
+
+		// both halves against themselves and against each other
+		int left = a + 1;
+		int right = nodeA.offset;
+		out.push_back(make_pair(left, left));
+		out.push_back(make_pair(right, right));
+		if (flatOverlap(queryFlat[left], queryFlat[right]))
+			out.push_back(make_pair(left, right));
+		return true;
+	}
+
+	if (nodeA.count > 0 && nodeB.count > 0)
+		return false;
+
+	// open the bigger branch
+	float areaA = (nodeA.max[0] - nodeA.min[0]) * (nodeA.max[1] - nodeA.min[1]);
+	float areaB = (nodeB.max[0] - nodeB.min[0]) * (nodeB.max[1] - nodeB.min[1]);
+	if (nodeB.count > 0 || (nodeA.count == 0 && areaA >= areaB))
+	{
+		if (flatOverlap(queryFlat[a + 1], nodeB))
+			out.push_back(make_pair(a + 1, b));
+		if (flatOverlap(queryFlat[nodeA.offset], nodeB))
+			out.push_back(make_pair(nodeA.offset, b));
+	}
+	else
+	{
+		if (flatOverlap(nodeA, queryFlat[b + 1]))
+			out.push_back(make_pair(a, b + 1));
+		if (flatOverlap(nodeA, queryFlat[nodeB.offset]))
+			out.push_back(make_pair(a, nodeB.offset));
+	}
+	return true;
+}
+
+void BVH::leafPairs(int a, int b, vector<pair<int, int>>& pairs) const
+{
+	const BVHFlatNode& nodeA = queryFlat[a];
+	const BVHFlatNode& nodeB = queryFlat[b];
+	for (int p = nodeA.offset; p < nodeA.offset + nodeA.count; p++)
+	{
+		const float* boundsP = &queryPrimBounds[p * 6];
+
+		// a leaf against itself only looks at the slots after p
+		int q = a == b ? p + 1 : nodeB.offset;
+		for (; q < nodeB.offset + nodeB.count; q++)
+		{
+			const float* boundsQ = &queryPrimBounds[q * 6];
+			if (!(boundsP[0] < boundsQ[3] && boundsP[3] > boundsQ[0] && boundsP[1] < boundsQ[4] && boundsP[4] > boundsQ[1]))
+				continue;
+
+			// keep the (lower, higher) object order the response code expects
+			int i = queryPrimitives[p];
+			int j = queryPrimitives[q];
+			pairs.push_back(i < j ? make_pair(i, j) : make_pair(j, i));
+		}
+	}
+}
@@ -0,0 +1,374 @@
+#include "BVHSnapshot.h"
+#include "BVH.h"
+#include "DynamicAABBTree.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile()
+	: view(nullptr), bytes(0),
+#ifdef _WIN32
+	fileHandle(INVALID_HANDLE_VALUE), mappingHandle(nullptr)
+#else
+	fd(-1)
+#endif
+{
+}
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+bool MappedFile::open(const string& path)
+{
+	close();
+#ifdef _WIN32
+	fileHandle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (fileHandle == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0)
+	{
+		close();
+		return false;
+	}
+	mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mappingHandle == nullptr)
+	{
+		close();
+		return false;
+	}
+	view = (const unsigned char*)MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+	if (view == nullptr)
+	{
+		close();
+		return false;
+	}
+	bytes = (size_t)fileSize.QuadPart;
+#else
+	fd = ::open(path.c_str(), O_RDONLY);
+	if (fd == -1)
+		return false;
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size == 0)
+	{
+		close();
+		return false;
+	}
+	void* address = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (address == MAP_FAILED)
+	{
+		close();
+		return false;
+	}
+	view = (const unsigned char*)address;
+	bytes = info.st_size;
+#endif
+	return true;
+}
+
+void MappedFile::close()
+{
+#ifdef _WIN32
+	if (view != nullptr)
+		UnmapViewOfFile(view);
+	if (mappingHandle != nullptr)
+		CloseHandle(mappingHandle);
+	if (fileHandle != INVALID_HANDLE_VALUE)
+		CloseHandle(fileHandle);
+	mappingHandle = nullptr;
+	fileHandle = INVALID_HANDLE_VALUE;
+#else
+	if (view != nullptr)
+		munmap((void*)view, bytes);
+	if (fd != -1)
+		::close(fd);
+	fd = -1;
+#endif
+	view = nullptr;
+	bytes = 0;
+}
+
+const unsigned char* MappedFile::data() const
+{
+	return view;
+}
+
+size_t MappedFile::size() const
+{
+	return bytes;
+}
+
+unsigned long long snapshotChecksum(const void* data, size_t bytes, unsigned long long seed)
+{
+	// memcpy per word, the header copy on the stack is not 8 byte aligned everywhere
+	const unsigned char* p = (const unsigned char*)data;
+	unsigned long long hash = seed;
+	for (size_t i = 0; i + 8 <= bytes; i += 8)
+	{
+		unsigned long long word;
+		memcpy(&word, p + i, 8);
+		hash = (hash ^ word) * 1099511628211ull;
+	}
+	return hash;
+}
+
+bool BVH::isSnapshot() const
+{
+	return snapshot != nullptr;
+}
+
+unsigned long long BVH::snapshotKey(const AABBLanes& boxes, int buildType)
+{
+	// the lanes one after the other, a tree over other boxes must not pass for this one
+	unsigned long long key = (14695981039346656037ull ^ (unsigned int)buildType) * 1099511628211ull;
+	key = (key ^ (unsigned long long)boxes.count) * 1099511628211ull;
+	const float* lanes[6] = { boxes.minX, boxes.minY, boxes.minZ, boxes.maxX, boxes.maxY, boxes.maxZ };
+	size_t wholeWords = (boxes.count * sizeof(float)) & ~(size_t)7;
+	for (int lane = 0; lane < 6; lane++)
+	{
+		key = snapshotChecksum(lanes[lane], wholeWords, key);
+		if (boxes.count & 1)
+		{
+			unsigned int last;
+			memcpy(&last, &lanes[lane][boxes.count - 1], 4);
+			key = (key ^ last) * 1099511628211ull;
+		}
+	}
+	return key;
+}
+
+static unsigned long long alignSection(unsigned long long offset)
+{
+	return (offset + BVH_SNAPSHOT_ALIGN - 1) & ~(BVH_SNAPSHOT_ALIGN - 1);
+}
+
+// the links the queries follow without a check: every child and leaf range in bounds, the flat nodes a
+// depth first tree with the smaller subtree first (that bounds BVH_STACK_SIZE) and the wide nodes a tree
+// no deeper than wideDepth. reads the nodes and primitives once, not the primitive bounds
+static bool validSnapshotTree(const BVHFlatNode* flat, int flatCount, const int* primitives, int primitiveCount,
+	int objectCount, const BVHWideNode* wide, int wideCount, int wideDepth)
+{
+	for (int k = 0; k < primitiveCount; k++)
+	{
+		if (primitives[k] < 0 || primitives[k] >= objectCount)
+			return false;
+	}
+
+	// subtree ends from the back, a branch's children come after it
+	vector<int> subtreeEnd(flatCount);
+	for (int i = flatCount - 1; i >= 0; i--)
+	{
+		const BVHFlatNode& node = flat[i];
+		if (node.count > 0)
+		{
+			if (node.offset < 0 || (long long)node.offset + node.count > primitiveCount)
+				return false;
+			subtreeEnd[i] = i + 1;
+			continue;
+		}
+		if (node.count < 0 || node.offset <= i + 1 || node.offset >= flatCount || subtreeEnd[i + 1] != node.offset)
+			return false;
+		subtreeEnd[i] = subtreeEnd[node.offset];
+		if (node.offset - (i + 1) > subtreeEnd[i] - node.offset)
+			return false;
+	}
+	if (subtreeEnd[0] != flatCount)
+		return false;
+
+	// a wide child always comes after its parent, so one pass gives every node its level
+	vector<int> level(wideCount, 0);
+	if (wideCount > 0)
+		level[0] = 1;
+	for (int i = 0; i < wideCount; i++)
+	{
+		const BVHWideNode& node = wide[i];
+		if (level[i] == 0 || level[i] > wideDepth || (node.childMask & ~15) != 0)
+			return false;
+		for (int k = 0; k < 4; k++)
+		{
+			if (!(node.childMask & (1 << k)))
+				continue;
+			if (node.count[k] > 0)
+			{
+				if (node.child[k] < 0 || (long long)node.child[k] + node.count[k] > primitiveCount)
+					return false;
+			}
+			else
+			{
+				if (node.child[k] <= i || node.child[k] >= wideCount || level[node.child[k]] != 0)
+					return false;
+				level[node.child[k]] = level[i] + 1;
+			}
+		}
+	}
+	return true;
+}
+
+bool BVH::saveSnapshot(const string& path, unsigned long long sceneKey) const
+{
+	if (dynamic || queryFlatCount == 0)
+		return false;
+
+	BVHSnapshotHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, BVH_SNAPSHOT_MAGIC, sizeof(header.magic));
+	header.version = BVH_SNAPSHOT_VERSION;
+	header.headerSize = sizeof(BVHSnapshotHeader);
+	header.flatNodeSize = sizeof(BVHFlatNode);
+	header.wideNodeSize = sizeof(BVHWideNode);
+	header.objectCount = queryPrimitiveCount;
+	header.flatNodeCount = queryFlatCount;
+	header.primitiveCount = queryPrimitiveCount;
+	header.wideNodeCount = queryWideCount;
+	header.wideDepth = queryWideDepth;
+	header.buildCost = buildCost;
+	header.sceneKey = sceneKey;
+	header.nodeOffset = alignSection(sizeof(BVHSnapshotHeader));
+	header.primitiveOffset = alignSection(header.nodeOffset + (unsigned long long)queryFlatCount * sizeof(BVHFlatNode));
+	header.boundsOffset = alignSection(header.primitiveOffset + (unsigned long long)queryPrimitiveCount * sizeof(int));
+	header.wideOffset = alignSection(header.boundsOffset + (unsigned long long)queryPrimitiveCount * 6 * sizeof(float));
+	header.fileSize = alignSection(header.wideOffset + (unsigned long long)queryWideCount * sizeof(BVHWideNode));
+
+	// the whole file in memory once, so the checksum runs over exactly the bytes that get written
+	vector<unsigned char> file(header.fileSize, 0);
+	memcpy(&file[header.nodeOffset], queryFlat, queryFlatCount * sizeof(BVHFlatNode));
+	memcpy(&file[header.primitiveOffset], queryPrimitives, queryPrimitiveCount * sizeof(int));
+	memcpy(&file[header.boundsOffset], queryPrimBounds, queryPrimitiveCount * 6 * sizeof(float));
+	if (queryWideCount > 0)
+		memcpy(&file[header.wideOffset], queryWideNodes, queryWideCount * sizeof(BVHWideNode));
+	header.payloadChecksum = snapshotChecksum(&file[header.nodeOffset], header.fileSize - header.nodeOffset);
+	header.headerChecksum = snapshotChecksum(&header, offsetof(BVHSnapshotHeader, headerChecksum));
+	memcpy(&file[0], &header, sizeof(header));
+
+	FILE* out = fopen(path.c_str(), "wb");
+	if (out == nullptr)
+		return false;
+	bool written = fwrite(file.data(), 1, file.size(), out) == file.size();
+	return fclose(out) == 0 && written;
+}
+
+bool BVH::loadSnapshot(const string& path, int objectCount, unsigned long long sceneKey, bool verifyPayload)
+{
+	unique_ptr<MappedFile> mapped(new MappedFile());
+	if (!mapped->open(path) || mapped->size() < sizeof(BVHSnapshotHeader))
+		return false;
+
+	BVHSnapshotHeader header;
+	memcpy(&header, mapped->data(), sizeof(header));
+	if (memcmp(header.magic, BVH_SNAPSHOT_MAGIC, sizeof(header.magic)) != 0
+		|| header.headerChecksum != snapshotChecksum(&header, offsetof(BVHSnapshotHeader, headerChecksum))
+		|| header.version != BVH_SNAPSHOT_VERSION
+		|| header.headerSize != sizeof(BVHSnapshotHeader)
+		|| header.flatNodeSize != sizeof(BVHFlatNode)
+		|| header.wideNodeSize != sizeof(BVHWideNode))
+		return false;
+	if (header.objectCount != objectCount || header.primitiveCount != objectCount || header.sceneKey != sceneKey
+		|| header.flatNodeCount <= 0 || header.fileSize != mapped->size())
+		return false;
+
+	// the sections have to sit inside the file where save put them
+	unsigned long long nodeEnd = header.nodeOffset + (unsigned long long)header.flatNodeCount * sizeof(BVHFlatNode);
+	unsigned long long primitiveEnd = header.primitiveOffset + (unsigned long long)header.primitiveCount * sizeof(int);
+	unsigned long long boundsEnd = header.boundsOffset + (unsigned long long)header.primitiveCount * 6 * sizeof(float);
+	unsigned long long wideEnd = header.wideOffset + (unsigned long long)header.wideNodeCount * sizeof(BVHWideNode);
+	if (header.nodeOffset < sizeof(BVHSnapshotHeader) || header.primitiveOffset < nodeEnd || header.boundsOffset < primitiveEnd
+		|| header.wideOffset < boundsEnd || header.fileSize < wideEnd || header.wideNodeCount < 0
+		|| (header.nodeOffset | header.primitiveOffset | header.boundsOffset | header.wideOffset) % BVH_SNAPSHOT_ALIGN != 0)
+		return false;
+
+	const unsigned char* data = mapped->data();
+	if (verifyPayload && header.payloadChecksum != snapshotChecksum(data + header.nodeOffset, header.fileSize - header.nodeOffset))
+		return false;
+	if (!validSnapshotTree((const BVHFlatNode*)(data + header.nodeOffset), header.flatNodeCount, (const int*)(data + header.primitiveOffset),
+		header.primitiveCount, objectCount, (const BVHWideNode*)(data + header.wideOffset), header.wideNodeCount, header.wideDepth))
+		return false;
+
+	// the old tree goes, the queries read the file from here on
+	clear();
+	buildCost = header.buildCost;
+	queryFlat = (const BVHFlatNode*)(data + header.nodeOffset);
+	queryFlatCount = header.flatNodeCount;
+	queryPrimitives = (const int*)(data + header.primitiveOffset);
+	queryPrimitiveCount = header.primitiveCount;
+	queryPrimBounds = (const float*)(data + header.boundsOffset);
+	queryWideNodes = (const BVHWideNode*)(data + header.wideOffset);
+	queryWideCount = header.wideNodeCount;
+	queryWideDepth = header.wideDepth;
+	snapshot = std::move(mapped);
+	return true;
+}
+
+void BVH::unpackSnapshot()
+{
+	// the mapped flat arrays become the query vectors as they are, which lets go of the file. the wide
+	// nodes are collapsed again by the refit, it needs their child slots
+	flatNodes.assign(queryFlat, queryFlat + queryFlatCount);
+	flatPrimitives.assign(queryPrimitives, queryPrimitives + queryPrimitiveCount);
+	flatPrimBounds.assign(queryPrimBounds, queryPrimBounds + queryPrimitiveCount * 6);
+	wideNodes.clear();
+	wideSource.clear();
+	bindQueryData();
+}
+
+void BVH::unpackNodes()
+{
+	// flat slot i becomes node i: a branch has its first child at i + 1 and the second at offset. the
+	// slots keep their layout, so there is no flatten, the refit writes straight back into them
+	int nodeCount = flatNodes.size();
+	primitiveIndices = flatPrimitives;
+	primBounds.resize(flatPrimitives.size() * 6);
+	for (int k = 0; k < (int)flatPrimitives.size(); k++)
+		std::copy(&flatPrimBounds[k * 6], &flatPrimBounds[k * 6] + 6, &primBounds[flatPrimitives[k] * 6]);
+
+	bvhNodes.clear();
+	bvhNodes.reserve(nodeCount);
+	for (int i = 0; i < nodeCount; i++)
+	{
+		const BVHFlatNode& flat = flatNodes[i];
+		AABB aabb(flat.min[0], flat.min[1], flat.min[2], flat.max[0], flat.max[1], flat.max[2]);
+		if (flat.count == 0)
+		{
+			BVHNode node(aabb, -1, i + 1, flat.offset, i, -1);
+			bvhNodes.push_back(node);
+		}
+		else
+		{
+			BVHNode node(aabb, -1, -1, -1, i, primitiveIndices[flat.offset]);
+			node.firstPrimitive = flat.offset;
+			node.primitiveCount = flat.count;
+			bvhNodes.push_back(node);
+		}
+	}
+	for (int i = 0; i < nodeCount; i++)
+	{
+		if (bvhNodes[i].indexMapToScene != -1)
+			continue;
+		bvhNodes[i + 1].parentNode = i;
+		bvhNodes[bvhNodes[i].rightChildNode].parentNode = i;
+	}
+	rootIndex = 0;
+
+	// children sit behind their parent, so the slots backwards are a refit order
+	flatSource.resize(nodeCount);
+	refitOrder.resize(nodeCount);
+	for (int i = 0; i < nodeCount; i++)
+	{
+		flatSource[i] = i;
+		refitOrder[i] = nodeCount - 1 - i;
+	}
+	if (wideSource.empty())
+		collapseWide();
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+using namespace std;
+
+/*
+ read only view of a whole file, CreateFileMapping on windows and mmap elsewhere. the pages come in on
+ first touch, so opening a big file costs about the same as a small one.
+*/
+
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool open(const string& path);
+	void close();
+	const unsigned char* data() const;
+	size_t size() const;
+
+private:
+	const unsigned char* view;
+	size_t bytes;
+#ifdef _WIN32
+	void* fileHandle;
+	void* mappingHandle;
+#else
+	int fd;
+#endif
+};
+
+/*
+ layout of a BVH snapshot (BVH::saveSnapshot), the query copy of the tree as it sits in memory:
+ header, flat nodes, flat primitives, flat primitive bounds, wide nodes, every section starting on a
+ 64 byte boundary of the file so the mapped nodes keep their cache line alignment. the node sizes and
+ the version guard against a layout change, sceneKey against a snapshot of different boxes.
+*/
+
+static const char BVH_SNAPSHOT_MAGIC[8] = { 'B', 'V', 'H', 'S', 'N', 'A', 'P', 0 };
+static const unsigned int BVH_SNAPSHOT_VERSION = 1;
+static const unsigned long long BVH_SNAPSHOT_ALIGN = 64;
+
+struct BVHSnapshotHeader
+{
+	char magic[8];
+	unsigned int version;
+	unsigned int headerSize;
+	unsigned int flatNodeSize;
+	unsigned int wideNodeSize;
+	int objectCount;
+	int flatNodeCount;
+	int primitiveCount;
+	int wideNodeCount;
+	int wideDepth;
+	float buildCost;
+	unsigned long long sceneKey;
+	unsigned long long nodeOffset;       // from the start of the file
+	unsigned long long primitiveOffset;
+	unsigned long long boundsOffset;
+	unsigned long long wideOffset;
+	unsigned long long fileSize;
+	unsigned long long payloadChecksum;  // everything after the header
+	unsigned long long headerChecksum;   // the header up to here
+};
+static_assert(sizeof(BVHSnapshotHeader) % 8 == 0, "the checksums run over 8 byte words");
+
+// fnv-1a over 8 byte words (bytes must be a multiple of 8), a pass over the data at memory speed
+unsigned long long snapshotChecksum(const void* data, size_t bytes, unsigned long long seed = 14695981039346656037ull);
@@ -0,0 +1,460 @@
+#include "BVH.h"
+#include "DynamicAABBTree.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+// the batched queries walk either tree through one of these views. a node has a first child (the
+// smaller subtree on the flat tree), a second one, or a range of leaf slots
+struct FlatTreeView
+{
+	const BVHFlatNode* nodes;
+	const int* primitives;
+	const float* primBounds;
+
+	int root() const { return 0; }
+	void bounds(int n, float* b) const
+	{
+		b[0] = nodes[n].min[0]; b[1] = nodes[n].min[1]; b[2] = nodes[n].min[2];
+		b[3] = nodes[n].max[0]; b[4] = nodes[n].max[1]; b[5] = nodes[n].max[2];
+	}
+	bool isLeaf(int n) const { return nodes[n].count > 0; }
+	int first(int n) const { return n + 1; }
+	int second(int n) const { return nodes[n].offset; }
+	int leafBegin(int n) const { return nodes[n].offset; }
+	int leafEnd(int n) const { return nodes[n].offset + nodes[n].count; }
+	int object(int slot) const { return primitives[slot]; }
+	const float* objectBounds(int slot) const { return primBounds + slot * 6; }
+};
+
+struct DynamicTreeView
+{
+	const DynamicAABBTree* tree;
+
+	int root() const { return tree->getRootIndex(); }
+	void bounds(int n, float* b) const
+	{
+		const AABB& aabb = tree->getNode(n).aabb;
+		b[0] = aabb.minX; b[1] = aabb.minY; b[2] = aabb.minZ;
+		b[3] = aabb.maxX; b[4] = aabb.maxY; b[5] = aabb.maxZ;
+	}
+	bool isLeaf(int n) const { return tree->getNode(n).indexMapToScene != -1; }
+	int first(int n) const { return tree->getNode(n).leftChildNode; }
+	int second(int n) const { return tree->getNode(n).rightChildNode; }
+	int leafBegin(int n) const { return n; }
+	int leafEnd(int n) const { return n + 1; }
+	int object(int slot) const { return tree->getNode(slot).indexMapToScene; }
+	const float* objectBounds(int slot) const { return tree->getTightBounds(object(slot)); }
+};
+
+static float boxDistanceSq(const vec3& p, const float* b)
+{
+	float dx = std::max(std::max(b[0] - p.x, p.x - b[3]), 0.0f);
+	float dy = std::max(std::max(b[1] - p.y, p.y - b[4]), 0.0f);
+	float dz = std::max(std::max(b[2] - p.z, p.z - b[5]), 0.0f);
+	return dx * dx + dy * dy + dz * dz;
+}
+
+// entry distance of the ray into the box, FLT_MAX on a miss or beyond maxT
+static float rayBox(const vec3& origin, const vec3& inverse, float maxT, const float* b)
+{
+	float enter = 0.0f;
+	float leave = maxT;
+	for (int a = 0; a < 3; a++)
+	{
+		float t0 = (b[a] - origin[a]) * inverse[a];
+		float t1 = (b[a + 3] - origin[a]) * inverse[a];
+		if (t0 > t1)
+			std::swap(t0, t1);
+		enter = std::max(enter, t0);
+		leave = std::min(leave, t1);
+	}
+	return enter <= leave ? enter : FLT_MAX;
+}
+
+// -1 outside some plane, otherwise mask with the planes the box is not fully inside of
+static int classifyFrustum(const vec4* planes, int mask, const float* b)
+{
+	for (int p = 0; mask >> p; p++)
+	{
+		if (!(mask & (1 << p)))
+			continue;
+
+		const vec4& plane = planes[p];
+		float outer = plane.w + plane.x * (plane.x >= 0.0f ? b[3] : b[0]) + plane.y * (plane.y >= 0.0f ? b[4] : b[1]) + plane.z * (plane.z >= 0.0f ? b[5] : b[2]);
+		if (outer < 0.0f)
+			return -1;
+		float inner = plane.w + plane.x * (plane.x >= 0.0f ? b[0] : b[3]) + plane.y * (plane.y >= 0.0f ? b[1] : b[4]) + plane.z * (plane.z >= 0.0f ? b[2] : b[5]);
+		if (inner >= 0.0f)
+			mask &= ~(1 << p);
+	}
+	return mask;
+}
+
+template <typename Tree>
+static int frustumQuery(const Tree& tree, const vec4* planes, int planeCount, int* results, int capacity)
+{
+	// planes the node is fully inside of are not tested again below it
+	pair<int, int> stack[BVH_STACK_SIZE];  // node, plane mask
+	int top = 0;
+	int found = 0;
+	float b[6];
+	int nodeIndex = tree.root();
+	int mask = (1 << planeCount) - 1;
+	while (true)
+	{
+		tree.bounds(nodeIndex, b);
+		mask = classifyFrustum(planes, mask, b);
+		if (mask != -1)
+		{
+			if (!tree.isLeaf(nodeIndex))
+			{
+				stack[top++] = make_pair(tree.second(nodeIndex), mask);
+				nodeIndex = tree.first(nodeIndex);
+				continue;
+			}
+
+			for (int slot = tree.leafBegin(nodeIndex); slot < tree.leafEnd(nodeIndex); slot++)
+			{
+				if (mask != 0 && classifyFrustum(planes, mask, tree.objectBounds(slot)) == -1)
+					continue;
+				if (found < capacity)
+					results[found] = tree.object(slot);
+				found++;
+			}
+		}
+
+		if (top == 0)
+			break;
+		nodeIndex = stack[--top].first;
+		mask = stack[top].second;
+	}
+	return found;
+}
+
+// the frustum walk below one node whose plane mask is already known, objects appended to out
+template <typename Tree>
+static void frustumSubtree(const Tree& tree, const vec4* planes, int root, int rootMask, vector<int>& out)
+{
+	pair<int, int> stack[BVH_STACK_SIZE];
+	int top = 0;
+	float b[6];
+	int nodeIndex = root;
+	int mask = rootMask;
+	while (true)
+	{
+		// a node inside every plane passes its whole subtree, no bounds are read below it
+		if (mask != 0)
+		{
+			tree.bounds(nodeIndex, b);
+			mask = classifyFrustum(planes, mask, b);
+		}
+		if (mask != -1)
+		{
+			if (!tree.isLeaf(nodeIndex))
+			{
+				stack[top++] = make_pair(tree.second(nodeIndex), mask);
+				nodeIndex = tree.first(nodeIndex);
+				continue;
+			}
+
+			for (int slot = tree.leafBegin(nodeIndex); slot < tree.leafEnd(nodeIndex); slot++)
+			{
+				if (mask != 0 && classifyFrustum(planes, mask, tree.objectBounds(slot)) == -1)
+					continue;
+				out.push_back(tree.object(slot));
+			}
+		}
+
+		if (top == 0)
+			break;
+		nodeIndex = stack[--top].first;
+		mask = stack[top].second;
+	}
+}
+
+// splits the top of the walk into up to about BVH_CULL_TASKS subtrees in tree order, the culled ones
+// already gone. inside subtrees are split too, they are most of the work when the camera sees everything
+template <typename Tree>
+static void splitFrustumTasks(const Tree& tree, const vec4* planes, int planeCount,
+	vector<pair<int, int>>& tasks, vector<pair<int, int>>& next)
+{
+	float b[6];
+	tasks.clear();
+	tree.bounds(tree.root(), b);
+	int rootMask = classifyFrustum(planes, (1 << planeCount) - 1, b);
+	if (rootMask == -1)
+		return;
+	tasks.push_back(make_pair(tree.root(), rootMask));
+
+	for (int level = 0; level < 16 && tasks.size() < BVH_CULL_TASKS; level++)
+	{
+		next.clear();
+		bool split = false;
+		for (const pair<int, int>& task : tasks)
+		{
+			if (tree.isLeaf(task.first))
+			{
+				next.push_back(task);
+				continue;
+			}
+
+			split = true;
+			int children[2] = { tree.first(task.first), tree.second(task.first) };
+			for (int c = 0; c < 2; c++)
+			{
+				int mask = task.second;
+				if (mask != 0)
+				{
+					tree.bounds(children[c], b);
+					mask = classifyFrustum(planes, mask, b);
+				}
+				if (mask != -1)
+					next.push_back(make_pair(children[c], mask));
+			}
+		}
+		tasks.swap(next);
+		if (!split)
+			break;
+	}
+}
+
+template <typename Tree>
+static void frustumCull(const Tree& tree, const vec4* planes, int planeCount, vector<int>& visible, ThreadPool& pool,
+	vector<pair<int, int>>& tasks, vector<pair<int, int>>& next, vector<vector<int>>& chunkResults)
+{
+	splitFrustumTasks(tree, planes, planeCount, tasks, next);
+
+	chunkResults.resize(pool.getThreadCount());
+	for (size_t c = 0; c < chunkResults.size(); c++)
+		chunkResults[c].clear();
+
+	pool.parallelFor(tasks.size(), [&tree, planes, &tasks, &chunkResults](int begin, int end, int chunk)
+		{
+			for (int t = begin; t < end; t++)
+				frustumSubtree(tree, planes, tasks[t].first, tasks[t].second, chunkResults[chunk]);
+		}, 1);
+
+	// chunks are contiguous task ranges, joined in order
+	for (size_t c = 0; c < chunkResults.size(); c++)
+		visible.insert(visible.end(), chunkResults[c].begin(), chunkResults[c].end());
+}
+
+template <typename Tree>
+static int radiusQuery(const Tree& tree, const vec3& center, float radius, int* results, int capacity)
+{
+	int stack[BVH_STACK_SIZE];
+	int top = 0;
+	int found = 0;
+	float b[6];
+	float radiusSq = radius * radius;
+	int nodeIndex = tree.root();
+	while (true)
+	{
+		tree.bounds(nodeIndex, b);
+		if (boxDistanceSq(center, b) <= radiusSq)
+		{
+			if (!tree.isLeaf(nodeIndex))
+			{
+				stack[top++] = tree.second(nodeIndex);
+				nodeIndex = tree.first(nodeIndex);
+				continue;
+			}
+
+			for (int slot = tree.leafBegin(nodeIndex); slot < tree.leafEnd(nodeIndex); slot++)
+			{
+				if (boxDistanceSq(center, tree.objectBounds(slot)) > radiusSq)
+					continue;
+				if (found < capacity)
+					results[found] = tree.object(slot);
+				found++;
+			}
+		}
+
+		if (top == 0)
+			break;
+		nodeIndex = stack[--top];
+	}
+	return found;
+}
+
+// nearer child first while the stack is at most half full, then the smaller child first like the other
+// walks, which keeps the stack within its size on the flat tree
+template <typename Tree, typename Key>
+static void orderChildren(const Tree& tree, int nodeIndex, int top, const Key& key, int& nearChild, float& nearKey, int& farChild, float& farKey)
+{
+	nearChild = tree.first(nodeIndex);
+	farChild = tree.second(nodeIndex);
+	nearKey = key(nearChild);
+	farKey = key(farChild);
+	if (top < BVH_STACK_SIZE / 2 && farKey < nearKey)
+	{
+		std::swap(nearChild, farChild);
+		std::swap(nearKey, farKey);
+	}
+}
+
+template <typename Tree>
+static int rayQuery(const Tree& tree, const vec3& origin, const vec3& direction, float maxDistance, float& hitDistance)
+{
+	vec3 inverse(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+	float b[6];
+	auto entry = [&](int n) { tree.bounds(n, b); return rayBox(origin, inverse, maxDistance, b); };
+
+	pair<int, float> stack[BVH_STACK_SIZE];  // node, entry distance
+	int top = 0;
+	int hit = -1;
+	hitDistance = maxDistance;
+	int nodeIndex = tree.root();
+	float nodeEntry = entry(nodeIndex);
+	while (true)
+	{
+		if (nodeEntry < hitDistance)
+		{
+			if (tree.isLeaf(nodeIndex))
+			{
+				for (int slot = tree.leafBegin(nodeIndex); slot < tree.leafEnd(nodeIndex); slot++)
+				{
+					float t = rayBox(origin, inverse, hitDistance, tree.objectBounds(slot));
+					if (t < hitDistance)
+					{
+						hitDistance = t;
+						hit = tree.object(slot);
+					}
+				}
+			}
+			else
+			{
+				int nearChild, farChild;
+				float nearEntry, farEntry;
+				orderChildren(tree, nodeIndex, top, entry, nearChild, nearEntry, farChild, farEntry);
+				if (farEntry < hitDistance)
+					stack[top++] = make_pair(farChild, farEntry);
+				nodeIndex = nearChild;
+				nodeEntry = nearEntry;
+				continue;
+			}
+		}
+
+		if (top == 0)
+			break;
+		nodeIndex = stack[--top].first;
+		nodeEntry = stack[top].second;
+	}
+	return hit;
+}
+
+template <typename Tree>
+static int nearestQuery(const Tree& tree, const vec3& point, int k, int excludeObject, pair<float, int>* neighbours)
+{
+	// neighbours is a max heap on the distance while searching, the worst one is pruned against
+	float b[6];
+	auto distance = [&](int n) { tree.bounds(n, b); return boxDistanceSq(point, b); };
+
+	pair<int, float> stack[BVH_STACK_SIZE];
+	int top = 0;
+	int count = 0;
+	float worst = FLT_MAX;
+	int nodeIndex = tree.root();
+	float nodeDistance = distance(nodeIndex);
+	while (true)
+	{
+		if (nodeDistance < worst)
+		{
+			if (tree.isLeaf(nodeIndex))
+			{
+				for (int slot = tree.leafBegin(nodeIndex); slot < tree.leafEnd(nodeIndex); slot++)
+				{
+					int object = tree.object(slot);
+					float d = boxDistanceSq(point, tree.objectBounds(slot));
+					if (object == excludeObject || d >= worst)
+						continue;
+
+					if (count == k)
+					{
+						std::pop_heap(neighbours, neighbours + count);
+						count--;
+					}
+					neighbours[count++] = make_pair(d, object);
+					std::push_heap(neighbours, neighbours + count);
+					if (count == k)
+						worst = neighbours[0].first;
+				}
+			}
+			else
+			{
+				int nearChild, farChild;
+				float nearDistance, farDistance;
+				orderChildren(tree, nodeIndex, top, distance, nearChild, nearDistance, farChild, farDistance);
+				if (farDistance < worst)
+					stack[top++] = make_pair(farChild, farDistance);
+				nodeIndex = nearChild;
+				nodeDistance = nearDistance;
+				continue;
+			}
+		}
+
+		if (top == 0)
+			break;
+		nodeIndex = stack[--top].first;
+		nodeDistance = stack[top].second;
+	}
+
+	std::sort_heap(neighbours, neighbours + count);
+	for (int i = 0; i < count; i++)
+		neighbours[i].first = std::sqrt(neighbours[i].first);
+	return count;
+}
+
+int BVH::queryFrustum(const vec4* planes, int planeCount, int* results, int capacity) const
+{
+	if (dynamic)
+		return dynamicTree->getRootIndex() == -1 ? 0 : frustumQuery(DynamicTreeView{ dynamicTree.get() }, planes, planeCount, results, capacity);
+	if (queryFlatCount == 0)
+		return 0;
+	return frustumQuery(FlatTreeView{ queryFlat, queryPrimitives, queryPrimBounds }, planes, planeCount, results, capacity);
+}
+
+void BVH::queryFrustum(const vec4* planes, int planeCount, vector<int>& visible, ThreadPool& pool)
+{
+	visible.clear();
+	if (dynamic)
+	{
+		if (dynamicTree->getRootIndex() != -1)
+			frustumCull(DynamicTreeView{ dynamicTree.get() }, planes, planeCount, visible, pool, cullTasks, cullTaskScratch, cullResults);
+		return;
+	}
+	if (queryFlatCount == 0)
+		return;
+	frustumCull(FlatTreeView{ queryFlat, queryPrimitives, queryPrimBounds }, planes, planeCount, visible, pool, cullTasks, cullTaskScratch, cullResults);
+}
+
+int BVH::queryRadius(const vec3& center, float radius, int* results, int capacity) const
+{
+	if (dynamic)
+		return dynamicTree->getRootIndex() == -1 ? 0 : radiusQuery(DynamicTreeView{ dynamicTree.get() }, center, radius, results, capacity);
+	if (queryFlatCount == 0)
+		return 0;
+	return radiusQuery(FlatTreeView{ queryFlat, queryPrimitives, queryPrimBounds }, center, radius, results, capacity);
+}
+
+int BVH::raycast(const vec3& origin, const vec3& direction, float maxDistance, float& hitDistance) const
+{
+	hitDistance = maxDistance;
+	if (dynamic)
+		return dynamicTree->getRootIndex() == -1 ? -1 : rayQuery(DynamicTreeView{ dynamicTree.get() }, origin, direction, maxDistance, hitDistance);
+	if (queryFlatCount == 0)
+		return -1;
+	return rayQuery(FlatTreeView{ queryFlat, queryPrimitives, queryPrimBounds }, origin, direction, maxDistance, hitDistance);
+}
+
+int BVH::nearest(const vec3& point, int k, int excludeObject, pair<float, int>* neighbours) const
+{
+	if (k <= 0)
+		return 0;
+	if (dynamic)
+		return dynamicTree->getRootIndex() == -1 ? 0 : nearestQuery(DynamicTreeView{ dynamicTree.get() }, point, k, excludeObject, neighbours);
+	if (queryFlatCount == 0)
+		return 0;
+	return nearestQuery(FlatTreeView{ queryFlat, queryPrimitives, queryPrimBounds }, point, k, excludeObject, neighbours);
+}
@@ -0,0 +1,427 @@
+// headless simulation benchmark, no window and no gl context
+// usage: Benchmark [-ticks 600] [-agents 64] [-seed 2022] [-threads 0] [-broadphase hash | sap | bvh] [-bvh 1 | 0]
+//                  [-bvhtype sah | lbvh | insertion | dynamic] [-bins 16] [-leaf 1] [-refit 1 | 0] [-rotateevery 16] [-rebuildat 1.25]
+//                  [-margin 0.5] [-predict 0.1] [-pillars 0] [-metrics bvh_metrics.jsonl] [-metricsamples 1024]
+//                  [-ccd 1 | 0] [-rate 60]
+//        Benchmark -mode build [-sizes 1000,65536,300000] [-insertionmax 300000] [-bins 16] [-leaf 1] [-threads 0]
+//                  [-snapshot bvh_benchmark.snapshot]
+//        Benchmark -mode query [-agents 64] [-queries 4096] [-bvhtype sah | lbvh | insertion | dynamic] [-threads 0]
+
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <random>
+#include <cstdio>
+
+#include "Simulation.h"
+#include "BVHQueryBatch.h"
+
+typedef std::chrono::high_resolution_clock Clock;
+
+// stand-in for the rest box of custom4.dae, the mesh is not loaded here
+static const AABB rest_aabb(-1.0f, -1.0f, 0.0f, 1.0f, 1.0f, 4.0f);
+
+struct Options
+{
+	const char* mode = "simulate";
+	int ticks = 600;
+	int agentCount = 64;
+	unsigned int seed = 2022;
+	int threads = 0;
+	int broadPhaseType = SPATIAL_HASH;
+	bool enableBVH = true;
+	int bvhBuildType = BVH_BINNED_SAH;
+	BVHBuildSettings bvhSettings;
+	bool refitBVH = true;
+	int bvhRotateInterval = 16;
+	float bvhRebuildThreshold = 1.25f;
+	bool continuousCollision = true;
+	float tick_rate = 60.f;
+	vector<int> sizes = { 1000, 65536, 300000 };
+	int insertionMax = 300000;  // the insertion build is quadratic in the worst case, bigger sizes skip it
+	int queryCount = 4096;     // per query type in -mode query
+	int pillarCount = 0;       // static 2 x 2 obstacles scattered over the arena
+	const char* metricsPath = nullptr;  // json line of bvh metrics per tick
+	int metricsSamples = 1024;
+	const char* snapshotPath = "bvh_benchmark.snapshot";  // written and mapped again in -mode build
+};
+
+static double elapsedMs(Clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static void spawnCrowd(Simulation& simulation, int agentCount)
+{
+	// same grid layout as the viewer, the arena grows with the crowd so nobody spawns outside the walls
+	int rows = (int)std::sqrt(agentCount);
+	simulation.arenaMax = std::max(simulation.arenaMax, rows * 10.0f + 10.0f);
+	simulation.spawn(agentCount, rows, rest_aabb);
+}
+
+static void timeQueries(const BVH& bvh, const AgentStore& agents)
+{
+	// every agent box against the tree into one reused buffer, like a broad-phase would
+	vector<int> results(256);
+	long long found = 0;
+	Clock::time_point start = Clock::now();
+	for (int i = 0; i < agents.size(); i++)
+		found += bvh.queryBinary(agents.aabb(i), i, results.data(), results.size());
+	double binaryMs = elapsedMs(start);
+
+	found = 0;
+	start = Clock::now();
+	for (int i = 0; i < agents.size(); i++)
+		found += bvh.query(agents.aabb(i), i, results.data(), results.size());
+	double wideMs = elapsedMs(start);
+	std::cout << "                binary " << agents.size() / binaryMs * 1e-3 << " M queries/s, " << bvh.getFlatNodeCount() * sizeof(BVHFlatNode) / 1024 << " KB, "
+		<< "wide " << agents.size() / wideMs * 1e-3 << " M queries/s, " << bvh.getWideNodeCount() * sizeof(BVHWideNode) / 1024 << " KB, "
+		<< found << " pairs" << std::endl;
+}
+
+static void printMetrics(const BVH& bvh, const AgentStore& agents, int sampleCount)
+{
+	BVHProfiler profiler;
+	profiler.measure(bvh, agents.lanes(), sampleCount);
+	const BVHMetrics& metrics = profiler.getMetrics();
+	double queries = std::max(metrics.queries.queries, 1LL);
+	std::cout << "                depth " << metrics.maxDepth << " (leaves " << metrics.averageLeafDepth << " on average), sibling overlap "
+		<< metrics.leafOverlapRatio << ", " << metrics.queries.nodesVisited / queries << " nodes and "
+		<< metrics.queries.boxTests / queries << " box tests per query" << std::endl;
+}
+
+static void runBuildComparison(const Options& options)
+{
+	ThreadPool pool(options.threads);
+	std::cout << "bvh build, " << options.bvhSettings.binCount << " bins, leaf size " << options.bvhSettings.maxLeafSize
+		<< ", " << pool.getThreadCount() << " threads for the lbvh" << std::endl;
+
+	for (int agentCount : options.sizes)
+	{
+		Simulation simulation(options.seed);
+		simulation.enableBVH = false;
+		spawnCrowd(simulation, agentCount);
+
+		// a few ticks so the crowd is not on the spawn grid anymore
+		for (int t = 0; t < 60; t++)
+			simulation.tick(1.f / 60.f);
+
+		BVH bvh;
+		bvh.build(simulation.agents.lanes(), options.bvhSettings);  // warm up the scratch vectors
+		Clock::time_point start = Clock::now();
+		bvh.build(simulation.agents.lanes(), options.bvhSettings);
+		double sahMs = elapsedMs(start);
+		std::cout << "  " << agentCount << " agents" << std::endl;
+		std::cout << "    binned sah  " << sahMs << " ms, " << bvh.getNodeCount() << " nodes, sah cost " << bvh.getSAHCost() << std::endl;
+		timeQueries(bvh, simulation.agents);
+		printMetrics(bvh, simulation.agents, options.metricsSamples);
+
+		// one tick of movement, then the per tick refit (bounds only) and the periodic rotation pass on
+		// the same tree, ns per node shows whether both stay linear in the tree size
+		simulation.tick(1.f / 60.f);
+		start = Clock::now();
+		bvh.refit(simulation.agents.lanes(), false);
+		double refitMs = elapsedMs(start);
+		simulation.tick(1.f / 60.f);
+		start = Clock::now();
+		bvh.refit(simulation.agents.lanes(), true);
+		double rotateMs = elapsedMs(start);
+		std::cout << "    refit       " << refitMs << " ms (" << refitMs * 1e6 / bvh.getNodeCount() << " ns per node), with rotations "
+			<< rotateMs << " ms (" << rotateMs * 1e6 / bvh.getNodeCount() << " ns per node), sah cost " << bvh.getSAHCost() << std::endl;
+		bvh.build(simulation.agents.lanes(), options.bvhSettings);
+
+		// the same tree written out and mapped back instead of built, the first refit unpacks the nodes in
+		// their flat slots
+		unsigned long long sceneKey = BVH::snapshotKey(simulation.agents.lanes(), BVH_BINNED_SAH);
+		start = Clock::now();
+		bool saved = bvh.saveSnapshot(options.snapshotPath, sceneKey);
+		double saveMs = elapsedMs(start);
+		BVH mapped;
+		start = Clock::now();
+		bool loaded = saved && mapped.loadSnapshot(options.snapshotPath, agentCount, sceneKey, false);
+		double mapMs = elapsedMs(start);
+		start = Clock::now();
+		loaded = loaded && mapped.loadSnapshot(options.snapshotPath, agentCount, sceneKey);
+		double verifyMs = elapsedMs(start);
+		if (loaded)
+		{
+			std::cout << "    snapshot    save " << saveMs << " ms, map " << mapMs << " ms, map + checksum " << verifyMs << " ms" << std::endl;
+			timeQueries(mapped, simulation.agents);
+			start = Clock::now();
+			mapped.refit(simulation.agents.lanes(), false);
+			std::cout << "                first refit (unpack, bounds only like the simulation ticks) " << elapsedMs(start) << " ms" << std::endl;
+		}
+		else
+			std::cout << "    snapshot    could not write or map " << options.snapshotPath << std::endl;
+		std::remove(options.snapshotPath);
+
+		bvh.buildLBVH(simulation.agents.lanes(), pool);
+		start = Clock::now();
+		bvh.buildLBVH(simulation.agents.lanes(), pool);
+		double lbvhMs = elapsedMs(start);
+		std::cout << "    lbvh        " << lbvhMs << " ms, " << bvh.getNodeCount() << " nodes, sah cost " << bvh.getSAHCost() << std::endl;
+		timeQueries(bvh, simulation.agents);
+		printMetrics(bvh, simulation.agents, options.metricsSamples);
+
+		bvh.clear();
+		start = Clock::now();
+		bvh.updateDynamic(simulation.agents, options.bvhSettings);
+		double dynamicMs = elapsedMs(start);
+		std::cout << "    dynamic     " << dynamicMs << " ms, " << bvh.getNodeCount() << " nodes, sah cost " << bvh.getSAHCost() << std::endl;
+		timeQueries(bvh, simulation.agents);
+		printMetrics(bvh, simulation.agents, options.metricsSamples);
+
+		if (agentCount > options.insertionMax)
+		{
+			std::cout << "    insertion   skipped, above -insertionmax" << std::endl;
+			continue;
+		}
+
+		start = Clock::now();
+		bvh.buildInsertion(simulation.agents);
+		double insertionMs = elapsedMs(start);
+		std::cout << "    insertion   " << insertionMs << " ms, " << bvh.getNodeCount() << " nodes, sah cost " << bvh.getSAHCost() << std::endl;
+		timeQueries(bvh, simulation.agents);
+		printMetrics(bvh, simulation.agents, options.metricsSamples);
+	}
+}
+
+static void runQueryBatches(const Options& options)
+{
+	Simulation simulation(options.seed);
+	simulation.threadPool.resize(options.threads);
+	simulation.bvhBuildType = options.bvhBuildType;
+	simulation.bvhSettings = options.bvhSettings;
+	spawnCrowd(simulation, options.agentCount);
+	for (int t = 0; t < 60; t++)
+		simulation.tick(1.f / 60.f);
+	simulation.updateBVH();
+
+	const AgentStore& agents = simulation.agents;
+	std::mt19937 generator(options.seed);
+	std::uniform_int_distribution<int> pickAgent(0, agents.size() - 1);
+	std::uniform_real_distribution<float> angle(0.0f, 6.2831853f);
+	float arena = simulation.arenaMax;
+
+	// radius and nearest around agents, rays from the arena edge inwards, one frustum over the crowd
+	int count = options.queryCount;
+	BVHQueryBatch batches[4];
+	vector<int> radiusAgents(count);
+	for (int q = 0; q < count; q++)
+	{
+		int i = pickAgent(generator);
+		radiusAgents[q] = i;
+		vec3 position(agents.posX[i], agents.posY[i], agents.posZ[i]);
+		batches[QUERY_RADIUS].addRadius(position, 15.0f);
+		batches[QUERY_NEAREST].addNearest(position, 8, i);
+
+		float a = angle(generator);
+		vec3 origin(std::cos(a) * arena, std::sin(a) * arena, 2.0f);
+		batches[QUERY_RAY].addRay(origin, glm::normalize(vec3(agents.posX[i], agents.posY[i], 2.0f) - origin), 4.0f * arena);
+	}
+	mat4 projection = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 4.0f * arena);
+	mat4 view = glm::lookAt(vec3(0.0f, -arena, arena), vec3(0.0f), vec3(0.0f, 0.0f, 1.0f));
+	batches[QUERY_FRUSTUM].addFrustum(projection * view);
+
+	std::cout << "agents " << agents.size() << ", " << count << " queries per batch, threads " << simulation.threadPool.getThreadCount()
+		<< ", bvh " << (simulation.bvh.isDynamic() ? "dynamic" : options.bvhBuildType == BVH_INSERTION ? "insertion" : options.bvhBuildType == BVH_LBVH ? "lbvh" : "binned sah") << std::endl;
+
+	const char* names[4] = { "frustum ", "radius  ", "ray     ", "nearest " };
+	for (int type = 0; type < 4; type++)
+	{
+		batches[type].run(simulation.bvh, simulation.threadPool);  // warm up the arenas
+		Clock::time_point start = Clock::now();
+		batches[type].run(simulation.bvh, simulation.threadPool);
+		double ms = elapsedMs(start);
+		std::cout << "  " << names[type] << ms << " ms, " << batches[type].getTotalResults() << " results" << std::endl;
+	}
+
+	// the same frustum as the render culling walks it, one tree split over the pool
+	vec4 planes[6];
+	frustumPlanes(projection * view, planes);
+	vector<int> visible;
+	simulation.bvh.queryFrustum(planes, 6, visible, simulation.threadPool);
+	Clock::time_point start = Clock::now();
+	simulation.bvh.queryFrustum(planes, 6, visible, simulation.threadPool);
+	std::cout << "  culling  " << elapsedMs(start) << " ms, " << visible.size() << " visible" << std::endl;
+
+	// the radius batch against a scan over every agent, what the tree saves
+	start = Clock::now();
+	long long scanned = 0;
+	for (int q = 0; q < count; q++)
+	{
+		int i = radiusAgents[q];
+		for (int j = 0; j < agents.size(); j++)
+		{
+			float dx = std::max(std::max(agents.minX[j] - agents.posX[i], agents.posX[i] - agents.maxX[j]), 0.0f);
+			float dy = std::max(std::max(agents.minY[j] - agents.posY[i], agents.posY[i] - agents.maxY[j]), 0.0f);
+			float dz = std::max(std::max(agents.minZ[j] - agents.posZ[i], agents.posZ[i] - agents.maxZ[j]), 0.0f);
+			if (dx * dx + dy * dy + dz * dz <= 15.0f * 15.0f)
+				scanned++;
+		}
+	}
+	std::cout << "  radius by scanning every agent, one thread " << elapsedMs(start) << " ms, " << scanned << " results" << std::endl;
+}
+
+static void runSimulation(const Options& options)
+{
+	float tick_time = 1.f / options.tick_rate;
+
+	Simulation simulation(options.seed);
+	simulation.threadPool.resize(options.threads);
+	simulation.broadPhaseType = options.broadPhaseType;
+	simulation.enableBVH = options.enableBVH;
+	simulation.bvhBuildType = options.bvhBuildType;
+	simulation.bvhSettings = options.bvhSettings;
+	simulation.refitBVH = options.refitBVH;
+	simulation.bvhRotateInterval = options.bvhRotateInterval;
+	simulation.bvhRebuildThreshold = options.bvhRebuildThreshold;
+	simulation.continuousCollision = options.continuousCollision;
+	spawnCrowd(simulation, options.agentCount);
+
+	// static geometry for the obstacle tree, its own generator so the crowd gets the same velocities
+	std::mt19937 pillarGenerator(options.seed);
+	std::uniform_real_distribution<float> pillarPosition(simulation.arenaMin, simulation.arenaMax);
+	for (int p = 0; p < options.pillarCount; p++)
+	{
+		float x = pillarPosition(pillarGenerator);
+		float y = pillarPosition(pillarGenerator);
+		simulation.obstacles.add(AABB(x - 1.0f, y - 1.0f, -10.0f, x + 1.0f, y + 1.0f, 10.0f));
+	}
+
+	if (options.metricsPath != nullptr)
+	{
+		simulation.bvhMetricsSamples = options.metricsSamples;
+		if (!simulation.bvhProfiler.openLog(options.metricsPath))
+			std::cout << "could not open " << options.metricsPath << std::endl;
+	}
+
+	int ticks = options.ticks;
+	std::cout << "agents " << options.agentCount << ", ticks " << ticks << ", seed " << options.seed
+		<< ", threads " << simulation.threadPool.getThreadCount()
+		<< ", broad-phase " << (options.broadPhaseType == SWEEP_AND_PRUNE ? "sweep and prune" : options.broadPhaseType == BVH_SELF_COLLISION ? "bvh pairs" : "spatial hash")
+		<< ", bvh " << (!options.enableBVH ? "off" : options.bvhBuildType == BVH_INSERTION ? "insertion" : options.bvhBuildType == BVH_LBVH ? "lbvh" : options.bvhBuildType == BVH_DYNAMIC ? "dynamic" : "binned sah")
+		<< (options.enableBVH && options.refitBVH ? ", refit" : "")
+		<< ", ccd " << (options.continuousCollision ? "on" : "off")
+		<< ", " << options.pillarCount << " pillars"
+		<< ", " << options.tick_rate << " ticks/s" << std::endl;
+
+	SimulationTimings total;
+	double worstTick = 0.0;
+	long long pairs = 0;
+	long long obstacleContacts = 0;
+	long long contactEvents[3] = { 0, 0, 0 };
+	long long openContacts = 0;
+	int rebuilds = 0;
+	long long reinserts = 0;
+	for (int t = 0; t < ticks; t++)
+	{
+		simulation.tick(tick_time);
+
+		const SimulationTimings& timings = simulation.getTimings();
+		total.integrate += timings.integrate;
+		total.broadPhase += timings.broadPhase;
+		total.response += timings.response;
+		total.bvhUpdate += timings.bvhUpdate;
+		pairs += timings.candidatePairs;
+		obstacleContacts += timings.obstacleContacts;
+		if (timings.bvhRebuilt)
+			rebuilds++;
+		reinserts += timings.bvhReinserts;
+
+		// stand-in consumer, drains the contact events every tick
+		ContactEvent event;
+		while (simulation.contacts.events.pop(event))
+			contactEvents[event.type]++;
+		openContacts += simulation.contacts.getContactCount();
+		worstTick = std::max(worstTick, timings.integrate + timings.broadPhase + timings.response + timings.bvhUpdate);
+	}
+
+	// checksum of the final state, equal for every thread count with the same seed
+	double checksum = 0.0;
+	int escaped = 0;
+	for (int i = 0; i < simulation.agents.size(); i++)
+	{
+		checksum += simulation.agents.posX[i] * (i % 7 + 1) + simulation.agents.posY[i] * (i % 5 + 1);
+		if (std::abs(simulation.agents.posX[i]) > simulation.arenaMax || std::abs(simulation.agents.posY[i]) > simulation.arenaMax)
+			escaped++;
+	}
+
+	double n = std::max(ticks, 1);
+	std::cout << "ms per tick" << std::endl;
+	std::cout << "  integrate    " << total.integrate / n << std::endl;
+	std::cout << "  broad-phase  " << total.broadPhase / n << std::endl;
+	std::cout << "  response     " << total.response / n << std::endl;
+	std::cout << "  bvh update   " << total.bvhUpdate / n << std::endl;
+	std::cout << "  total        " << (total.integrate + total.broadPhase + total.response + total.bvhUpdate) / n
+		<< " (worst " << worstTick << ")" << std::endl;
+	std::cout << "candidate pairs per tick " << pairs / n << std::endl;
+	std::cout << "contact begin / end per tick " << contactEvents[CONTACT_BEGIN] / n << " / " << contactEvents[CONTACT_END] / n
+		<< ", " << openContacts / n << " open" << std::endl;
+	std::cout << "obstacle contacts per tick " << obstacleContacts / n << std::endl;
+	std::cout << "agents outside the walls " << escaped << std::endl;
+	std::cout << "checksum " << checksum << std::endl;
+	if (simulation.bvhProfiler.isLogging())
+		std::cout << "bvh metrics of " << simulation.bvhProfiler.getFrame() << " ticks in " << options.metricsPath << std::endl;
+	if (options.enableBVH && simulation.bvh.isDynamic())
+		std::cout << "bvh nodes " << simulation.bvh.getNodeCount() << ", sah cost " << simulation.bvh.getSAHCost()
+			<< ", " << reinserts / n << " reinserts per tick" << std::endl;
+	else if (options.enableBVH)
+		std::cout << "bvh nodes " << simulation.bvh.getNodeCount() << ", sah cost " << simulation.bvh.getSAHCost()
+			<< " (" << simulation.bvh.getBuildSAHCost() << " at the last build), " << rebuilds << " rebuilds" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+	Options options;
+	for (int a = 1; a + 1 < argc; a += 2)
+	{
+		const char* value = argv[a + 1];
+		if (strcmp(argv[a], "-mode") == 0) options.mode = value;
+		else if (strcmp(argv[a], "-ticks") == 0) options.ticks = atoi(value);
+		else if (strcmp(argv[a], "-agents") == 0) options.agentCount = atoi(value);
+		else if (strcmp(argv[a], "-seed") == 0) options.seed = (unsigned int)strtoul(value, nullptr, 10);
+		else if (strcmp(argv[a], "-threads") == 0) options.threads = atoi(value);
+		else if (strcmp(argv[a], "-broadphase") == 0) options.broadPhaseType = strcmp(value, "sap") == 0 ? SWEEP_AND_PRUNE : strcmp(value, "bvh") == 0 ? BVH_SELF_COLLISION : SPATIAL_HASH;
+		else if (strcmp(argv[a], "-bvh") == 0) options.enableBVH = atoi(value) != 0;
+		else if (strcmp(argv[a], "-bvhtype") == 0) options.bvhBuildType = strcmp(value, "insertion") == 0 ? BVH_INSERTION : strcmp(value, "lbvh") == 0 ? BVH_LBVH : strcmp(value, "dynamic") == 0 ? BVH_DYNAMIC : BVH_BINNED_SAH;
+		else if (strcmp(argv[a], "-bins") == 0) options.bvhSettings.binCount = atoi(value);
+		else if (strcmp(argv[a], "-leaf") == 0) options.bvhSettings.maxLeafSize = atoi(value);
+		else if (strcmp(argv[a], "-margin") == 0) options.bvhSettings.fatMargin = (float)atof(value);
+		else if (strcmp(argv[a], "-predict") == 0) options.bvhSettings.predictTime = (float)atof(value);
+		else if (strcmp(argv[a], "-refit") == 0) options.refitBVH = atoi(value) != 0;
+		else if (strcmp(argv[a], "-rotateevery") == 0) options.bvhRotateInterval = atoi(value);
+		else if (strcmp(argv[a], "-rebuildat") == 0) options.bvhRebuildThreshold = (float)atof(value);
+		else if (strcmp(argv[a], "-ccd") == 0) options.continuousCollision = atoi(value) != 0;
+		else if (strcmp(argv[a], "-rate") == 0) options.tick_rate = (float)atof(value);
+		else if (strcmp(argv[a], "-insertionmax") == 0) options.insertionMax = atoi(value);
+		else if (strcmp(argv[a], "-queries") == 0) options.queryCount = atoi(value);
+		else if (strcmp(argv[a], "-pillars") == 0) options.pillarCount = atoi(value);
+		else if (strcmp(argv[a], "-metrics") == 0) options.metricsPath = value;
+		else if (strcmp(argv[a], "-metricsamples") == 0) options.metricsSamples = atoi(value);
+		else if (strcmp(argv[a], "-snapshot") == 0) options.snapshotPath = value;
+		else if (strcmp(argv[a], "-sizes") == 0)
+		{
+			options.sizes.clear();
+			std::stringstream list(value);
+			std::string size;
+			while (std::getline(list, size, ','))
+				options.sizes.push_back(atoi(size.c_str()));
+		}
+		else std::cout << "unknown option " << argv[a] << std::endl;
+	}
+
+	if (strcmp(options.mode, "build") == 0)
+		runBuildComparison(options);
+	else if (strcmp(options.mode, "query") == 0)
+		runQueryBatches(options);
+	else
+		runSimulation(options);
+
+	return 0;
+}
@@ -18,6 +18,9 @@ layout(std140, binding = 0) uniform SceneUniforms
 };
 
 layout (location = 0) in vec3 pos_attrib;                                             
+// per box instance, pos_attrib is the corner of a 0..1 cube
+layout (location = 1) in vec3 box_min_attrib;
+layout (location = 2) in vec3 box_max_attrib;
 
 out VertexData
 {
@@ -28,5 +31,5 @@ out VertexData
 
 void main(void)
 {
-	gl_Position = PV * vec4(pos_attrib, 1.0);
+	gl_Position = PV * vec4(mix(box_min_attrib, box_max_attrib, pos_attrib), 1.0);
 }
\ No newline at end of file
@@ -51,3 +51,23 @@ void Camera::update()
     glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(SceneData), &SceneData);
     glBindBuffer(GL_UNIFORM_BUFFER, 0);
 }
+
+glm::mat4 Camera::getViewProjection() const
+{
+    return projMat * viewMat;
+}
+
+glm::mat4 Camera::getProjection() const
+{
+    return projMat;
+}
+
+glm::vec3 Camera::getPosition() const
+{
+    return camPos;
+}
+
+void Camera::getFrustumPlanes(glm::vec4* planes) const
+{
+    frustumPlanes(projMat * viewMat, planes);
+}
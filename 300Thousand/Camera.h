@@ -8,6 +8,7 @@
 #include <glm/gtc/type_ptr.hpp>
 #include <iostream>
 #include "ShaderLocs.h"
+#include "AABB.h"
 
 class Camera
 {
@@ -16,6 +17,10 @@ public:
 	void lookAt(glm::vec3 from, glm::vec3 to, glm::vec3 up);
 	void perspective(float fov, float aspect, float near, float far);
 	void update();
+	glm::mat4 getViewProjection() const;  // as of the last update()
+	glm::mat4 getProjection() const;
+	glm::vec3 getPosition() const;
+	void getFrustumPlanes(glm::vec4* planes) const;  // 6 planes, see frustumPlanes in AABB.h
 
 private:
 	GLuint scene_ubo = -1;
@@ -0,0 +1,56 @@
+#include "CollisionPhases.h"
+#include <algorithm>
+
+void CollisionPhases::build(const vector<pair<int, int>>& pairs, int agentCount)
+{
+	int pairCount = pairs.size();
+	int phaseCount = 0;
+
+	lastPhase.assign(agentCount, -1);
+	pairPhase.resize(pairCount);
+
+	// greedy colouring in list order
+	for (int k = 0; k < pairCount; k++)
+	{
+		int i = pairs[k].first;
+		int j = pairs[k].second;
+		int phase = std::max(lastPhase[i], lastPhase[j]) + 1;
+
+		pairPhase[k] = phase;
+		lastPhase[i] = phase;
+		lastPhase[j] = phase;
+		phaseCount = std::max(phaseCount, phase + 1);
+	}
+
+	// counting sort by phase, stable so a phase keeps the list order
+	phaseStart.assign(phaseCount + 1, 0);
+	for (int k = 0; k < pairCount; k++)
+		phaseStart[pairPhase[k] + 1]++;
+	for (int p = 0; p < phaseCount; p++)
+		phaseStart[p + 1] += phaseStart[p];
+
+	phaseFill.assign(phaseStart.begin(), phaseStart.end() - 1);
+	phasedPairs.resize(pairCount);
+	for (int k = 0; k < pairCount; k++)
+		phasedPairs[phaseFill[pairPhase[k]]++] = pairs[k];
+}
+
+int CollisionPhases::getPhaseCount() const
+{
+	return phaseStart.empty() ? 0 : phaseStart.size() - 1;
+}
+
+int CollisionPhases::getPhaseBegin(int phase) const
+{
+	return phaseStart[phase];
+}
+
+int CollisionPhases::getPhaseEnd(int phase) const
+{
+	return phaseStart[phase + 1];
+}
+
+const pair<int, int>& CollisionPhases::getPair(int k) const
+{
+	return phasedPairs[k];
+}
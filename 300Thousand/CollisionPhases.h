@@ -0,0 +1,29 @@
+#pragma once
+#include <vector>
+#include <utility>
+
+using namespace std;
+
+/*
+ splits the candidate pairs into phases where no agent shows up twice, so a phase can be resolved
+ on many threads at once. a pair goes into the phase after the last one that touched either of its
+ agents, every agent still sees its pairs in the original order, and the result is bit-identical to
+ resolving the list on one thread, whatever the thread count.
+*/
+
+class CollisionPhases
+{
+public:
+	void build(const vector<pair<int, int>>& pairs, int agentCount);
+	int getPhaseCount() const;
+	int getPhaseBegin(int phase) const;
+	int getPhaseEnd(int phase) const;
+	const pair<int, int>& getPair(int k) const;  // k in [getPhaseBegin, getPhaseEnd)
+
+private:
+	vector<int> lastPhase;      // last phase that touched each agent, -1 = none
+	vector<int> pairPhase;
+	vector<int> phaseStart;     // size = phase count + 1
+	vector<int> phaseFill;
+	vector<pair<int, int>> phasedPairs;  // pairs grouped by phase, original order inside a phase
+};
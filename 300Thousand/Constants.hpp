@@ -1,7 +1,7 @@
 #pragma once
 
 // Scene data
-const int INSTANCE_NUM = 64;
+const int INSTANCE_NUM = 300000;  // agents of the cpu simulated collision mode, the same crowd as the rendering mode
 const int width_range = 8;
 const int depth_range = 8;
 const int width_start_from = -4;
@@ -0,0 +1,155 @@
+#include "ContactCache.h"
+#include <algorithm>
+
+ContactEventQueue::ContactEventQueue(int capacity)
+	: head(0), tail(0), dropped(0)
+{
+	unsigned int size = 1;
+	while (size < (unsigned int)capacity)
+		size <<= 1;
+
+	ring.resize(size);
+	mask = size - 1;
+}
+
+bool ContactEventQueue::push(const ContactEvent& event)
+{
+	unsigned int t = tail.load(memory_order_relaxed);
+	if (t - head.load(memory_order_acquire) > mask)
+	{
+		dropped.fetch_add(1, memory_order_relaxed);
+		return false;
+	}
+
+	ring[t & mask] = event;
+	tail.store(t + 1, memory_order_release);
+	return true;
+}
+
+bool ContactEventQueue::pop(ContactEvent& event)
+{
+	unsigned int h = head.load(memory_order_relaxed);
+	if (h == tail.load(memory_order_acquire))
+		return false;
+
+	event = ring[h & mask];
+	head.store(h + 1, memory_order_release);
+	return true;
+}
+
+int ContactEventQueue::size() const
+{
+	return tail.load(memory_order_acquire) - head.load(memory_order_acquire);
+}
+
+int ContactEventQueue::getDropped() const
+{
+	return dropped.load(memory_order_relaxed);
+}
+
+ContactCache::ContactCache()
+	: emitPersist(false), beginCount(0), endCount(0)
+{
+}
+
+void ContactCache::clear()
+{
+	// ends nothing, a respawned crowd starts without contacts
+	contacts.clear();
+	newFlags.clear();
+	beginCount = 0;
+	endCount = 0;
+}
+
+unsigned long long ContactCache::pairKey(int i, int j)
+{
+	if (i > j)
+		std::swap(i, j);
+	return ((unsigned long long)(unsigned int)i << 32) | (unsigned int)j;
+}
+
+void ContactCache::emit(unsigned long long key, int type)
+{
+	ContactEvent event;
+	event.first = (int)(key >> 32);
+	event.second = (int)(key & 0xffffffffull);
+	event.type = type;
+	events.push(event);
+}
+
+void ContactCache::update(const vector<pair<int, int>>& pairs)
+{
+	int pairCount = pairs.size();
+
+	current.resize(pairCount);
+	for (int k = 0; k < pairCount; k++)
+		current[k] = make_pair(pairKey(pairs[k].first, pairs[k].second), k);
+	std::sort(current.begin(), current.end());
+
+	// merge against last tick, both lists are sorted by key
+	newFlags.assign(pairCount, 1);
+	nextContacts.clear();
+	beginCount = 0;
+	endCount = 0;
+
+	int c = 0;
+	int contactCount = contacts.size();
+	for (int k = 0; k < pairCount; k++)
+	{
+		unsigned long long key = current[k].first;
+		if (!nextContacts.empty() && nextContacts.back() == key)
+		{
+			// the same pair twice in one tick, only the first one is new
+			newFlags[current[k].second] = 0;
+			continue;
+		}
+
+		while (c < contactCount && contacts[c] < key)
+		{
+			emit(contacts[c++], CONTACT_END);
+			endCount++;
+		}
+
+		if (c < contactCount && contacts[c] == key)
+		{
+			newFlags[current[k].second] = 0;
+			if (emitPersist)
+				emit(key, CONTACT_PERSIST);
+			c++;
+		}
+		else
+		{
+			emit(key, CONTACT_BEGIN);
+			beginCount++;
+		}
+		nextContacts.push_back(key);
+	}
+
+	while (c < contactCount)
+	{
+		emit(contacts[c++], CONTACT_END);
+		endCount++;
+	}
+
+	contacts.swap(nextContacts);
+}
+
+bool ContactCache::isNew(int k) const
+{
+	return newFlags[k] != 0;
+}
+
+int ContactCache::getContactCount() const
+{
+	return contacts.size();
+}
+
+int ContactCache::getBeginCount() const
+{
+	return beginCount;
+}
+
+int ContactCache::getEndCount() const
+{
+	return endCount;
+}
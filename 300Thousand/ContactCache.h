@@ -0,0 +1,72 @@
+#pragma once
+#include <vector>
+#include <utility>
+#include <atomic>
+
+using namespace std;
+
+enum ContactEventType { CONTACT_BEGIN = 0, CONTACT_PERSIST = 1, CONTACT_END = 2 };
+
+struct ContactEvent
+{
+	int first;   // first < second
+	int second;
+	int type;    // ContactEventType
+};
+
+/*
+ bounded single producer single consumer ring of contact events.
+ the simulation pushes from the tick, a consumer (debug view, analytics, gameplay) pops on any one thread,
+ no locks on either side. when the consumer falls behind the newest events are dropped and counted.
+*/
+
+class ContactEventQueue
+{
+public:
+	ContactEventQueue(int capacity = 1 << 16);  // rounded up to a power of two
+	bool push(const ContactEvent& event);       // producer only
+	bool pop(ContactEvent& event);              // consumer only
+	int size() const;
+	int getDropped() const;
+
+private:
+	vector<ContactEvent> ring;
+	unsigned int mask;
+	atomic<unsigned int> head;     // next slot to pop, written by the consumer
+	atomic<unsigned int> tail;     // next slot to push, written by the producer
+	atomic<int> dropped;
+};
+
+/*
+ contacts that persist across ticks, keyed by the agent pair (min index << 32 | max index).
+ update() merges this tick's overlapping pairs against last tick's sorted keys, marks every pair as
+ new or persisting and queues begin / persist / end events in key order, so the events come out the
+ same for any thread count. a persisting pair was already resolved when it began, the response skips it.
+*/
+
+class ContactCache
+{
+public:
+	ContactCache();
+	void clear();
+	void update(const vector<pair<int, int>>& pairs);
+	bool isNew(int k) const;  // k indexes the pairs of the last update()
+
+	int getContactCount() const;
+	int getBeginCount() const;
+	int getEndCount() const;
+
+	ContactEventQueue events;
+	bool emitPersist;         // persist events are one per contact per tick, off unless a consumer wants them
+
+private:
+	static unsigned long long pairKey(int i, int j);
+	void emit(unsigned long long key, int type);
+
+	vector<unsigned long long> contacts;               // sorted keys of the last tick
+	vector<pair<unsigned long long, int>> current;     // key, index into pairs
+	vector<unsigned long long> nextContacts;
+	vector<char> newFlags;
+	int beginCount;
+	int endCount;
+};
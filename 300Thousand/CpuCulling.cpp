@@ -0,0 +1,174 @@
+#include "CpuCulling.h"
+#include <algorithm>
+#include <cstring>
+
+CpuCulling::CpuCulling()
+	: margin(0.0f), matrixBuffer(0), indexBuffer(0), capacity(0), visibleCount(0)
+{
+	memset(lodOffsets, 0, sizeof(lodOffsets));
+}
+
+CpuCulling::~CpuCulling()
+{
+	// buffers are released explicitly while the context is still alive, see release()
+}
+
+bool CpuCulling::init(int capacity)
+{
+	release();
+
+	this->capacity = capacity;
+
+	glGenBuffers(1, &matrixBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, matrixBuffer);
+	glBufferData(GL_ARRAY_BUFFER, std::max(1, capacity) * sizeof(mat4), nullptr, GL_STREAM_DRAW);
+
+	glGenBuffers(1, &indexBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, indexBuffer);
+	glBufferData(GL_ARRAY_BUFFER, std::max(1, capacity) * sizeof(GLuint), nullptr, GL_STREAM_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	return matrixBuffer != 0 && indexBuffer != 0;
+}
+
+int CpuCulling::cull(const Camera& camera, const InstancedSkinnedMesh& mesh, BVH& bvh, const AgentStore& agents, float alpha, ThreadPool& pool)
+{
+	visibleCount = 0;
+	memset(lodOffsets, 0, sizeof(lodOffsets));
+	if (matrixBuffer == 0 || indexBuffer == 0)
+		return 0;
+
+	// pushing every plane out by margin keeps the agents at the border from popping
+	vec4 planes[6];
+	camera.getFrustumPlanes(planes);
+	for (int p = 0; p < 6; p++)
+		planes[p].w += margin * length(vec3(planes[p]));
+
+	bvh.queryFrustum(planes, 6, visible, pool);
+	visibleCount = std::min((int)visible.size(), capacity);
+
+	// lod from the bounding sphere of the rest pose at the tick position, same rule as the gpu path
+	vec3 boundsMin, boundsMax;
+	mesh.GetBounds(boundsMin, boundsMax);
+	vec3 boundsCenter = (boundsMin + boundsMax) * 0.5f;
+	float radius = length(boundsMax - boundsMin) * 0.5f;
+	float projectionScale = camera.getProjection()[1][1];
+	vec3 eye = camera.getPosition();
+	lods.resize(visibleCount);
+	pool.parallelFor(visibleCount, [&](int begin, int end, int)
+		{
+			for (int k = begin; k < end; k++)
+			{
+				int i = visible[k];
+				vec3 center = vec3(agents.posX[i], agents.posY[i], agents.posZ[i]) + boundsCenter;
+				float distance = std::max(length(center - eye), 1e-4f);
+				lods[k] = mesh.SelectLod(radius * projectionScale / distance);
+			}
+		});
+
+	// counting sort, the order within a lod stays that of the tree walk
+	int counts[MAX_MESH_LODS] = { 0 };
+	for (int k = 0; k < visibleCount; k++)
+		counts[lods[k]]++;
+	for (int l = 0; l < MAX_MESH_LODS; l++)
+		lodOffsets[l + 1] = lodOffsets[l] + counts[l];
+	int cursors[MAX_MESH_LODS];
+	memcpy(cursors, lodOffsets, sizeof(cursors));
+	sorted.resize(visibleCount);
+	for (int k = 0; k < visibleCount; k++)
+		sorted[cursors[lods[k]]++] = visible[k];
+
+	// same interpolation as the unculled path
+	matrices.resize(visibleCount);
+	indices.resize(visibleCount);
+	pool.parallelFor(visibleCount, [this, &agents, alpha](int begin, int end, int)
+		{
+			for (int k = begin; k < end; k++)
+			{
+				int i = sorted[k];
+				vec3 prev(agents.prevX[i], agents.prevY[i], agents.prevZ[i]);
+				vec3 curr(agents.posX[i], agents.posY[i], agents.posZ[i]);
+				matrices[k] = translate(mat4(1.0f), mix(prev, curr, alpha));
+				indices[k] = i;
+			}
+		});
+
+	if (visibleCount > 0)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, matrixBuffer);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, visibleCount * sizeof(mat4), matrices.data());
+		glBindBuffer(GL_ARRAY_BUFFER, indexBuffer);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, visibleCount * sizeof(GLuint), indices.data());
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+	return visibleCount;
+}
+
+void CpuCulling::draw(InstancedSkinnedMesh& mesh)
+{
+	if (visibleCount == 0)
+		return;
+
+	// the packed matrices and agent indices in place of whatever feeds the instance attributes, put back
+	// after the draw
+	glBindVertexArray(mesh.m_VAO);
+	GLint previousMatrixBuffer = 0;
+	GLint previousBuffer = 0;
+	GLint previousEnabled = 0;
+	glGetVertexAttribiv(AttribLoc::matPosInstance, GL_VERTEX_ATTRIB_ARRAY_BUFFER_BINDING, &previousMatrixBuffer);
+	glGetVertexAttribiv(AttribLoc::instanceIndex, GL_VERTEX_ATTRIB_ARRAY_BUFFER_BINDING, &previousBuffer);
+	glGetVertexAttribiv(AttribLoc::instanceIndex, GL_VERTEX_ATTRIB_ARRAY_ENABLED, &previousEnabled);
+	glBindBuffer(GL_ARRAY_BUFFER, matrixBuffer);
+	for (int i = 0; i < 4; i++)
+		glVertexAttribPointer(AttribLoc::matPosInstance + i, 4, GL_FLOAT, GL_FALSE, sizeof(mat4), (void*)(sizeof(vec4) * i));
+	glBindBuffer(GL_ARRAY_BUFFER, indexBuffer);
+	glVertexAttribIPointer(AttribLoc::instanceIndex, 1, GL_UNSIGNED_INT, sizeof(GLuint), (void*)0);
+	glVertexAttribDivisor(AttribLoc::instanceIndex, 1);
+	glEnableVertexAttribArray(AttribLoc::instanceIndex);
+	glBindVertexArray(0);
+
+	for (int l = 0; l < MAX_MESH_LODS; l++)
+	{
+		if (lodOffsets[l + 1] > lodOffsets[l])
+			mesh.RenderInstancedLod(l, lodOffsets[l + 1] - lodOffsets[l], lodOffsets[l]);
+	}
+
+	glBindVertexArray(mesh.m_VAO);
+	if (previousMatrixBuffer != 0)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, previousMatrixBuffer);
+		for (int i = 0; i < 4; i++)
+			glVertexAttribPointer(AttribLoc::matPosInstance + i, 4, GL_FLOAT, GL_FALSE, sizeof(mat4), (void*)(sizeof(vec4) * i));
+	}
+	if (previousBuffer != 0)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, previousBuffer);
+		glVertexAttribIPointer(AttribLoc::instanceIndex, 1, GL_UNSIGNED_INT, sizeof(GLuint), (void*)0);
+	}
+	if (!previousEnabled)
+		glDisableVertexAttribArray(AttribLoc::instanceIndex);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+int CpuCulling::getVisibleCount() const
+{
+	return visibleCount;
+}
+
+int CpuCulling::getLodCount(int lod) const
+{
+	return lodOffsets[lod + 1] - lodOffsets[lod];
+}
+
+void CpuCulling::release()
+{
+	if (matrixBuffer != 0)
+		glDeleteBuffers(1, &matrixBuffer);
+	if (indexBuffer != 0)
+		glDeleteBuffers(1, &indexBuffer);
+	matrixBuffer = indexBuffer = 0;
+	capacity = 0;
+	visibleCount = 0;
+	memset(lodOffsets, 0, sizeof(lodOffsets));
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include <GL/glew.h>
+#include <vector>
+#include <glm/glm.hpp>
+#include "ShaderLocs.h"
+#include "Camera.h"
+#include "BVH.h"
+#include "AgentStore.h"
+#include "ThreadPool.h"
+#include "InstancedSkinnedMesh.h"
+
+using namespace std;
+using namespace glm;
+
+/*
+ frustum culling of the cpu simulated agents through their bvh, for renderers where compute shaders are
+ slow or missing (llvmpipe render nodes, old drivers). the pool walks the tree (BVH::queryFrustum) and
+ picks the lod of every visible agent (InstancedSkinnedMesh::SelectLod), then writes their interpolated
+ transforms packed into an instance buffer of its own, lod by lod, so every lod is one instanced draw of
+ its range. their agent indices go along for the animation phase. the buffer the mesh vao reads its
+ instances from is left alone, the gpu culling and the gpu simulation keep theirs.
+*/
+
+class CpuCulling
+{
+public:
+	CpuCulling();
+	~CpuCulling();
+	bool init(int capacity);
+	// the bvh has to be over the agents, its objects are agent indices
+	int cull(const Camera& camera, const InstancedSkinnedMesh& mesh, BVH& bvh, const AgentStore& agents, float alpha, ThreadPool& pool);
+	void draw(InstancedSkinnedMesh& mesh);  // the agents of the last cull()
+	int getVisibleCount() const;
+	int getLodCount(int lod) const;  // agents of the last cull() drawn at that lod
+	void release();
+
+	float margin;  // world units the frustum grows by, the tree boxes are at the tick position and the rest pose
+
+private:
+	vector<int> visible;
+	vector<unsigned char> lods;   // per visible agent
+	vector<int> sorted;           // visible, lod by lod
+	int lodOffsets[MAX_MESH_LODS + 1];
+	vector<mat4> matrices;   // the per frame upload, visible agents only
+	vector<GLuint> indices;
+
+	GLuint matrixBuffer;
+	GLuint indexBuffer;
+	int capacity;
+	int visibleCount;
+};
@@ -0,0 +1,690 @@
+#include "DynamicAABBTree.h"
+#include <algorithm>
+#include <cfloat>
+#include <cstdlib>
+#include <functional>
+
+static const int FREE_NODE = -2;
+
+static float surfaceArea(const AABB& aabb)
+{
+	float dx = aabb.maxX - aabb.minX;
+	float dy = aabb.maxY - aabb.minY;
+	float dz = aabb.maxZ - aabb.minZ;
+	return dx * dy + dy * dz + dz * dx;
+}
+
+static bool contains(const AABB& outer, const AABB& inner)
+{
+	return outer.minX <= inner.minX && outer.minY <= inner.minY && outer.minZ <= inner.minZ &&
+		outer.maxX >= inner.maxX && outer.maxY >= inner.maxY && outer.maxZ >= inner.maxZ;
+}
+
+DynamicAABBTree::DynamicAABBTree()
+	: margin(0.5f), predictTime(0.1f), root(-1), freeList(-1), proxyCount(0), reinsertCount(0)
+{
+}
+
+void DynamicAABBTree::clear()
+{
+	nodes.clear();
+	heights.clear();
+	tightBounds.clear();
+	proxyOfObject.clear();
+	root = -1;
+	freeList = -1;
+	proxyCount = 0;
+	reinsertCount = 0;
+}
+
+int DynamicAABBTree::allocateNode()
+{
+	if (freeList != -1)
+	{
+		int index = freeList;
+		freeList = nodes[index].parentNode;
+		return index;
+	}
+
+	nodes.push_back(BVHNode(AABB(0, 0, 0, 0, 0, 0), -1, -1, -1, nodes.size(), FREE_NODE));
+	heights.push_back(-1);
+	return nodes.size() - 1;
+}
+
+void DynamicAABBTree::freeNode(int index)
+{
+	nodes[index].indexMapToScene = FREE_NODE;
+	nodes[index].leftChildNode = -1;
+	nodes[index].rightChildNode = -1;
+	nodes[index].parentNode = freeList;
+	heights[index] = -1;
+	freeList = index;
+}
+
+AABB DynamicAABBTree::fatAABB(const AABB& aabb, const vec3& displacement, float grow) const
+{
+	AABB fat(aabb.minX - grow, aabb.minY - grow, aabb.minZ - grow, aabb.maxX + grow, aabb.maxY + grow, aabb.maxZ + grow);
+
+	// stretched towards where the agent is going
+	if (displacement.x < 0.0f) fat.minX += displacement.x; else fat.maxX += displacement.x;
+	if (displacement.y < 0.0f) fat.minY += displacement.y; else fat.maxY += displacement.y;
+	if (displacement.z < 0.0f) fat.minZ += displacement.z; else fat.maxZ += displacement.z;
+	return fat;
+}
+
+int DynamicAABBTree::createProxy(int object, const AABB& aabb, const vec3& displacement)
+{
+	int leaf = allocateNode();
+	nodes[leaf] = BVHNode(fatAABB(aabb, displacement, margin), -1, -1, -1, leaf, object);
+	heights[leaf] = 0;
+	insertLeaf(leaf);
+
+	if (object >= (int)proxyOfObject.size())
+	{
+		proxyOfObject.resize(object + 1, -1);
+		tightBounds.resize((object + 1) * 6);
+	}
+	proxyOfObject[object] = leaf;
+	float* b = &tightBounds[object * 6];
+	b[0] = aabb.minX; b[1] = aabb.minY; b[2] = aabb.minZ;
+	b[3] = aabb.maxX; b[4] = aabb.maxY; b[5] = aabb.maxZ;
+	proxyCount++;
+	return leaf;
+}
+
+void DynamicAABBTree::destroyProxy(int proxy)
+{
+	proxyOfObject[nodes[proxy].indexMapToScene] = -1;
+	removeLeaf(proxy);
+	freeNode(proxy);
+	proxyCount--;
+}
+
+bool DynamicAABBTree::moveProxy(int proxy, const AABB& aabb, const vec3& displacement)
+{
+	float* b = &tightBounds[nodes[proxy].indexMapToScene * 6];
+	b[0] = aabb.minX; b[1] = aabb.minY; b[2] = aabb.minZ;
+	b[3] = aabb.maxX; b[4] = aabb.maxY; b[5] = aabb.maxZ;
+
+	AABB fat = fatAABB(aabb, displacement, margin);
+	const AABB& current = nodes[proxy].aabb;
+	if (contains(current, aabb))
+	{
+		// still inside, unless the agent slowed down and the old fat box is far too big now
+		if (contains(fatAABB(aabb, displacement, margin * 4.0f), current))
+			return false;
+	}
+
+	removeLeaf(proxy);
+	nodes[proxy].aabb = fat;
+	insertLeaf(proxy);
+	return true;
+}
+
+int DynamicAABBTree::getProxy(int object) const
+{
+	return object < (int)proxyOfObject.size() ? proxyOfObject[object] : -1;
+}
+
+const float* DynamicAABBTree::getTightBounds(int object) const
+{
+	return &tightBounds[object * 6];
+}
+
+void DynamicAABBTree::update(const AgentStore& agents)
+{
+	int count = agents.size();
+	reinsertCount = 0;
+
+	// agents past the end are gone
+	for (int object = (int)proxyOfObject.size() - 1; object >= count; object--)
+	{
+		if (proxyOfObject[object] != -1)
+			destroyProxy(proxyOfObject[object]);
+	}
+	proxyOfObject.resize(count, -1);
+	tightBounds.resize(count * 6);
+
+	// the first population goes in as one top-down build, inserting a whole crowd one by one costs
+	// a search per agent and leaves a tree that depends on the order the agents come in
+	if (root == -1 && count > 1)
+	{
+		bulkLeaves.clear();
+		for (int i = 0; i < count; i++)
+		{
+			vec3 displacement = vec3(agents.velX[i], agents.velY[i], agents.velZ[i]) * predictTime;
+			AABB aabb = agents.aabb(i);
+			int leaf = allocateNode();
+			nodes[leaf] = BVHNode(fatAABB(aabb, displacement, margin), -1, -1, -1, leaf, i);
+			heights[leaf] = 0;
+			proxyOfObject[i] = leaf;
+			float* b = &tightBounds[i * 6];
+			b[0] = aabb.minX; b[1] = aabb.minY; b[2] = aabb.minZ;
+			b[3] = aabb.maxX; b[4] = aabb.maxY; b[5] = aabb.maxZ;
+			bulkLeaves.push_back(leaf);
+		}
+		proxyCount = count;
+		root = buildSubtree(0, count, -1);
+		return;
+	}
+
+	for (int i = 0; i < count; i++)
+	{
+		vec3 displacement = vec3(agents.velX[i], agents.velY[i], agents.velZ[i]) * predictTime;
+		if (proxyOfObject[i] == -1)
+			createProxy(i, agents.aabb(i), displacement);
+		else if (moveProxy(proxyOfObject[i], agents.aabb(i), displacement))
+			reinsertCount++;
+	}
+}
+
+void DynamicAABBTree::refit(const AABBLanes& boxes)
+{
+	int count = std::min(boxes.count, (int)proxyOfObject.size());
+	for (int object = 0; object < count; object++)
+	{
+		int proxy = proxyOfObject[object];
+		if (proxy == -1)
+			continue;
+
+		float* b = &tightBounds[object * 6];
+		b[0] = boxes.minX[object]; b[1] = boxes.minY[object]; b[2] = boxes.minZ[object];
+		b[3] = boxes.maxX[object]; b[4] = boxes.maxY[object]; b[5] = boxes.maxZ[object];
+		AABB aabb(b[0], b[1], b[2], b[3], b[4], b[5]);
+		if (contains(nodes[proxy].aabb, aabb))
+			continue;
+
+		// no velocity here, the next update stretches the fat box again
+		removeLeaf(proxy);
+		nodes[proxy].aabb = fatAABB(aabb, vec3(0.0f), margin);
+		insertLeaf(proxy);
+	}
+}
+
+int DynamicAABBTree::buildSubtree(int begin, int end, int parent)
+{
+	if (end - begin == 1)
+	{
+		nodes[bulkLeaves[begin]].parentNode = parent;
+		return bulkLeaves[begin];
+	}
+
+	// split at the object median along the longest axis of the centers, both halves differ by at most
+	// one leaf so the heights differ by at most one like after avl balancing
+	float lo[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+	float hi[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	for (int k = begin; k < end; k++)
+	{
+		const AABB& aabb = nodes[bulkLeaves[k]].aabb;
+		float center[3] = { aabb.minX + aabb.maxX, aabb.minY + aabb.maxY, aabb.minZ + aabb.maxZ };
+		for (int a = 0; a < 3; a++)
+		{
+			lo[a] = std::min(lo[a], center[a]);
+			hi[a] = std::max(hi[a], center[a]);
+		}
+	}
+	int axis = 0;
+	for (int a = 1; a < 3; a++)
+	{
+		if (hi[a] - lo[a] > hi[axis] - lo[axis])
+			axis = a;
+	}
+
+	int middle = begin + (end - begin) / 2;
+	std::nth_element(bulkLeaves.begin() + begin, bulkLeaves.begin() + middle, bulkLeaves.begin() + end, [this, axis](int a, int b)
+		{
+			const AABB& boxA = nodes[a].aabb;
+			const AABB& boxB = nodes[b].aabb;
+			float centerA = axis == 0 ? boxA.minX + boxA.maxX : axis == 1 ? boxA.minY + boxA.maxY : boxA.minZ + boxA.maxZ;
+			float centerB = axis == 0 ? boxB.minX + boxB.maxX : axis == 1 ? boxB.minY + boxB.maxY : boxB.minZ + boxB.maxZ;
+			return centerA < centerB;
+		});
+
+	int index = allocateNode();
+	int left = buildSubtree(begin, middle, index);
+	int right = buildSubtree(middle, end, index);
+	nodes[index] = BVHNode(nodes[left].aabb.unions(nodes[right].aabb), parent, left, right, index, -1);
+	heights[index] = 1 + std::max(heights[left], heights[right]);
+	return index;
+}
+
+void DynamicAABBTree::insertLeaf(int leaf)
+{
+	if (root == -1)
+	{
+		root = leaf;
+		nodes[leaf].parentNode = -1;
+		return;
+	}
+
+	// branch and bound: the cost of a sibling is the area of the new parent plus the growth of every
+	// ancestor. a subtree can not do better than the leaf area plus what its root already inherits
+	const AABB leafAABB = nodes[leaf].aabb;
+	float leafArea = surfaceArea(leafAABB);
+	int best = root;
+	float bestCost = surfaceArea(nodes[root].aabb.unions(leafAABB));
+
+	searchHeap.clear();
+	searchHeap.push_back(make_pair(0.0f, root));
+	while (!searchHeap.empty())
+	{
+		std::pop_heap(searchHeap.begin(), searchHeap.end(), std::greater<pair<float, int>>());
+		float inherited = searchHeap.back().first;
+		int index = searchHeap.back().second;
+		searchHeap.pop_back();
+		if (leafArea + inherited >= bestCost)
+			continue;
+
+		const BVHNode& node = nodes[index];
+		float unionArea = surfaceArea(node.aabb.unions(leafAABB));
+		float cost = unionArea + inherited;
+		if (cost < bestCost)
+		{
+			best = index;
+			bestCost = cost;
+		}
+
+		if (node.indexMapToScene == -1)
+		{
+			float childInherited = inherited + unionArea - surfaceArea(node.aabb);
+			if (leafArea + childInherited < bestCost)
+			{
+				searchHeap.push_back(make_pair(childInherited, node.leftChildNode));
+				std::push_heap(searchHeap.begin(), searchHeap.end(), std::greater<pair<float, int>>());
+				searchHeap.push_back(make_pair(childInherited, node.rightChildNode));
+				std::push_heap(searchHeap.begin(), searchHeap.end(), std::greater<pair<float, int>>());
+			}
+		}
+	}
+
+	// new parent of best and the leaf, in the place of best
+	int oldParent = nodes[best].parentNode;
+	int newParent = allocateNode();
+	nodes[newParent] = BVHNode(nodes[best].aabb.unions(leafAABB), oldParent, best, leaf, newParent, -1);
+	heights[newParent] = heights[best] + 1;
+
+	if (oldParent == -1)
+		root = newParent;
+	else if (nodes[oldParent].leftChildNode == best)
+		nodes[oldParent].leftChildNode = newParent;
+	else
+		nodes[oldParent].rightChildNode = newParent;
+	nodes[best].parentNode = newParent;
+	nodes[leaf].parentNode = newParent;
+
+	fixUpwards(newParent);
+}
+
+void DynamicAABBTree::removeLeaf(int leaf)
+{
+	if (leaf == root)
+	{
+		root = -1;
+		return;
+	}
+
+	// the sibling takes the place of the parent
+	int parent = nodes[leaf].parentNode;
+	int grandParent = nodes[parent].parentNode;
+	int sibling = nodes[parent].leftChildNode == leaf ? nodes[parent].rightChildNode : nodes[parent].leftChildNode;
+
+	nodes[sibling].parentNode = grandParent;
+	if (grandParent == -1)
+		root = sibling;
+	else if (nodes[grandParent].leftChildNode == parent)
+		nodes[grandParent].leftChildNode = sibling;
+	else
+		nodes[grandParent].rightChildNode = sibling;
+
+	freeNode(parent);
+	nodes[leaf].parentNode = -1;
+	fixUpwards(grandParent);
+}
+
+void DynamicAABBTree::fixUpwards(int index)
+{
+	// once a node keeps its children, box and height nothing above it changes either, the first node
+	// is the one whose child just changed
+	bool first = true;
+	while (index != -1)
+	{
+		int left = nodes[index].leftChildNode;
+		int right = nodes[index].rightChildNode;
+		int balanced = balance(index);
+
+		BVHNode& node = nodes[balanced];
+		AABB aabb = nodes[node.leftChildNode].aabb.unions(nodes[node.rightChildNode].aabb);
+		int height = 1 + std::max(heights[node.leftChildNode], heights[node.rightChildNode]);
+		bool changed = first || balanced != index || node.leftChildNode != left || node.rightChildNode != right || height != heights[balanced]
+			|| aabb.minX != node.aabb.minX || aabb.minY != node.aabb.minY || aabb.minZ != node.aabb.minZ
+			|| aabb.maxX != node.aabb.maxX || aabb.maxY != node.aabb.maxY || aabb.maxZ != node.aabb.maxZ;
+		if (!changed)
+			break;
+
+		node.aabb = aabb;
+		heights[balanced] = height;
+		index = node.parentNode;
+		first = false;
+	}
+}
+
+int DynamicAABBTree::balance(int a)
+{
+	// avl rotation when one side is two levels taller, returns the node now in the place of a
+	if (nodes[a].indexMapToScene != -1 || heights[a] < 2)
+		return a;
+
+	int b = nodes[a].leftChildNode;
+	int c = nodes[a].rightChildNode;
+	int difference = heights[c] - heights[b];
+	if (difference >= -1 && difference <= 1)
+	{
+		rotateForArea(a);
+		return a;
+	}
+
+	// the taller child moves up, the shorter of its children moves down under a
+	bool rightTaller = difference > 1;
+	int up = rightTaller ? c : b;
+	int stay = rightTaller ? b : c;
+	int f = nodes[up].leftChildNode;
+	int g = nodes[up].rightChildNode;
+	int keep = heights[f] > heights[g] ? f : g;
+	if (heights[f] == heights[g])
+	{
+		// either can go down, the one that makes the smaller box with stay
+		keep = surfaceArea(nodes[stay].aabb.unions(nodes[f].aabb)) < surfaceArea(nodes[stay].aabb.unions(nodes[g].aabb)) ? g : f;
+	}
+	int move = keep == f ? g : f;
+
+	int parent = nodes[a].parentNode;
+	nodes[up].parentNode = parent;
+	if (parent == -1)
+		root = up;
+	else if (nodes[parent].leftChildNode == a)
+		nodes[parent].leftChildNode = up;
+	else
+		nodes[parent].rightChildNode = up;
+
+	// a takes the place of the moving grandchild side, the taller grandchild stays with up
+	nodes[up].leftChildNode = a;
+	nodes[up].rightChildNode = keep;
+	nodes[a].parentNode = up;
+	if (rightTaller)
+		nodes[a].rightChildNode = move;
+	else
+		nodes[a].leftChildNode = move;
+	nodes[move].parentNode = a;
+
+	nodes[a].aabb = nodes[stay].aabb.unions(nodes[move].aabb);
+	heights[a] = 1 + std::max(heights[stay], heights[move]);
+	nodes[up].aabb = nodes[a].aabb.unions(nodes[keep].aabb);
+	heights[up] = 1 + std::max(heights[a], heights[keep]);
+	return up;
+}
+
+void DynamicAABBTree::rotateForArea(int a)
+{
+	// a child swaps places with a grandchild under its sibling, the sibling's box is the one that changes.
+	// only swaps that keep both changed nodes within one level of balance, so the avl bound holds
+	int children[2] = { nodes[a].leftChildNode, nodes[a].rightChildNode };
+	float bestGain = 0.0f;
+	int bestSide = -1;
+	int bestGrandchild = -1;
+	for (int side = 0; side < 2; side++)
+	{
+		int moving = children[side];
+		int sibling = children[1 - side];
+		if (nodes[sibling].indexMapToScene != -1)
+			continue;
+
+		int grandchildren[2] = { nodes[sibling].leftChildNode, nodes[sibling].rightChildNode };
+		float before = surfaceArea(nodes[sibling].aabb);
+		for (int g = 0; g < 2; g++)
+		{
+			// grandchild g goes up, the sibling becomes moving + the other grandchild
+			int up = grandchildren[g];
+			int other = grandchildren[1 - g];
+			int siblingHeight = 1 + std::max(heights[moving], heights[other]);
+			if (std::abs(heights[moving] - heights[other]) > 1 || std::abs(siblingHeight - heights[up]) > 1)
+				continue;
+
+			float gain = before - surfaceArea(nodes[moving].aabb.unions(nodes[other].aabb));
+			if (gain > bestGain)
+			{
+				bestGain = gain;
+				bestSide = side;
+				bestGrandchild = g;
+			}
+		}
+	}
+	if (bestSide == -1)
+		return;
+
+	int moving = children[bestSide];
+	int sibling = children[1 - bestSide];
+	BVHNode& siblingNode = nodes[sibling];
+	int up = bestGrandchild == 0 ? siblingNode.leftChildNode : siblingNode.rightChildNode;
+	if (bestGrandchild == 0)
+		siblingNode.leftChildNode = moving;
+	else
+		siblingNode.rightChildNode = moving;
+	nodes[moving].parentNode = sibling;
+
+	if (bestSide == 0)
+		nodes[a].leftChildNode = up;
+	else
+		nodes[a].rightChildNode = up;
+	nodes[up].parentNode = a;
+
+	siblingNode.aabb = nodes[siblingNode.leftChildNode].aabb.unions(nodes[siblingNode.rightChildNode].aabb);
+	heights[sibling] = 1 + std::max(heights[siblingNode.leftChildNode], heights[siblingNode.rightChildNode]);
+}
+
+int DynamicAABBTree::query(const AABB& aabb, int sceneIndex, int* results, int capacity, BVHQueryStats* stats) const
+{
+	if (root == -1)
+		return 0;
+
+	// avl balance keeps the height under 1.44 log2 of the leaves, far from the stack size
+	int stack[BVH_STACK_SIZE];
+	int top = 0;
+	int found = 0;
+	int visited = 0;
+	int tests = 0;
+	stack[top++] = root;
+	while (top > 0)
+	{
+		const BVHNode& node = nodes[stack[--top]];
+		visited++;
+		tests++;
+		if (!aabb.overlap(node.aabb))
+			continue;
+
+		if (node.indexMapToScene == -1)
+		{
+			stack[top++] = node.leftChildNode;
+			stack[top++] = node.rightChildNode;
+			continue;
+		}
+
+		// the fat box only says maybe
+		int object = node.indexMapToScene;
+		const float* b = &tightBounds[object * 6];
+		if (object <= sceneIndex)
+			continue;
+		tests++;
+		if (!(aabb.minX < b[3] && aabb.maxX > b[0] && aabb.minY < b[4] && aabb.maxY > b[1]))
+			continue;
+		if (found < capacity)
+			results[found] = object;
+		found++;
+	}
+
+	if (stats)
+		stats->add(visited, tests, found);
+	return found;
+}
+
+void DynamicAABBTree::findPairs(vector<pair<int, int>>& pairs, ThreadPool& pool)
+{
+	if (root == -1)
+		return;
+
+	// the tree against itself in one simultaneous descent, every overlapping node pair is opened once
+	// instead of a query per proxy from the root. the top is split into a fixed count of subtree pairs
+	// like BVH::findPairs, so the tasks (and the pair order) do not depend on the thread count
+	vector<pair<int, int>>& tasks = selfTasks;
+	vector<pair<int, int>>& next = selfTaskScratch;
+	tasks.assign(1, make_pair(root, root));
+	for (int level = 0; level < 16 && tasks.size() < BVH_SELF_TASKS; level++)
+	{
+		next.clear();
+		bool split = false;
+		for (const pair<int, int>& task : tasks)
+		{
+			if (expandSelfTask(task.first, task.second, next))
+				split = true;
+			else
+				next.push_back(task);
+		}
+		tasks.swap(next);
+		if (!split)
+			break;
+	}
+
+	chunkPairs.resize(pool.getThreadCount());
+	for (size_t c = 0; c < chunkPairs.size(); c++)
+		chunkPairs[c].clear();
+	taskStacks.resize(pool.getThreadCount());
+
+	pool.parallelFor(tasks.size(), [this, &tasks](int begin, int end, int chunk)
+		{
+			vector<pair<int, int>>& stack = taskStacks[chunk];
+			for (int t = begin; t < end; t++)
+			{
+				stack.assign(1, tasks[t]);
+				while (!stack.empty())
+				{
+					pair<int, int> task = stack.back();
+					stack.pop_back();
+					if (!expandSelfTask(task.first, task.second, stack))
+						leafPair(task.first, task.second, chunkPairs[chunk]);
+				}
+			}
+		}, 1);
+
+	// chunks are contiguous task ranges, joined in order
+	for (size_t c = 0; c < chunkPairs.size(); c++)
+		pairs.insert(pairs.end(), chunkPairs[c].begin(), chunkPairs[c].end());
+}
+
+bool DynamicAABBTree::expandSelfTask(int a, int b, vector<pair<int, int>>& out) const
+{
+	// false when both sides are leaves (or a is one leaf against itself), those go to leafPair
+	const BVHNode& nodeA = nodes[a];
+	const BVHNode& nodeB = nodes[b];
+	bool leafA = nodeA.indexMapToScene != -1;
+	bool leafB = nodeB.indexMapToScene != -1;
+	if (a == b)
+	{
+		if (leafA)
+			return false;
+
+		// both halves against themselves and against each other
+		int left = nodeA.leftChildNode;
+		int right = nodeA.rightChildNode;
+		out.push_back(make_pair(left, left));
+		out.push_back(make_pair(right, right));
+		if (nodes[left].aabb.overlap(nodes[right].aabb))
+			out.push_back(make_pair(left, right));
+		return true;
+	}
+
+	if (leafA && leafB)
+		return false;
+
+	// open the bigger branch
+	float areaA = (nodeA.aabb.maxX - nodeA.aabb.minX) * (nodeA.aabb.maxY - nodeA.aabb.minY);
+	float areaB = (nodeB.aabb.maxX - nodeB.aabb.minX) * (nodeB.aabb.maxY - nodeB.aabb.minY);
+	if (leafB || (!leafA && areaA >= areaB))
+	{
+		if (nodes[nodeA.leftChildNode].aabb.overlap(nodeB.aabb))
+			out.push_back(make_pair(nodeA.leftChildNode, b));
+		if (nodes[nodeA.rightChildNode].aabb.overlap(nodeB.aabb))
+			out.push_back(make_pair(nodeA.rightChildNode, b));
+	}
+	else
+	{
+		if (nodeA.aabb.overlap(nodes[nodeB.leftChildNode].aabb))
+			out.push_back(make_pair(a, nodeB.leftChildNode));
+		if (nodeA.aabb.overlap(nodes[nodeB.rightChildNode].aabb))
+			out.push_back(make_pair(a, nodeB.rightChildNode));
+	}
+	return true;
+}
+
+void DynamicAABBTree::leafPair(int a, int b, vector<pair<int, int>>& pairs) const
+{
+	if (a == b)
+		return;
+
+	// the fat boxes only say maybe, the exact agent boxes decide
+	int i = nodes[a].indexMapToScene;
+	int j = nodes[b].indexMapToScene;
+	const float* boundsI = &tightBounds[i * 6];
+	const float* boundsJ = &tightBounds[j * 6];
+	if (!(boundsI[0] < boundsJ[3] && boundsI[3] > boundsJ[0] && boundsI[1] < boundsJ[4] && boundsI[4] > boundsJ[1]))
+		return;
+
+	// keep the (lower, higher) object order the response code expects
+	pairs.push_back(i < j ? make_pair(i, j) : make_pair(j, i));
+}
+
+float DynamicAABBTree::getSAHCost() const
+{
+	if (root == -1)
+		return 0.0f;
+
+	// same measure as BVH::getSAHCost, free nodes skipped
+	float rootArea = std::max(surfaceArea(nodes[root].aabb), 1e-12f);
+	float cost = 0.0f;
+	for (const BVHNode& node : nodes)
+	{
+		if (node.indexMapToScene == FREE_NODE)
+			continue;
+		float p = surfaceArea(node.aabb) / rootArea;
+		cost += node.indexMapToScene == -1 ? p : p * 2.0f;
+	}
+	return cost;
+}
+
+int DynamicAABBTree::getHeight() const
+{
+	return root == -1 ? 0 : heights[root];
+}
+
+int DynamicAABBTree::getReinsertCount() const
+{
+	return reinsertCount;
+}
+
+int DynamicAABBTree::getProxyCount() const
+{
+	return proxyCount;
+}
+
+int DynamicAABBTree::getRootIndex() const
+{
+	return root;
+}
+
+int DynamicAABBTree::getNodeCount() const
+{
+	return nodes.size();
+}
+
+const BVHNode& DynamicAABBTree::getNode(int index) const
+{
+	return nodes[index];
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include <vector>
+#include <utility>
+#include <glm/glm.hpp>
+#include "AABB.h"
+#include "AgentStore.h"
+#include "ThreadPool.h"
+#include "BVH.h"
+
+using namespace std;
+using namespace glm;
+
+/*
+ incremental aabb tree for the moving crowd, one leaf (proxy) per agent that keeps its node for its
+ whole life. a leaf holds a fat box, the agent box grown by margin and stretched along the velocity,
+ and is only taken out and inserted again once the agent box leaves it. insertion picks the sibling
+ with a branch and bound search over the surface area cost. on the way up a node two levels out of
+ balance gets an avl rotation, any other one the child / grandchild swap that shrinks it most without
+ breaking the balance, so the height stays near log2 and the areas do not only grow. the first
+ population is built top-down in one go, an object median split keeps that tree balanced from the start.
+ the nodes are BVHNode so BVH and the renderer walk it like the other trees, a free node has
+ indexMapToScene = -2 and is chained through parentNode.
+*/
+
+class DynamicAABBTree
+{
+public:
+	DynamicAABBTree();
+	void clear();
+
+	int createProxy(int object, const AABB& aabb, const vec3& displacement);
+	void destroyProxy(int proxy);
+	bool moveProxy(int proxy, const AABB& aabb, const vec3& displacement);  // true when it was reinserted
+	int getProxy(int object) const;  // -1 without one
+	const float* getTightBounds(int object) const;  // min xyz, max xyz of the agent box
+
+	// one proxy per agent, the object of agent i is i like SceneObject::index. into an empty tree the
+	// proxies are bulk built instead of inserted one by one
+	void update(const AgentStore& agents);
+
+	// bounds only between two updates, the exact boxes follow boxes and a proxy is only reinserted when
+	// its box left the fat one. the fat boxes never shrink here, so the next update does not undo it
+	void refit(const AABBLanes& boxes);
+
+	// same contract as BVH::query, the exact agent boxes decide, not the fat ones
+	int query(const AABB& aabb, int sceneIndex, int* results, int capacity, BVHQueryStats* stats = nullptr) const;
+	void findPairs(vector<pair<int, int>>& pairs, ThreadPool& pool);  // same contract as BVH::findPairs
+
+	float getSAHCost() const;
+	int getHeight() const;
+	int getReinsertCount() const;  // proxies that went back into the tree in the last update()
+	int getProxyCount() const;
+	int getRootIndex() const;
+	int getNodeCount() const;
+	const BVHNode& getNode(int index) const;
+
+	float margin;       // fat box growth on every side
+	float predictTime;  // seconds of velocity the fat box is stretched by
+
+private:
+	int allocateNode();
+	void freeNode(int index);
+	void insertLeaf(int leaf);
+	void removeLeaf(int leaf);
+	int balance(int index);
+	void rotateForArea(int index);  // the best balanced child / grandchild swap, if it shrinks a child
+	int buildSubtree(int begin, int end, int parent);  // over bulkLeaves[begin, end), returns its root
+	void fixUpwards(int index);  // heights and boxes up to the root, balancing on the way
+	bool expandSelfTask(int a, int b, vector<pair<int, int>>& out) const;  // node pair one level down
+	void leafPair(int a, int b, vector<pair<int, int>>& pairs) const;
+	AABB fatAABB(const AABB& aabb, const vec3& displacement, float grow) const;
+
+	vector<BVHNode> nodes;
+	vector<int> heights;         // 0 for a leaf, -1 when free
+	vector<float> tightBounds;   // 6 floats per object
+	vector<int> proxyOfObject;
+	int root;
+	int freeList;
+	int proxyCount;
+	int reinsertCount;
+
+	vector<pair<float, int>> searchHeap;        // inherited cost, node
+	vector<int> bulkLeaves;                     // bulk build scratch, partitioned in place
+	vector<pair<int, int>> selfTasks;           // findPairs scratch, subtree pairs
+	vector<pair<int, int>> selfTaskScratch;
+	vector<vector<pair<int, int>>> chunkPairs;  // per pool chunk
+	vector<vector<pair<int, int>>> taskStacks;
+};
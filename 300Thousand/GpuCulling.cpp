@@ -0,0 +1,287 @@
+#include "GpuCulling.h"
+#include "InitShader.h"
+#include <algorithm>
+#include <cfloat>
+#include <iostream>
+
+static const std::string cull_compute_shader("gpu_cull_cs.glsl");
+static const std::string commands_compute_shader("gpu_cull_commands_cs.glsl");
+static const std::string scatter_compute_shader("gpu_cull_scatter_cs.glsl");
+
+static const int workGroupSize = 256;
+static const int commandGroupSize = 64;
+
+GpuCulling::GpuCulling()
+	: boundsMargin(0.25f), impostorDistance(FLT_MAX), impostorFadeWidth(10.0f), cullProgram(-1), commandsProgram(-1), scatterProgram(-1),
+	visibleMatrixBuffer(0), visibleIndexBuffer(0), identityIndexBuffer(0), instanceLodBuffer(0), lodCountBuffer(0), commandBuffer(0),
+	impostorInstanceBuffer(0), impostorCommandBuffer(0), impostorVao(0),
+	instanceBuffer(0), capacity(0), commandCount(0), entryCount(0), boundsMin(0.0f), boundsMax(0.0f)
+{
+}
+
+GpuCulling::~GpuCulling()
+{
+	// buffers are released explicitly while the context is still alive, see release()
+}
+
+bool GpuCulling::init(InstancedSkinnedMesh& mesh, GLuint instanceBuffer, int capacity)
+{
+	release();
+
+	this->instanceBuffer = instanceBuffer;
+	this->capacity = capacity;
+
+	// one command per lod and entry, the box covers all of them
+	entryCount = mesh.m_Entries.size();
+	vector<DrawElementsIndirectCommand> commands(MAX_MESH_LODS * entryCount);
+	for (int lod = 0; lod < MAX_MESH_LODS; lod++)
+	{
+		for (int i = 0; i < entryCount; i++)
+		{
+			const MeshEntry& entry = mesh.m_Entries[i];
+			DrawElementsIndirectCommand& command = commands[lod * entryCount + i];
+			command.count = entry.LodNumIndices[lod];
+			command.instanceCount = 0;
+			command.firstIndex = entry.LodBaseIndex[lod];
+			command.baseVertex = entry.BaseVertex;
+			command.baseInstance = 0;
+		}
+	}
+	commandCount = commands.size();
+	mesh.GetBounds(boundsMin, boundsMax);
+
+	vector<GLuint> identity(capacity);
+	for (int i = 0; i < capacity; i++)
+		identity[i] = i;
+
+	glGenBuffers(1, &visibleMatrixBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, visibleMatrixBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, std::max(1, capacity) * sizeof(mat4), nullptr, GL_DYNAMIC_COPY);
+
+	glGenBuffers(1, &visibleIndexBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, visibleIndexBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, std::max(1, capacity) * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+
+	glGenBuffers(1, &identityIndexBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, identityIndexBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, std::max(1, capacity) * sizeof(GLuint), identity.data(), GL_STATIC_DRAW);
+
+	glGenBuffers(1, &instanceLodBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, instanceLodBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, std::max(1, capacity) * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+
+	glGenBuffers(1, &lodCountBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, lodCountBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, 2 * (MAX_MESH_LODS + 1) * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+
+	glGenBuffers(1, &commandBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, commandBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, std::max(1, commandCount) * sizeof(DrawElementsIndirectCommand), commands.data(), GL_DYNAMIC_COPY);
+
+	// position and index per impostor, std430 packs them in 16 bytes
+	glGenBuffers(1, &impostorInstanceBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, impostorInstanceBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, std::max(1, capacity) * 4 * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+
+	DrawArraysIndirectCommand impostorCommand = { 4, 0, 0, 0 };
+	glGenBuffers(1, &impostorCommandBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, impostorCommandBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(DrawArraysIndirectCommand), &impostorCommand, GL_DYNAMIC_COPY);
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	glGenVertexArrays(1, &impostorVao);
+	glBindVertexArray(impostorVao);
+	glBindBuffer(GL_ARRAY_BUFFER, impostorInstanceBuffer);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 4 * sizeof(GLuint), (void*)0);
+	glVertexAttribIPointer(1, 1, GL_UNSIGNED_INT, 4 * sizeof(GLuint), (void*)(3 * sizeof(GLuint)));
+	for (int a = 0; a < 2; a++)
+	{
+		glEnableVertexAttribArray(a);
+		glVertexAttribDivisor(a, 1);
+	}
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	// the index attribute is always fed, from the identity buffer while the full buffer is drawn
+	glBindVertexArray(mesh.m_VAO);
+	glEnableVertexAttribArray(AttribLoc::instanceIndex);
+	glVertexAttribDivisor(AttribLoc::instanceIndex, 1);
+	glBindVertexArray(0);
+	bindInstanceAttributes(mesh.m_VAO, instanceBuffer, identityIndexBuffer);
+
+	return reloadShaders();
+}
+
+bool GpuCulling::reloadShaders()
+{
+	// InitShader leaves the new program bound
+	GLint previousProgram = 0;
+	glGetIntegerv(GL_CURRENT_PROGRAM, &previousProgram);
+
+	GLuint programs[3] = {
+		InitShader(cull_compute_shader.c_str()),
+		InitShader(commands_compute_shader.c_str()),
+		InitShader(scatter_compute_shader.c_str())
+	};
+
+	glUseProgram(previousProgram);
+
+	if (programs[0] == -1 || programs[1] == -1 || programs[2] == -1)
+	{
+		// keep the old programs if any of the new ones failed
+		for (int p = 0; p < 3; p++)
+		{
+			if (programs[p] != -1)
+				glDeleteProgram(programs[p]);
+		}
+		std::cerr << "gpu culling shaders failed, keeping the previous programs" << std::endl;
+		return isReady();
+	}
+
+	GLuint* slots[3] = { &cullProgram, &commandsProgram, &scatterProgram };
+	for (int p = 0; p < 3; p++)
+	{
+		if (*slots[p] != -1)
+			glDeleteProgram(*slots[p]);
+		*slots[p] = programs[p];
+	}
+
+	return true;
+}
+
+void GpuCulling::cull(const Camera& camera, const InstancedSkinnedMesh& mesh, int instanceCount)
+{
+	if (!isReady() || capacity == 0 || commandCount == 0)
+		return;
+
+	instanceCount = std::min(instanceCount, capacity);
+
+	GLint previousProgram = 0;
+	glGetIntegerv(GL_CURRENT_PROGRAM, &previousProgram);
+
+	vec4 planes[6];
+	camera.getFrustumPlanes(planes);
+	vec3 margin = (boundsMax - boundsMin) * boundsMargin;
+	vec3 center = (boundsMin + boundsMax) * 0.5f;
+	vec3 extent = (boundsMax - boundsMin) * 0.5f + margin;
+	vec3 eye = camera.getPosition();
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SsboBinding::CullInstances, instanceBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SsboBinding::VisibleMatrices, visibleMatrixBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SsboBinding::VisibleIndices, visibleIndexBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SsboBinding::LodCounts, lodCountBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SsboBinding::DrawCommands, commandBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SsboBinding::InstanceLods, instanceLodBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SsboBinding::ImpostorInstances, impostorInstanceBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SsboBinding::ImpostorCommand, impostorCommandBuffer);
+
+	// the counts start from zero
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, lodCountBuffer);
+	glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	// the matrices may have just been written by glBufferSubData or by the gpu simulation
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+	// test, pick the lod and count
+	glUseProgram(cullProgram);
+	glUniform1i(ComputeUniformLoc::InstanceCount, instanceCount);
+	glUniform4fv(ComputeUniformLoc::FrustumPlanes, 6, &planes[0][0]);
+	glUniform3f(ComputeUniformLoc::BoundsCenter, center.x, center.y, center.z);
+	glUniform3f(ComputeUniformLoc::BoundsExtent, extent.x, extent.y, extent.z);
+	glUniform1i(ComputeUniformLoc::LodCount, mesh.m_LodCount);
+	glUniform1fv(ComputeUniformLoc::LodScreenSizes, MAX_MESH_LODS - 1, mesh.m_LodScreenSizes);
+	glUniform3f(ComputeUniformLoc::EyePosition, eye.x, eye.y, eye.z);
+	glUniform1f(ComputeUniformLoc::ProjectionScale, camera.getProjection()[1][1]);
+	glUniform1f(ComputeUniformLoc::BoundsRadius, length(boundsMax - boundsMin) * 0.5f);
+	glUniform1f(ComputeUniformLoc::ImpostorDistance, impostorDistance);
+	glUniform1f(ComputeUniformLoc::ImpostorFadeWidth, impostorFadeWidth);
+	glDispatchCompute((instanceCount + workGroupSize - 1) / workGroupSize, 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	// the counts into the commands, the lod offsets into the cursors, one more invocation for the impostors
+	glUseProgram(commandsProgram);
+	glUniform1i(ComputeUniformLoc::CommandCount, commandCount);
+	glUniform1i(ComputeUniformLoc::EntryCount, entryCount);
+	glDispatchCompute((commandCount + 1 + commandGroupSize - 1) / commandGroupSize, 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	// compact, lod by lod
+	glUseProgram(scatterProgram);
+	glUniform1i(ComputeUniformLoc::InstanceCount, instanceCount);
+	glDispatchCompute((instanceCount + workGroupSize - 1) / workGroupSize, 1, 1);
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+
+	for (int b = SsboBinding::CullInstances; b <= SsboBinding::ImpostorCommand; b++)
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, b, 0);
+
+	glUseProgram(previousProgram);
+}
+
+void GpuCulling::draw(InstancedSkinnedMesh& mesh)
+{
+	if (!isReady() || capacity == 0)
+		return;
+
+	bindInstanceAttributes(mesh.m_VAO, visibleMatrixBuffer, visibleIndexBuffer);
+	mesh.RenderIndirect(commandBuffer);
+	bindInstanceAttributes(mesh.m_VAO, instanceBuffer, identityIndexBuffer);
+}
+
+void GpuCulling::drawImpostors(ImpostorAtlas& atlas, int frameNumber)
+{
+	if (!isReady() || capacity == 0 || impostorDistance == FLT_MAX)
+		return;
+
+	atlas.draw(impostorVao, impostorCommandBuffer, frameNumber, impostorDistance, impostorFadeWidth);
+}
+
+void GpuCulling::release()
+{
+	if (visibleMatrixBuffer != 0)
+		glDeleteBuffers(1, &visibleMatrixBuffer);
+	if (visibleIndexBuffer != 0)
+		glDeleteBuffers(1, &visibleIndexBuffer);
+	if (identityIndexBuffer != 0)
+		glDeleteBuffers(1, &identityIndexBuffer);
+	if (instanceLodBuffer != 0)
+		glDeleteBuffers(1, &instanceLodBuffer);
+	if (lodCountBuffer != 0)
+		glDeleteBuffers(1, &lodCountBuffer);
+	if (commandBuffer != 0)
+		glDeleteBuffers(1, &commandBuffer);
+	if (impostorInstanceBuffer != 0)
+		glDeleteBuffers(1, &impostorInstanceBuffer);
+	if (impostorCommandBuffer != 0)
+		glDeleteBuffers(1, &impostorCommandBuffer);
+	if (impostorVao != 0)
+		glDeleteVertexArrays(1, &impostorVao);
+
+	visibleMatrixBuffer = visibleIndexBuffer = identityIndexBuffer = instanceLodBuffer = lodCountBuffer = commandBuffer = 0;
+	impostorInstanceBuffer = impostorCommandBuffer = impostorVao = 0;
+	capacity = 0;
+	commandCount = 0;
+	entryCount = 0;
+}
+
+bool GpuCulling::isReady() const
+{
+	return cullProgram != -1 && commandsProgram != -1 && scatterProgram != -1;
+}
+
+void GpuCulling::bindInstanceAttributes(GLuint vao, GLuint matrices, GLuint indices)
+{
+	glBindVertexArray(vao);
+	glBindBuffer(GL_ARRAY_BUFFER, matrices);
+	for (int i = 0; i < 4; i++)
+	{
+		glVertexAttribPointer(AttribLoc::matPosInstance + i,
+			4, GL_FLOAT, GL_FALSE,
+			sizeof(mat4),
+			(void*)(sizeof(vec4) * i));
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, indices);
+	glVertexAttribIPointer(AttribLoc::instanceIndex, 1, GL_UNSIGNED_INT, sizeof(GLuint), (void*)0);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
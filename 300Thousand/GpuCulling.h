@@ -0,0 +1,78 @@
+#pragma once
+#include <GL/glew.h>
+#include <vector>
+#include <glm/glm.hpp>
+#include "ShaderLocs.h"
+#include "Camera.h"
+#include "InstancedSkinnedMesh.h"
+#include "ImpostorAtlas.h"
+
+using namespace std;
+using namespace glm;
+
+// the layout glDrawElementsIndirect reads, matches struct DrawCommand in gpu_cull_commands_cs.glsl
+struct DrawElementsIndirectCommand
+{
+	GLuint count;
+	GLuint instanceCount;
+	GLuint firstIndex;
+	GLint baseVertex;
+	GLuint baseInstance;
+};
+
+/*
+ frustum culling and lod selection of the instances on the gpu, the visible counts never come back to
+ the cpu. the first compute pass tests the box of every instance against the camera planes, picks its
+ lod from the size of its bounding sphere on screen and counts the instances per lod, the second turns
+ the counts into the instance counts and base instances of the indirect commands (one per lod and mesh
+ entry, lod major), the third scatters the survivors into a compacted matrix buffer with the lods one
+ after another (one atomic per lod and work group). draw() points the instance attributes of the mesh
+ vao at the compacted buffers for the indirect draw and back at the full buffer afterwards. the original
+ index of every survivor goes along, so the animation phase of an agent does not depend on what else is
+ visible. past impostorDistance the instances go to a buffer of impostors instead (position and index),
+ drawn by drawImpostors() with one indirect quad draw. inside the fade band they go to both, the two
+ shaders dither between them.
+*/
+
+class GpuCulling
+{
+public:
+	GpuCulling();
+	~GpuCulling();
+	// instanceBuffer holds capacity model matrices and feeds the matPosInstance attribute of the mesh vao
+	bool init(InstancedSkinnedMesh& mesh, GLuint instanceBuffer, int capacity);
+	bool reloadShaders();
+	void cull(const Camera& camera, const InstancedSkinnedMesh& mesh, int instanceCount);
+	void draw(InstancedSkinnedMesh& mesh);  // the instances that passed the last cull()
+	void drawImpostors(ImpostorAtlas& atlas, int frameNumber);  // the impostors of the last cull()
+	void release();
+	bool isReady() const;
+
+	float boundsMargin;  // grows the mesh box on every side, the animated poses reach past the rest pose
+	float impostorDistance;   // world units from the eye, FLT_MAX draws no impostors
+	float impostorFadeWidth;
+
+private:
+	void bindInstanceAttributes(GLuint vao, GLuint matrices, GLuint indices);
+
+	GLuint cullProgram;
+	GLuint commandsProgram;
+	GLuint scatterProgram;
+
+	GLuint visibleMatrixBuffer;
+	GLuint visibleIndexBuffer;
+	GLuint identityIndexBuffer;  // 0 .. capacity - 1, the instance index when nothing is culled
+	GLuint instanceLodBuffer;    // lod of every instance, or culled
+	GLuint lodCountBuffer;       // instances per lod, then the scatter cursor of every lod
+	GLuint commandBuffer;
+	GLuint impostorInstanceBuffer;
+	GLuint impostorCommandBuffer;
+	GLuint impostorVao;
+	GLuint instanceBuffer;       // owned by the caller
+
+	int capacity;
+	int commandCount;
+	int entryCount;
+	vec3 boundsMin;
+	vec3 boundsMax;
+};
@@ -0,0 +1,228 @@
+#include "GpuSimulation.h"
+#include "InitShader.h"
+#include <algorithm>
+#include <iostream>
+
+static const std::string integrate_compute_shader("gpu_sim_integrate_cs.glsl");
+static const std::string scan_compute_shader("gpu_sim_scan_cs.glsl");
+static const std::string scatter_compute_shader("gpu_sim_scatter_cs.glsl");
+static const std::string collide_compute_shader("gpu_sim_collide_cs.glsl");
+
+static const int workGroupSize = 256;
+
+// matches struct Agent in the compute shaders (std430)
+struct GpuAgent
+{
+	vec4 pos;
+	vec4 vel;
+};
+
+GpuSimulation::GpuSimulation()
+	: integrateProgram(-1), scanProgram(-1), scatterProgram(-1), collideProgram(-1),
+	cellCountBuffer(0), cellStartBuffer(0), sortedAgentsBuffer(0), agentCellBuffer(0), instanceBuffer(0),
+	current(0), agentCount(0), tableSize(0), cellSize(1.0f),
+	restAABB(0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f), arenaMin(0.0f), arenaMax(0.0f)
+{
+	agentBuffers[0] = 0;
+	agentBuffers[1] = 0;
+}
+
+GpuSimulation::~GpuSimulation()
+{
+	// buffers are released explicitly while the context is still alive, see release()
+}
+
+bool GpuSimulation::init(const vector<vec3>& positions, const vector<vec3>& velocities, const AABB& restAABB,
+	vec2 arenaMin, vec2 arenaMax, GLuint instanceBuffer)
+{
+	release();
+
+	this->restAABB = restAABB;
+	this->arenaMin = arenaMin;
+	this->arenaMax = arenaMax;
+	this->instanceBuffer = instanceBuffer;
+	agentCount = positions.size();
+	current = 0;
+
+	// same cell and table sizing as SpatialHashGrid, every agent shares the rest box
+	cellSize = std::max(restAABB.maxX_0 - restAABB.minX_0, restAABB.maxY_0 - restAABB.minY_0);
+	if (cellSize <= 0.0f)
+		cellSize = 1.0f;
+	tableSize = 1;
+	while (tableSize < 2 * (unsigned int)agentCount)
+		tableSize <<= 1;
+
+	vector<GpuAgent> agents(agentCount);
+	for (int i = 0; i < agentCount; i++)
+	{
+		agents[i].pos = vec4(positions[i], 1.0f);
+		agents[i].vel = vec4(velocities[i], 0.0f);
+	}
+
+	glGenBuffers(2, agentBuffers);
+	for (int b = 0; b < 2; b++)
+	{
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, agentBuffers[b]);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, agentCount * sizeof(GpuAgent), agents.data(), GL_DYNAMIC_COPY);
+	}
+
+	glGenBuffers(1, &cellCountBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, cellCountBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, tableSize * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+
+	glGenBuffers(1, &cellStartBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, cellStartBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, (tableSize + 1) * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+
+	glGenBuffers(1, &sortedAgentsBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, sortedAgentsBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, std::max(1, agentCount) * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+
+	glGenBuffers(1, &agentCellBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, agentCellBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, std::max(1, agentCount) * 2 * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	return reloadShaders();
+}
+
+bool GpuSimulation::reloadShaders()
+{
+	// InitShader leaves the new program bound
+	GLint previousProgram = 0;
+	glGetIntegerv(GL_CURRENT_PROGRAM, &previousProgram);
+
+	GLuint programs[4] = {
+		InitShader(integrate_compute_shader.c_str()),
+		InitShader(scan_compute_shader.c_str()),
+		InitShader(scatter_compute_shader.c_str()),
+		InitShader(collide_compute_shader.c_str())
+	};
+
+	glUseProgram(previousProgram);
+
+	bool loaded = true;
+	for (int p = 0; p < 4; p++)
+		loaded = loaded && programs[p] != -1;
+
+	if (!loaded)
+	{
+		// keep the old programs if any of the new ones failed
+		for (int p = 0; p < 4; p++)
+		{
+			if (programs[p] != -1)
+				glDeleteProgram(programs[p]);
+		}
+		std::cerr << "gpu simulation shaders failed, keeping the previous programs" << std::endl;
+		return isReady();
+	}
+
+	GLuint* slots[4] = { &integrateProgram, &scanProgram, &scatterProgram, &collideProgram };
+	for (int p = 0; p < 4; p++)
+	{
+		if (*slots[p] != -1)
+			glDeleteProgram(*slots[p]);
+		*slots[p] = programs[p];
+	}
+
+	return true;
+}
+
+// each pass only declares the uniforms it reads, setting a missing location is an error
+void GpuSimulation::setGridUniforms()
+{
+	glUniform1f(ComputeUniformLoc::CellSize, cellSize);
+	glUniform1ui(ComputeUniformLoc::TableMask, tableSize - 1);
+	glUniform3f(ComputeUniformLoc::RestMin, restAABB.minX_0, restAABB.minY_0, restAABB.minZ_0);
+	glUniform3f(ComputeUniformLoc::RestMax, restAABB.maxX_0, restAABB.maxY_0, restAABB.maxZ_0);
+}
+
+void GpuSimulation::step(float deltaTime)
+{
+	if (!isReady() || agentCount == 0)
+		return;
+
+	GLint previousProgram = 0;
+	glGetIntegerv(GL_CURRENT_PROGRAM, &previousProgram);
+
+	GLuint agentGroups = (agentCount + workGroupSize - 1) / workGroupSize;
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SsboBinding::AgentsIn, agentBuffers[current]);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SsboBinding::AgentsOut, agentBuffers[1 - current]);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SsboBinding::CellCount, cellCountBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SsboBinding::CellStart, cellStartBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SsboBinding::SortedAgents, sortedAgentsBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SsboBinding::AgentCell, agentCellBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SsboBinding::ModelMatrices, instanceBuffer);
+
+	// counting sort starts from empty buckets
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, cellCountBuffer);
+	glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	// integrate, wall bounce and count agents per bucket
+	glUseProgram(integrateProgram);
+	glUniform1i(ComputeUniformLoc::AgentCount, agentCount);
+	glUniform1f(ComputeUniformLoc::DeltaTime, deltaTime);
+	glUniform2f(ComputeUniformLoc::ArenaMin, arenaMin.x, arenaMin.y);
+	glUniform2f(ComputeUniformLoc::ArenaMax, arenaMax.x, arenaMax.y);
+	setGridUniforms();
+	glDispatchCompute(agentGroups, 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	// bucket start offsets
+	glUseProgram(scanProgram);
+	glUniform1ui(ComputeUniformLoc::TableMask, tableSize - 1);
+	glDispatchCompute(1, 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	// agents in bucket order
+	glUseProgram(scatterProgram);
+	glUniform1i(ComputeUniformLoc::AgentCount, agentCount);
+	glDispatchCompute(agentGroups, 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	// resolve overlaps and write the instance transforms
+	glUseProgram(collideProgram);
+	glUniform1i(ComputeUniformLoc::AgentCount, agentCount);
+	glUniform1f(ComputeUniformLoc::DeltaTime, deltaTime);
+	setGridUniforms();
+	glDispatchCompute(agentGroups, 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+
+	for (int b = 0; b <= SsboBinding::ModelMatrices; b++)
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, b, 0);
+
+	current = 1 - current;
+	glUseProgram(previousProgram);
+}
+
+void GpuSimulation::release()
+{
+	if (agentBuffers[0] != 0)
+		glDeleteBuffers(2, agentBuffers);
+	if (cellCountBuffer != 0)
+		glDeleteBuffers(1, &cellCountBuffer);
+	if (cellStartBuffer != 0)
+		glDeleteBuffers(1, &cellStartBuffer);
+	if (sortedAgentsBuffer != 0)
+		glDeleteBuffers(1, &sortedAgentsBuffer);
+	if (agentCellBuffer != 0)
+		glDeleteBuffers(1, &agentCellBuffer);
+
+	agentBuffers[0] = agentBuffers[1] = 0;
+	cellCountBuffer = cellStartBuffer = sortedAgentsBuffer = agentCellBuffer = 0;
+	agentCount = 0;
+}
+
+bool GpuSimulation::isReady() const
+{
+	return integrateProgram != -1 && scanProgram != -1 && scatterProgram != -1 && collideProgram != -1;
+}
+
+int GpuSimulation::getAgentCount() const
+{
+	return agentCount;
+}
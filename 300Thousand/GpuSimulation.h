@@ -0,0 +1,53 @@
+#pragma once
+#include <GL/glew.h>
+#include <vector>
+#include <glm/glm.hpp>
+#include "AABB.h"
+#include "ShaderLocs.h"
+
+using namespace std;
+using namespace glm;
+
+/*
+ agent simulation on compute shaders, positions and velocities never leave the gpu.
+ every step: integrate + wall bounce, count agents per grid bucket, scan the counts, scatter agents
+ into bucket order, resolve overlaps against the neighbouring cells and write the instance model
+ matrices straight into the buffer RenderInstanced reads. only core gl 4.3 is used (runs on llvmpipe).
+*/
+
+class GpuSimulation
+{
+public:
+	GpuSimulation();
+	~GpuSimulation();
+	bool init(const vector<vec3>& positions, const vector<vec3>& velocities, const AABB& restAABB,
+		vec2 arenaMin, vec2 arenaMax, GLuint instanceBuffer);
+	bool reloadShaders();
+	void step(float deltaTime);
+	void release();
+	bool isReady() const;
+	int getAgentCount() const;
+
+private:
+	void setGridUniforms();
+
+	GLuint integrateProgram;
+	GLuint scanProgram;
+	GLuint scatterProgram;
+	GLuint collideProgram;
+
+	GLuint agentBuffers[2];  // ping-pong, collision reads one and writes the other
+	GLuint cellCountBuffer;
+	GLuint cellStartBuffer;
+	GLuint sortedAgentsBuffer;
+	GLuint agentCellBuffer;
+	GLuint instanceBuffer;   // owned by the caller
+
+	int current;
+	int agentCount;
+	unsigned int tableSize;
+	float cellSize;
+	AABB restAABB;
+	vec2 arenaMin;
+	vec2 arenaMax;
+};
@@ -0,0 +1,277 @@
+#include "ImpostorAtlas.h"
+#include "InitShader.h"
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/constants.hpp>
+#include <algorithm>
+#include <iostream>
+
+static const std::string impostor_vertex_shader("impostor_vs.glsl");
+static const std::string impostor_fragment_shader("impostor_fs.glsl");
+
+// frames of the animation loop, see getCellIndex in instanced_skinning_vs.glsl
+static const int animationFrames = 150;
+// the fade distance of the skinning shader while baking, far enough that nothing fades
+static const float noImpostors = 3.0e38f;
+
+// matches the SceneUniforms block of the shaders
+struct BakeSceneUniforms
+{
+	mat4 PV;
+	vec4 eye_w;
+};
+
+ImpostorAtlas::ImpostorAtlas()
+	: azimuthCount(8), elevationCount(3), frameCount(16), tileSize(64), maxElevation(glm::radians(60.0f)), boundsMargin(0.25f),
+	program(-1), texture(0), center(0.0f), halfSize(1.0f)
+{
+}
+
+ImpostorAtlas::~ImpostorAtlas()
+{
+	// the texture is released explicitly while the context is still alive, see release()
+}
+
+bool ImpostorAtlas::bake(InstancedSkinnedMesh& mesh, GLuint skinningProgram, int animTexWidth, int animTexHeight)
+{
+	if (texture != 0)
+		glDeleteTextures(1, &texture);
+	texture = 0;
+
+	// a sphere around the rest box, the quad is the square around it
+	vec3 boundsMin, boundsMax;
+	mesh.GetBounds(boundsMin, boundsMax);
+	center = (boundsMin + boundsMax) * 0.5f;
+	halfSize = std::max(length(boundsMax - boundsMin) * 0.5f * (1.0f + boundsMargin), 1e-3f);
+
+	int viewCount = azimuthCount * elevationCount;
+	int atlasWidth = frameCount * tileSize;
+	int atlasHeight = viewCount * tileSize;
+	GLint maxTextureSize = 0;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+	if (viewCount <= 0 || frameCount <= 0 || atlasWidth > maxTextureSize || atlasHeight > maxTextureSize)
+	{
+		std::cerr << "impostor atlas of " << atlasWidth << " x " << atlasHeight << " is not possible" << std::endl;
+		return false;
+	}
+
+	// mips down to 4 pixel tiles, the impostors are small on screen
+	int levels = 1;
+	while ((tileSize >> levels) >= 4)
+		levels++;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexStorage2D(GL_TEXTURE_2D, levels, GL_RGBA8, atlasWidth, atlasHeight);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	GLuint depthBuffer = 0;
+	glGenRenderbuffers(1, &depthBuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, atlasWidth, atlasHeight);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	GLint previousFramebuffer = 0;
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previousFramebuffer);
+	GLuint framebuffer = 0;
+	glGenFramebuffers(1, &framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+	bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+
+	if (complete)
+	{
+		GLint previousProgram = 0;
+		GLint previousViewport[4];
+		GLfloat previousClearColor[4];
+		GLint previousSceneBuffer = 0;
+		glGetIntegerv(GL_CURRENT_PROGRAM, &previousProgram);
+		glGetIntegerv(GL_VIEWPORT, previousViewport);
+		glGetFloatv(GL_COLOR_CLEAR_VALUE, previousClearColor);
+		glGetIntegeri_v(GL_UNIFORM_BUFFER_BINDING, 0, &previousSceneBuffer);
+
+		// a camera of its own for the bake
+		GLuint sceneBuffer = 0;
+		glGenBuffers(1, &sceneBuffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, sceneBuffer);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(BakeSceneUniforms), nullptr, GL_STREAM_DRAW);
+		glBindBufferBase(GL_UNIFORM_BUFFER, 0, sceneBuffer);
+
+		// one instance at the origin with index 0, so the frame number is the animation frame
+		mat4 identity(1.0f);
+		GLuint zero = 0;
+		GLuint matrixBuffer = 0;
+		GLuint indexBuffer = 0;
+		glGenBuffers(1, &matrixBuffer);
+		glBindBuffer(GL_ARRAY_BUFFER, matrixBuffer);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(mat4), &identity, GL_STATIC_DRAW);
+		glGenBuffers(1, &indexBuffer);
+		glBindBuffer(GL_ARRAY_BUFFER, indexBuffer);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(GLuint), &zero, GL_STATIC_DRAW);
+
+		glBindVertexArray(mesh.m_VAO);
+		GLint previousMatrixBuffer = 0;
+		GLint previousIndexBuffer = 0;
+		GLint previousIndexEnabled = 0;
+		glGetVertexAttribiv(AttribLoc::matPosInstance, GL_VERTEX_ATTRIB_ARRAY_BUFFER_BINDING, &previousMatrixBuffer);
+		glGetVertexAttribiv(AttribLoc::instanceIndex, GL_VERTEX_ATTRIB_ARRAY_BUFFER_BINDING, &previousIndexBuffer);
+		glGetVertexAttribiv(AttribLoc::instanceIndex, GL_VERTEX_ATTRIB_ARRAY_ENABLED, &previousIndexEnabled);
+		glBindBuffer(GL_ARRAY_BUFFER, matrixBuffer);
+		for (int i = 0; i < 4; i++)
+			glVertexAttribPointer(AttribLoc::matPosInstance + i, 4, GL_FLOAT, GL_FALSE, sizeof(mat4), (void*)(sizeof(vec4) * i));
+		glBindBuffer(GL_ARRAY_BUFFER, indexBuffer);
+		glVertexAttribIPointer(AttribLoc::instanceIndex, 1, GL_UNSIGNED_INT, sizeof(GLuint), (void*)0);
+		glVertexAttribDivisor(AttribLoc::instanceIndex, 1);
+		glEnableVertexAttribArray(AttribLoc::instanceIndex);
+		glBindVertexArray(0);
+
+		glUseProgram(skinningProgram);
+		glUniform1i(UniformLoc::Mode, 1);
+		glUniform1i(UniformLoc::NumBones, mesh.NumBones());
+		glUniform1i(UniformLoc::AnimTexHeight, animTexHeight);
+		glUniform1i(UniformLoc::AnimTexWidth, animTexWidth);
+		glUniform1f(UniformLoc::ImpostorDistance, noImpostors);
+
+		glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+		// rows bottom up: elevation major, azimuth minor, the order impostor_vs.glsl picks them in
+		mat4 projection = ortho(-halfSize, halfSize, -halfSize, halfSize, 0.0f, 4.0f * halfSize);
+		for (int e = 0; e < elevationCount; e++)
+		{
+			float elevation = elevationCount > 1 ? maxElevation * e / (elevationCount - 1) : 0.0f;
+			for (int a = 0; a < azimuthCount; a++)
+			{
+				float azimuth = 2.0f * glm::pi<float>() * a / azimuthCount;
+				vec3 direction(cos(elevation) * cos(azimuth), cos(elevation) * sin(azimuth), sin(elevation));
+				vec3 eye = center + direction * (2.0f * halfSize);
+
+				BakeSceneUniforms scene;
+				scene.PV = projection * lookAt(eye, center, vec3(0.0f, 0.0f, 1.0f));
+				scene.eye_w = vec4(eye, 1.0f);
+				glBindBuffer(GL_UNIFORM_BUFFER, sceneBuffer);
+				glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(scene), &scene);
+				glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+				int view = e * azimuthCount + a;
+				for (int f = 0; f < frameCount; f++)
+				{
+					glUniform1i(UniformLoc::FrameNumber, f * animationFrames / frameCount);
+					glViewport(f * tileSize, view * tileSize, tileSize, tileSize);
+					mesh.RenderInstanced(1);
+				}
+			}
+		}
+
+		// everything back the way the caller had it
+		glBindVertexArray(mesh.m_VAO);
+		if (previousMatrixBuffer != 0)
+		{
+			glBindBuffer(GL_ARRAY_BUFFER, previousMatrixBuffer);
+			for (int i = 0; i < 4; i++)
+				glVertexAttribPointer(AttribLoc::matPosInstance + i, 4, GL_FLOAT, GL_FALSE, sizeof(mat4), (void*)(sizeof(vec4) * i));
+		}
+		if (previousIndexBuffer != 0)
+		{
+			glBindBuffer(GL_ARRAY_BUFFER, previousIndexBuffer);
+			glVertexAttribIPointer(AttribLoc::instanceIndex, 1, GL_UNSIGNED_INT, sizeof(GLuint), (void*)0);
+		}
+		if (!previousIndexEnabled)
+			glDisableVertexAttribArray(AttribLoc::instanceIndex);
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		glBindBufferBase(GL_UNIFORM_BUFFER, 0, previousSceneBuffer);
+		glUseProgram(previousProgram);
+		glViewport(previousViewport[0], previousViewport[1], previousViewport[2], previousViewport[3]);
+		glClearColor(previousClearColor[0], previousClearColor[1], previousClearColor[2], previousClearColor[3]);
+
+		glDeleteBuffers(1, &sceneBuffer);
+		glDeleteBuffers(1, &matrixBuffer);
+		glDeleteBuffers(1, &indexBuffer);
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+	glDeleteFramebuffers(1, &framebuffer);
+	glDeleteRenderbuffers(1, &depthBuffer);
+
+	if (!complete)
+	{
+		std::cerr << "impostor atlas framebuffer incomplete" << std::endl;
+		glDeleteTextures(1, &texture);
+		texture = 0;
+		return false;
+	}
+
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glGenerateMipmap(GL_TEXTURE_2D);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	std::cout << "impostor atlas " << atlasWidth << " x " << atlasHeight << ", " << viewCount << " views, " << frameCount << " frames" << std::endl;
+	return reloadShaders();
+}
+
+bool ImpostorAtlas::reloadShaders()
+{
+	// InitShader leaves the new program bound
+	GLint previousProgram = 0;
+	glGetIntegerv(GL_CURRENT_PROGRAM, &previousProgram);
+	GLuint newProgram = InitShader(impostor_vertex_shader.c_str(), impostor_fragment_shader.c_str());
+	glUseProgram(previousProgram);
+
+	if (newProgram == -1)
+	{
+		std::cerr << "impostor shaders failed, keeping the previous program" << std::endl;
+		return isReady();
+	}
+	if (program != -1)
+		glDeleteProgram(program);
+	program = newProgram;
+	return true;
+}
+
+void ImpostorAtlas::draw(GLuint vao, GLuint commandBuffer, int frameNumber, float distance, float fadeWidth)
+{
+	if (!isReady())
+		return;
+
+	GLint previousProgram = 0;
+	glGetIntegerv(GL_CURRENT_PROGRAM, &previousProgram);
+
+	glUseProgram(program);
+	glUniform1i(UniformLoc::FrameNumber, frameNumber);
+	glUniform1f(UniformLoc::ImpostorDistance, distance);
+	glUniform1f(UniformLoc::ImpostorFadeWidth, fadeWidth);
+	glUniform3i(UniformLoc::ImpostorGrid, azimuthCount, elevationCount, frameCount);
+	glUniform3f(UniformLoc::ImpostorCenter, center.x, center.y, center.z);
+	glUniform1f(UniformLoc::ImpostorHalfSize, halfSize);
+	glUniform1f(UniformLoc::ImpostorMaxElevation, maxElevation);
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glBindVertexArray(vao);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+	glDrawArraysIndirect(GL_TRIANGLE_STRIP, (void*)0);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	glBindVertexArray(0);
+
+	glUseProgram(previousProgram);
+}
+
+void ImpostorAtlas::release()
+{
+	if (texture != 0)
+		glDeleteTextures(1, &texture);
+	if (program != -1)
+		glDeleteProgram(program);
+	texture = 0;
+	program = -1;
+}
+
+bool ImpostorAtlas::isReady() const
+{
+	return texture != 0 && program != -1;
+}
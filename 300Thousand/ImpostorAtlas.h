@@ -0,0 +1,53 @@
+#pragma once
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "ShaderLocs.h"
+#include "InstancedSkinnedMesh.h"
+
+using namespace std;
+using namespace glm;
+
+// the layout glDrawArraysIndirect reads, matches the ImpostorCommand block in gpu_cull_commands_cs.glsl
+struct DrawArraysIndirectCommand
+{
+	GLuint count;
+	GLuint instanceCount;
+	GLuint first;
+	GLuint baseInstance;
+};
+
+/*
+ pre-rendered pictures of the skinned mesh for the agents far away, one camera facing quad each. bake()
+ renders the mesh with the skinning program into an offscreen atlas once at load, a row per view
+ direction (azimuths around z times elevations above the ground) and a column per animation frame.
+ the agents only move, they never turn, so the light baked in stays right. the quads take the nearest
+ view and the frame of their animation phase, the same phase the skinned mesh uses.
+*/
+
+class ImpostorAtlas
+{
+public:
+	ImpostorAtlas();
+	~ImpostorAtlas();
+	// skinningProgram is the instanced skinning program with its light and material blocks bound.
+	// the instance attributes of the mesh vao are put back as they were
+	bool bake(InstancedSkinnedMesh& mesh, GLuint skinningProgram, int animTexWidth, int animTexHeight);
+	bool reloadShaders();
+	// vao feeds the impostor instances (position, index), commandBuffer holds one DrawArraysIndirectCommand
+	void draw(GLuint vao, GLuint commandBuffer, int frameNumber, float distance, float fadeWidth);
+	void release();
+	bool isReady() const;
+
+	int azimuthCount;
+	int elevationCount;
+	int frameCount;        // of the 150 frame animation loop
+	int tileSize;          // pixels
+	float maxElevation;    // radians, the highest baked view
+	float boundsMargin;    // grows the quad around the mesh, the animated poses reach past the rest pose
+
+private:
+	GLuint program;
+	GLuint texture;
+	vec3 center;
+	float halfSize;
+};
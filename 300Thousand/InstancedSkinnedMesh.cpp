@@ -17,6 +17,7 @@
 #include "ShaderLocs.h"
 #include <iostream>
 #include "Constants.hpp"
+#include "MeshSimplifier.h"
 
 
 void InstancedSkinnedMesh::VertexBoneData::AddBoneData(unsigned int BoneID, float Weight)
@@ -42,6 +43,10 @@ InstancedSkinnedMesh::InstancedSkinnedMesh()
    memset(m_Buffers, 0, sizeof(m_Buffers));
    m_NumBones = 0;
    m_pScene = NULL;
+   m_LodCount = 1;
+   m_LodScreenSizes[0] = 0.1f;
+   m_LodScreenSizes[1] = 0.05f;
+   m_LodScreenSizes[2] = 0.025f;
 }
 
 
@@ -203,6 +208,8 @@ bool InstancedSkinnedMesh::InitFromScene(const aiScene* pScene, const string& Fi
       return false;
    }
 
+   GenerateLods(Positions, Bones, Indices);
+
    // Generate and populate the buffers with vertex attributes and the indices
    glBindBuffer(GL_ARRAY_BUFFER, m_Buffers[POS_VB]);
    glBufferData(GL_ARRAY_BUFFER, sizeof(Positions[0]) * Positions.size(), &Positions[0], GL_STATIC_DRAW);
@@ -240,6 +247,80 @@ bool InstancedSkinnedMesh::InitFromScene(const aiScene* pScene, const string& Fi
    return true;
 }
 
+// fraction of the triangles of the full mesh each lod keeps
+static const float LodRatios[MAX_MESH_LODS] = { 1.0f, 0.5f, 0.25f, 0.12f };
+
+void InstancedSkinnedMesh::GenerateLods(const vector<aiVector3D>& Positions, const vector<VertexBoneData>& Bones, vector<unsigned int>& Indices)
+{
+    // every lod simplifies the one before it, the indices go after the full mesh in the same buffer
+    MeshSimplifier simplifier;
+    vector<glm::vec3> points;
+    vector<unsigned char> boneIds;
+    vector<float> boneWeights;
+    vector<unsigned int> source;
+    vector<unsigned int> lod;
+    unsigned int lodTriangles[MAX_MESH_LODS] = { 0 };
+    unsigned int lodTargets[MAX_MESH_LODS] = { 0 };
+
+    for (unsigned int i = 0; i < m_Entries.size(); i++)
+    {
+        MeshEntry& entry = m_Entries[i];
+        unsigned int vertexCount = (i + 1 < m_Entries.size() ? m_Entries[i + 1].BaseVertex : Positions.size()) - entry.BaseVertex;
+
+        points.resize(vertexCount);
+        boneIds.resize(vertexCount * NUM_BONES_PER_VERTEX);
+        boneWeights.resize(vertexCount * NUM_BONES_PER_VERTEX);
+        for (unsigned int v = 0; v < vertexCount; v++)
+        {
+            const aiVector3D& p = Positions[entry.BaseVertex + v];
+            points[v] = glm::vec3(p.x, p.y, p.z);
+            for (int b = 0; b < NUM_BONES_PER_VERTEX; b++)
+            {
+                boneIds[v * NUM_BONES_PER_VERTEX + b] = Bones[entry.BaseVertex + v].IDs[b];
+                boneWeights[v * NUM_BONES_PER_VERTEX + b] = Bones[entry.BaseVertex + v].Weights[b];
+            }
+        }
+
+        entry.LodBaseIndex[0] = entry.BaseIndex;
+        entry.LodNumIndices[0] = entry.NumIndices;
+        lodTriangles[0] += entry.NumIndices / 3;
+        lodTargets[0] += entry.NumIndices / 3;
+        for (int l = 1; l < MAX_MESH_LODS; l++)
+        {
+            source.assign(Indices.begin() + entry.LodBaseIndex[l - 1], Indices.begin() + entry.LodBaseIndex[l - 1] + entry.LodNumIndices[l - 1]);
+            unsigned int target = (unsigned int)(entry.NumIndices * LodRatios[l]) / 3 * 3;
+            unsigned int count = simplifier.simplify(points.data(), boneIds.data(), boneWeights.data(), vertexCount,
+                source.data(), source.size(), target, lod);
+
+            if (count >= source.size())
+            {
+                // nothing left to take within the error limit, the lod repeats the one before
+                entry.LodBaseIndex[l] = entry.LodBaseIndex[l - 1];
+                entry.LodNumIndices[l] = entry.LodNumIndices[l - 1];
+            }
+            else
+            {
+                entry.LodBaseIndex[l] = Indices.size();
+                entry.LodNumIndices[l] = count;
+                Indices.insert(Indices.end(), lod.begin(), lod.end());
+            }
+            lodTriangles[l] += entry.LodNumIndices[l] / 3;
+            lodTargets[l] += target / 3;
+        }
+    }
+
+    // a lod above its target stopped at the error limit or ran out of legal collapses, it costs
+    // about as much to draw as the one before
+    m_LodCount = m_Entries.empty() ? 1 : MAX_MESH_LODS;
+    for (int l = 0; l < m_LodCount; l++)
+    {
+        cout << "LOD " << l << ": " << lodTriangles[l] << " triangles";
+        if (lodTriangles[l] > lodTargets[l])
+            cout << ", missed its target of " << lodTargets[l] << " (max error " << simplifier.maxError << ")";
+        cout << std::endl;
+    }
+}
+
 void InstancedSkinnedMesh::InitMesh(unsigned int MeshIndex,
                     const aiMesh* pMesh,
                     vector<aiVector3D>& Positions,
@@ -466,6 +547,101 @@ void InstancedSkinnedMesh::RenderInstanced(int instanceCount)
     glBindVertexArray(0);
 }
 
+void InstancedSkinnedMesh::RenderInstancedLod(int lod, int instanceCount, int baseInstance)
+{
+    glBindVertexArray(m_VAO);
+
+    for (unsigned int i = 0; i < m_pScene->mNumAnimations; i++) {
+        glActiveTexture(textureBindValues[i]);
+        glBindTexture(GL_TEXTURE_2D, animTextures[i]);
+    }
+
+    for (unsigned int i = 0; i < m_Entries.size(); i++)
+    {
+        const unsigned int MaterialIndex = m_Entries[i].MaterialIndex;
+
+        assert(MaterialIndex < m_Textures.size());
+
+        if (m_Textures[MaterialIndex])
+        {
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, m_Textures[MaterialIndex]);
+        }
+
+        glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES,
+            m_Entries[i].LodNumIndices[lod],
+            GL_UNSIGNED_INT,
+            (void*)(sizeof(unsigned int) * m_Entries[i].LodBaseIndex[lod]),
+            instanceCount,
+            m_Entries[i].BaseVertex,
+            baseInstance);
+    }
+
+    glBindVertexArray(0);
+}
+
+void InstancedSkinnedMesh::RenderIndirect(GLuint commandBuffer)
+{
+    glBindVertexArray(m_VAO);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+
+    for (unsigned int i = 0; i < m_pScene->mNumAnimations; i++) {
+        glActiveTexture(textureBindValues[i]);
+        glBindTexture(GL_TEXTURE_2D, animTextures[i]);
+    }
+
+    // same as RenderInstanced, the instance counts come from the command buffer.
+    // entries that share a material go out as one multi draw
+    for (int lod = 0; lod < m_LodCount; lod++)
+    {
+        unsigned int first = 0;
+        while (first < m_Entries.size())
+        {
+            const unsigned int MaterialIndex = m_Entries[first].MaterialIndex;
+
+            assert(MaterialIndex < m_Textures.size());
+
+            unsigned int last = first + 1;
+            while (last < m_Entries.size() && m_Entries[last].MaterialIndex == MaterialIndex)
+                last++;
+
+            if (m_Textures[MaterialIndex])
+            {
+                glActiveTexture(GL_TEXTURE0);
+                glBindTexture(GL_TEXTURE_2D, m_Textures[MaterialIndex]);
+            }
+
+            unsigned int command = lod * m_Entries.size() + first;
+            glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)(sizeof(GLuint) * 5 * command), last - first, 0);
+            first = last;
+        }
+    }
+
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    glBindVertexArray(0);
+}
+
+int InstancedSkinnedMesh::SelectLod(float screenSize) const
+{
+    int lod = 0;
+    while (lod < m_LodCount - 1 && screenSize < m_LodScreenSizes[lod])
+        lod++;
+    return lod;
+}
+
+void InstancedSkinnedMesh::GetBounds(glm::vec3& boundsMin, glm::vec3& boundsMax) const
+{
+    boundsMin = glm::vec3(0.0f);
+    boundsMax = glm::vec3(0.0f);
+    for (unsigned int i = 0; i < m_Entries.size(); i++)
+    {
+        glm::vec3 entryMin(m_Entries[i].mBbMin.x, m_Entries[i].mBbMin.y, m_Entries[i].mBbMin.z);
+        glm::vec3 entryMax(m_Entries[i].mBbMax.x, m_Entries[i].mBbMax.y, m_Entries[i].mBbMax.z);
+        boundsMin = i == 0 ? entryMin : glm::min(boundsMin, entryMin);
+        boundsMax = i == 0 ? entryMax : glm::max(boundsMax, entryMax);
+    }
+}
+
 unsigned int InstancedSkinnedMesh::FindPosition(float AnimationTime, const aiNodeAnim* pNodeAnim)
 {    
    for (unsigned int i = 0 ; i < pNodeAnim->mNumPositionKeys - 1 ; i++) 
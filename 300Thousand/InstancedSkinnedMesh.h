@@ -19,6 +19,7 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 #define INVALID_MATERIAL 0xFFFFFFFF
+#define MAX_MESH_LODS 4
 
 using namespace std;
 
@@ -30,6 +31,8 @@ struct MeshEntry
         BaseVertex = 0;
         BaseIndex = 0;
         MaterialIndex = INVALID_MATERIAL;
+        memset(LodNumIndices, 0, sizeof(LodNumIndices));
+        memset(LodBaseIndex, 0, sizeof(LodBaseIndex));
     }
 
     aiVector3D mBbMin, mBbMax;
@@ -38,6 +41,10 @@ struct MeshEntry
     unsigned int BaseVertex;
     unsigned int BaseIndex;
     unsigned int MaterialIndex;
+
+    // lod 0 is NumIndices at BaseIndex, the others index the same vertices
+    unsigned int LodNumIndices[MAX_MESH_LODS];
+    unsigned int LodBaseIndex[MAX_MESH_LODS];
 };
 
 class InstancedSkinnedMesh
@@ -52,6 +59,11 @@ class InstancedSkinnedMesh
        void UpdateFrame(int frameNumber, int bits, int animationIndex = 0);
        void Render();
        void RenderInstanced(int instanceCount);
+       void RenderInstancedLod(int lod, int instanceCount, int baseInstance);
+       // one DrawElementsIndirectCommand per lod and entry, lod major, one multi draw per lod and material
+       void RenderIndirect(GLuint commandBuffer);
+       int SelectLod(float screenSize) const;  // screenSize: bounding sphere diameter over the screen height
+       void GetBounds(glm::vec3& boundsMin, glm::vec3& boundsMax) const;  // rest pose, all entries
 	
        unsigned int NumBones() const {return m_NumBones;}
     
@@ -64,6 +76,8 @@ class InstancedSkinnedMesh
        FIBITMAP* m_img;
        vector<MeshEntry> m_Entries;
        GLuint m_VAO;
+       int m_LodCount;
+       float m_LodScreenSizes[MAX_MESH_LODS - 1];  // switch to the next lod below this screen size
     
    private:
        const static int NUM_BONES_PER_VERTEX = 4;
@@ -112,6 +126,7 @@ class InstancedSkinnedMesh
                      vector<unsigned int>& Indices);
        void LoadBones(unsigned int MeshIndex, const aiMesh* paiMesh, vector<VertexBoneData>& Bones);
        bool InitMaterials(const aiScene* pScene, const string& Filename);
+       void GenerateLods(const vector<aiVector3D>& Positions, const vector<VertexBoneData>& Bones, vector<unsigned int>& Indices);
        void Clear();
        int setMatrixInImage(aiMatrix4x4 boneTransform, FIBITMAP* img, int height, int width, unsigned int& currentX, unsigned int& currentY, int bits);
        void getRowAsColor(float elem1, float elem2, float elem3, float elem4, RGBQUAD & color, int bits);
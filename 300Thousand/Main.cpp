@@ -19,6 +19,7 @@
 #include <iostream>
 #include <random>
 #include <math.h>
+#include <cfloat>
 
 #include "InitShader.h"    //Functions for loading shaders from text files
 #include "LoadMesh.h"      //Functions for creating OpenGL buffers from mesh files
@@ -30,7 +31,14 @@
 #include "Camera.h"
 #include "Constants.hpp"
 #include "BVH.h"
+#include "BVHRenderer.h"
 #include "SceneObject.h"
+#include "AgentStore.h"
+#include "Simulation.h"
+#include "GpuSimulation.h"
+#include "GpuCulling.h"
+#include "CpuCulling.h"
+#include "ImpostorAtlas.h"
 
 const int init_window_width = 1024;
 const int init_window_height = 1024;
@@ -55,8 +63,33 @@ GLuint bounding_shader_program = -1;
 // mesh data
 static const std::string mesh_name = "custom4.dae";
 InstancedSkinnedMesh mesh_data;
-vector<SceneObject> objects;  // aabb, position, velocity
-BVH* bvh;
+
+// agents, broad-phase, response and bvh, the same seed gives the same run for any thread count
+unsigned int simulationSeed = 2022;
+Simulation simulation(simulationSeed);
+AgentStore& agents = simulation.agents;  // aabb, position, velocity as structure of arrays
+int threadCount = simulation.threadPool.getThreadCount();
+int contactBegins = 0;  // contact events drained from the simulation in the last frame
+int contactEnds = 0;
+BVHRenderer bvhRenderer;
+string bvhSnapshotPath;  // off by default, "-bvhsnapshot crowd.bvh" maps the spawn tree from that file
+
+// rendering mode crowd simulated on compute shaders
+GpuSimulation gpuSimulation;
+bool enableGpuSimulation = false;
+
+// instances outside the view frustum are dropped before the skinned draw, on the gpu or, for the cpu
+// simulated agents, through their bvh on the worker threads
+enum CullingMode { CULLING_OFF = 0, CULLING_GPU = 1, CULLING_CPU_BVH = 2 };
+GpuCulling gpuCulling;
+CpuCulling cpuCulling;
+int cullingMode = CULLING_GPU;
+
+// past impostorDistance the gpu culled crowd is drawn as pictures baked from the mesh, fading over impostorFadeWidth
+ImpostorAtlas impostorAtlas;
+bool enableImpostors = true;
+float impostorDistance = 300.f;
+float impostorFadeWidth = 30.f;
 
 // Camera
 Camera* camera;
@@ -84,14 +117,18 @@ bool isShowLayer = false;
 // IDs for BVH and AABB
 //GLuint model_matrix_buffer_rendering = -1;
 GLuint model_matrix_buffer = -1;
-GLuint aabbVAOs[INSTANCE_NUM] = { -1 };
-GLuint aabbVBOs[INSTANCE_NUM] = { -1 };
-GLuint bvhVAOs[INSTANCE_NUM - 1] = { -1 };
 
 // Time
 float prev_time = 0.f;
 float delta_time = 0.f;
 
+// fixed timestep simulation, rendering interpolates between the last two ticks
+float tick_rate = 60.f;      // ticks per second
+float tick_time = 1.f / 60.f;
+int max_substeps = 4;        // ticks per frame before the frame time is dropped
+float tick_accumulator = 0.f;
+float render_alpha = 1.f;    // 0 = prevPos, 1 = currPos
+
 int currentFrame = 0;
 
 unsigned int height = 256;
@@ -135,150 +172,13 @@ namespace UboBinding
 	int material = 2;
 }
 
-float random(float min, float max)
-{
-	//float randNum = (float)(rand() / (float)(RAND_MAX / abs(max - min)));
-	std::random_device device;
-	std::mt19937 generator(device());
-	std::uniform_real_distribution<float> distribution(min, max);
-	return min + distribution(generator);
-}
-
-void collisionDetection()
-{
-	for (int i = 0; i < INSTANCE_NUM; i++)
-	{
-		for (int j = i + 1; j < INSTANCE_NUM; j++)
-		{
-			AABB aabb_1 = objects[i].aabb;
-			AABB aabb_2 = objects[j].aabb;
-
-			if (aabb_1.overlap(aabb_2))
-			{
-				// change the uniform collision status
-				objects[i].collisionStatus = 1;
-				objects[j].collisionStatus = 1;
-
-				// difference of distance in x and y
-				glm::vec3 deltaArea = aabb_1.intersection(aabb_2);
-
-				// update position
-				// calculate the first collision axis
-				glm::vec3 velocity_delta = objects[i].velocity + objects[j].velocity;
-				float delta_time_x = deltaArea.x / velocity_delta.x;
-				float delta_time_y = deltaArea.y / velocity_delta.y;
-				if (delta_time_x <= delta_time_y)
-				{
-					// x direction is the hit normal
-					objects[i].currPos.x -= objects[i].velocity.x * delta_time;
-					objects[j].currPos.x -= objects[j].velocity.x * delta_time;
-
-					// update velocity
-					objects[i].velocity.x = -objects[i].velocity.x;
-					objects[j].velocity.x = -objects[j].velocity.x;
-				}
-				else
-				{
-					// y direction is the hit normal
-					objects[i].currPos.y -= objects[i].velocity.y * delta_time;
-					objects[j].currPos.y -= objects[j].velocity.y * delta_time;
-
-					// update velocity
-					objects[i].velocity.y = -objects[i].velocity.y;
-					objects[j].velocity.y = -objects[j].velocity.y;
-				}
-
-
-				// update bounding box
-				//glm::vec3 scale = glm::vec3(mScale * mesh_data.mScaleFactor);
-				glm::vec3 scale = glm::vec3(1.f);
-				objects[i].aabb.update(objects[i].currPos, scale);
-				objects[j].aabb.update(objects[j].currPos, scale);
-
-			}
-			else
-			{
-				// set the uniform collision status
-				objects[i].collisionStatus = objects[i].collisionStatus == 1 ? 1 : 0;
-				objects[j].collisionStatus = objects[j].collisionStatus == 1 ? 1 : 0;
-			}
-		}
-	}
-
-
-}
-
-void updatePosition(glm::vec3& curr_pos, glm::vec3& prev_pos, glm::vec3& curr_velocity)
-{
-	// bounding detection
-	if (curr_pos.x < -100.0 || curr_pos.x > 100.0)
-	{
-		if (curr_pos.x < -100.0)
-			curr_pos.x = -100.0;
-		else
-			curr_pos.x = 100.0;
-
-		curr_velocity.x = -curr_velocity.x;
-	}
-
-	if (curr_pos.y < -100.0 || curr_pos.y > 100.0)
-	{
-		if (curr_pos.y < -100.0)
-			curr_pos.y = -100.0;
-		else
-			curr_pos.y = 100.0;
-
-		curr_velocity.y = -curr_velocity.y;
-	}
-
-	/*if (curr_pos.z < -15.0 || curr_pos.z > 15.0)
-	{
-		if (curr_pos.z < -15.0)
-			curr_pos.z = -15.0;
-		else
-			curr_pos.z = 15.0;
-
-		curr_velocity.z = -curr_velocity.z;
-	}*/
-
-	prev_pos = glm::vec3(curr_pos.x, curr_pos.y, curr_pos.z);
-	curr_pos += curr_velocity * delta_time;
-
-}
-
-void updatePositions()
-{
-	for (int i = 0; i < INSTANCE_NUM; i++)
-	{
-		updatePosition(objects[i].currPos, objects[i].prevPos, objects[i].velocity);
-
-		// update bounding box
-		glm::vec3 deltaPos = objects[i].currPos - objects[i].prevPos;
-		//glm::vec3 scale = glm::vec3(mScale * mesh_data.mScaleFactor);
-		glm::vec3 scale = glm::vec3(1.f);
-		objects[i].aabb.update(objects[i].currPos, scale);
-
-		// reset the collision status
-		objects[i].collisionStatus = 0;
-	}
-}
-
 void updateBoundingBox()
 {
-	for (int i = 0; i < INSTANCE_NUM; i++)
-	{
-		// update the aabb box vertex data
-		//AABB aabb(mesh_data.mBbMin.x, mesh_data.mBbMin.y, mesh_data.mBbMin.z, mesh_data.mBbMax.x, mesh_data.mBbMax.y, mesh_data.mBbMax.z);
-		vector<glm::vec3> vertices = BVH::generateAABBvertices(objects[i].aabb);
-
-		// update aabb vbo
-		glBindBuffer(GL_ARRAY_BUFFER, aabbVBOs[i]);
-		glBufferSubData(GL_ARRAY_BUFFER, 0, 24 * sizeof(glm::vec3), vertices.data());
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
-	}
-
-	delete bvh;
-	bvh = new BVH(objects);
+	// one instance buffer upload per overlay, only for the ones shown
+	if (enableAABB)
+		bvhRenderer.updateAgents(agents);
+	if (enableBVH)
+		bvhRenderer.update(simulation.bvh);
 }
 
 //For an explanation of this program's structure see https://www.glfw.org/docs/3.3/quick.html 
@@ -353,10 +253,77 @@ void draw_gui(GLFWwindow* window)
 	ImGui::SliderFloat3("Cam Pos", camPos, -400.f, 400.f);
 	//ImGui::SliderFloat("Scale", &mScale, -1.0f, +1.0f);
 
+	ImGui::SliderFloat("Tick Rate", &tick_rate, 10.f, 240.f);
+	ImGui::SliderInt("Max Substeps", &max_substeps, 1, 16);
+
+	if (renderingOrCollision && gpuSimulation.isReady()) {
+		ImGui::Checkbox("GPU Simulation", &enableGpuSimulation);
+	}
+	ImGui::RadioButton("No Culling", &cullingMode, CULLING_OFF);
+	if (gpuCulling.isReady()) {
+		ImGui::SameLine();
+		ImGui::RadioButton("GPU Culling", &cullingMode, CULLING_GPU);
+	}
+	if (!renderingOrCollision) {
+		ImGui::SameLine();
+		ImGui::RadioButton("CPU BVH Culling", &cullingMode, CULLING_CPU_BVH);
+		if (cullingMode == CULLING_CPU_BVH) {
+			ImGui::Text("Visible %d / %d", cpuCulling.getVisibleCount(), INSTANCE_NUM);
+			ImGui::Text("LODs %d %d %d %d", cpuCulling.getLodCount(0), cpuCulling.getLodCount(1), cpuCulling.getLodCount(2), cpuCulling.getLodCount(3));
+		}
+	}
+	if (cullingMode != CULLING_OFF) {
+		ImGui::SliderFloat3("LOD Screen Sizes", mesh_data.m_LodScreenSizes, 0.0f, 0.25f);
+	}
+	if (cullingMode == CULLING_GPU && impostorAtlas.isReady()) {
+		ImGui::Checkbox("Impostors", &enableImpostors);
+		if (enableImpostors) {
+			ImGui::SliderFloat("Impostor Distance", &impostorDistance, 10.f, 2000.f);
+			ImGui::SliderFloat("Impostor Fade", &impostorFadeWidth, 1.f, 200.f);
+		}
+	}
+
 	if (!renderingOrCollision) {
-		ImGui::Checkbox("AABB", &enableAABB);
+		if (ImGui::Checkbox("AABB", &enableAABB))
+			updateBoundingBox();
 		ImGui::Checkbox("Dynamic", &enableDynamic);
-		ImGui::Checkbox("BVH", &enableBVH); ImGui::SameLine();
+		ImGui::RadioButton("Spatial Hash", &simulation.broadPhaseType, SPATIAL_HASH); ImGui::SameLine();
+		ImGui::RadioButton("Sweep And Prune", &simulation.broadPhaseType, SWEEP_AND_PRUNE); ImGui::SameLine();
+		ImGui::RadioButton("BVH Pairs", &simulation.broadPhaseType, BVH_SELF_COLLISION);
+		ImGui::Checkbox("Continuous Collision", &simulation.continuousCollision);
+		if (ImGui::SliderInt("Threads", &threadCount, 1, std::thread::hardware_concurrency()))
+		{
+			simulation.threadPool.resize(threadCount);
+		}
+		ImGui::Text("Contacts %d (+%d, -%d)", simulation.contacts.getContactCount(), contactBegins, contactEnds);
+		ImGui::RadioButton("Insertion BVH", &simulation.bvhBuildType, BVH_INSERTION); ImGui::SameLine();
+		ImGui::RadioButton("Binned SAH BVH", &simulation.bvhBuildType, BVH_BINNED_SAH); ImGui::SameLine();
+		ImGui::RadioButton("LBVH", &simulation.bvhBuildType, BVH_LBVH); ImGui::SameLine();
+		ImGui::RadioButton("Dynamic Tree", &simulation.bvhBuildType, BVH_DYNAMIC);
+		ImGui::Checkbox("Refit BVH", &simulation.refitBVH); ImGui::SameLine();
+		ImGui::SliderFloat("Rebuild At SAH x", &simulation.bvhRebuildThreshold, 1.0f, 3.0f);
+		ImGui::SliderInt("Rotate Every N Refits", &simulation.bvhRotateInterval, 0, 64);
+		static bool bvhMetrics = false;
+		if (ImGui::Checkbox("BVH Metrics", &bvhMetrics))
+		{
+			// sampled every tick, the json log next to the executable
+			simulation.bvhMetricsSamples = bvhMetrics ? 1024 : 0;
+			if (bvhMetrics)
+				simulation.bvhProfiler.openLog("bvh_metrics.jsonl");
+			else
+				simulation.bvhProfiler.closeLog();
+		}
+		if (bvhMetrics)
+		{
+			const BVHMetrics& metrics = simulation.bvhProfiler.getMetrics();
+			double queries = std::max(metrics.queries.queries, 1LL);
+			ImGui::Text("SAH %.2f (build %.2f), depth %d, overlap %.3f", metrics.sahCost, metrics.buildSAHCost, metrics.maxDepth, metrics.leafOverlapRatio);
+			ImGui::Text("%d nodes, %d KB, build %.2f ms, refit %.2f ms", metrics.nodeCount, (int)((metrics.nodeBytes + metrics.flatBytes + metrics.wideBytes) / 1024), metrics.buildTime, metrics.refitTime);
+			ImGui::Text("%.1f nodes, %.1f box tests per query", metrics.queries.nodesVisited / queries, metrics.queries.boxTests / queries);
+		}
+		if (ImGui::Checkbox("BVH", &enableBVH))
+			updateBoundingBox();
+		ImGui::SameLine();
 		ImGui::Checkbox("Show In Layer", &isShowLayer);
 		if (isShowLayer)
 		{
@@ -389,6 +356,27 @@ void draw_gui(GLFWwindow* window)
 	ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 }
 
+// the first instanceCount instances of the model matrix buffer
+void renderCrowd(int instanceCount)
+{
+	if (cullingMode == CULLING_GPU && gpuCulling.isReady()) {
+		// the mesh shader fades out where the impostors fade in
+		bool impostors = enableImpostors && impostorAtlas.isReady();
+		gpuCulling.impostorDistance = impostors ? impostorDistance : FLT_MAX;
+		gpuCulling.impostorFadeWidth = impostorFadeWidth;
+		glUniform1f(UniformLoc::ImpostorDistance, gpuCulling.impostorDistance);
+		glUniform1f(UniformLoc::ImpostorFadeWidth, impostorFadeWidth);
+
+		gpuCulling.cull(*camera, mesh_data, instanceCount);
+		gpuCulling.draw(mesh_data);
+		// idle() has moved currentFrame past the frame number of the mesh
+		gpuCulling.drawImpostors(impostorAtlas, currentFrame - 1);
+	}
+	else {
+		mesh_data.RenderInstanced(instanceCount);
+	}
+}
+
 // This function gets called every time the scene gets redisplayed
 void display(GLFWwindow* window)
 {
@@ -402,13 +390,22 @@ void display(GLFWwindow* window)
 	//Set uniforms
 	glUniform1i(UniformLoc::AnimTexHeight, height);
 	glUniform1i(UniformLoc::AnimTexWidth, width);
+	glUniform1f(UniformLoc::ImpostorDistance, FLT_MAX);
 
 	// update instance model attribute
 	
-	if (!renderingOrCollision) {
+	if (!renderingOrCollision && cullingMode == CULLING_CPU_BVH) {
+		// only the visible agents are interpolated and uploaded
+		cpuCulling.cull(*camera, mesh_data, simulation.bvh, agents, render_alpha, simulation.threadPool);
+
+		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+		cpuCulling.draw(mesh_data);
+	}
+	else if (!renderingOrCollision) {
 		for (int i = 0; i < INSTANCE_NUM; i++)
 		{
-			glm::mat4 trans = glm::translate(glm::mat4(1.f), objects[i].currPos);
+			glm::vec3 pos = glm::mix(agents[i].prevPos(), agents[i].currPos(), render_alpha);
+			glm::mat4 trans = glm::translate(glm::mat4(1.f), pos);
 			model_matrix_data[i] = trans;
 		}
 
@@ -418,15 +415,18 @@ void display(GLFWwindow* window)
 		glBindBuffer(GL_ARRAY_BUFFER, 0);
 
 		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-		mesh_data.RenderInstanced(INSTANCE_NUM);
+		renderCrowd(INSTANCE_NUM);
 	}
 	else {
-		glBindBuffer(GL_ARRAY_BUFFER, model_matrix_buffer);
-		glBufferSubData(GL_ARRAY_BUFFER, 0, 300000 * sizeof(glm::mat4), model_matrix_data_rendering.data());
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		// the gpu simulation writes the model matrices itself
+		if (!enableGpuSimulation) {
+			glBindBuffer(GL_ARRAY_BUFFER, model_matrix_buffer);
+			glBufferSubData(GL_ARRAY_BUFFER, 0, INSTANCE_NUM * sizeof(glm::mat4), model_matrix_data_rendering.data());
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+		}
 
 		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-		mesh_data.RenderInstanced(300000);
+		renderCrowd(INSTANCE_NUM);
 	}
 
 
@@ -439,23 +439,16 @@ void display(GLFWwindow* window)
 		// draw bounding box
 		if (enableAABB)
 		{
-			for (int i = 0; i < INSTANCE_NUM; i++)
-			{
-				glBindVertexArray(aabbVAOs[i]);
-				glUniform1i(collisionTypeLoc, objects[i].collisionStatus);
-				glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-				glDrawArrays(GL_QUADS, 0, 24);
-				glBindVertexArray(0);
-			}
+			bvhRenderer.drawAgents(collisionTypeLoc);
 		}
 
 		// draw bvh
 		if (enableBVH)
 		{
 			if (isShowLayer)
-				bvh->drawBVHInLayer(layer);
+				bvhRenderer.drawInLayer(layer);
 			else
-				bvh->drawBVH();
+				bvhRenderer.draw();
 		}
 
 	}
@@ -512,16 +505,54 @@ void idle()
 		cout << "Current Frame " << currentFrame << endl;
 	}
 
-	if (enableDynamic)
+	bool gpuSimulating = renderingOrCollision && enableGpuSimulation;
+	if (!enableDynamic && !gpuSimulating)
 	{
-		// update position
-		updatePositions();
+		// paused, show the last tick as it is
+		tick_accumulator = 0.f;
+		render_alpha = 1.f;
+		return;
+	}
+
+	// a slow frame runs at most max_substeps ticks and drops the rest instead of taking a bigger step
+	tick_time = 1.f / tick_rate;
+	tick_accumulator = glm::min(tick_accumulator + delta_time, max_substeps * tick_time);
 
-		// collision detection
-		collisionDetection();
+	int ticks = 0;
+	while (tick_accumulator >= tick_time)
+	{
+		if (enableDynamic)
+		{
+			// move, collide and rebuild the bvh
+			simulation.tick(tick_time);
+		}
 
+		if (gpuSimulating)
+		{
+			gpuSimulation.step(tick_time);
+		}
+
+		tick_accumulator -= tick_time;
+		ticks++;
+	}
+	render_alpha = tick_accumulator / tick_time;
+
+	if (enableDynamic && ticks > 0)
+	{
 		// update bounding box
 		updateBoundingBox();
+
+		// consumer side of the contact events, only the changes of this frame
+		contactBegins = 0;
+		contactEnds = 0;
+		ContactEvent event;
+		while (simulation.contacts.events.pop(event))
+		{
+			if (event.type == CONTACT_BEGIN)
+				contactBegins++;
+			else if (event.type == CONTACT_END)
+				contactEnds++;
+		}
 	}
 }
 
@@ -577,6 +608,18 @@ void reload_shader()
 		bounding_shader_program = bounding_new_shader;
 	}
 
+	if (gpuSimulation.getAgentCount() > 0)
+	{
+		gpuSimulation.reloadShaders();
+	}
+	if (gpuCulling.isReady())
+	{
+		gpuCulling.reloadShaders();
+	}
+	if (impostorAtlas.isReady())
+	{
+		impostorAtlas.reloadShaders();
+	}
 }
 
 //This function gets called when a key is pressed
@@ -630,54 +673,40 @@ void initCamera()
 
 void initBVH()
 {
-	bvh = new BVH(objects);
-	//bvh->traverseBVH(bvh->getRootIndex());
+	updateBoundingBox();
+	//simulation.bvh.traverseBVH(simulation.bvh.getRootIndex());
 }
 
 void processSceneData()
 {
+	// the same grid as the rendering mode, the walls grow with the crowd so nobody spawns outside them
 	int rows = (int)std::sqrt(INSTANCE_NUM);
-
-	for (int i = 0; i < INSTANCE_NUM; i++)
-	{
-		// set up translate position
-		glm::vec3 _position = glm::vec3(((i % rows) - 1) * 10, ((i / rows) - 1) * 10, 0);
-		
-		// set up translate velocity
-		glm::vec3 _velocity = glm::vec3(random(5.5, 10.0), random(-5.5, 5.5), 0.0);
-
-		// update aabb
-		//glm::vec3 scale = glm::vec3(mScale * mesh_data.mScaleFactor);
-		glm::vec3 scale = glm::vec3(1.f);
-		AABB aabb(
-			mesh_data.m_Entries[0].mBbMin.x,
-			mesh_data.m_Entries[0].mBbMin.y,
-			mesh_data.m_Entries[0].mBbMin.z,
-			mesh_data.m_Entries[0].mBbMax.x,
-			mesh_data.m_Entries[0].mBbMax.y,
-			mesh_data.m_Entries[0].mBbMax.z
-		);
-
-		aabb.update(_position, scale);
-
-		SceneObject sceneObject(i, _position, glm::vec3(0, 0, 0), _velocity, aabb);
-		/*std::cout << sceneObject.pos.x << ", " << sceneObject.pos.y << std::endl;
-		std::cout << sceneObject.aabb.maxX << ", " << sceneObject.aabb.minX << std::endl;*/
-
-		objects.push_back(sceneObject);
-	}
+	simulation.arenaMax = std::max(simulation.arenaMax, rows * 10.0f + 10.0f);
+
+	// only on request, a miss writes tens of mb into the working directory
+	simulation.bvhSnapshotPath = bvhSnapshotPath;
+
+	// every agent shares the rest box of the mesh
+	simulation.spawn(INSTANCE_NUM, rows, AABB(
+		mesh_data.m_Entries[0].mBbMin.x,
+		mesh_data.m_Entries[0].mBbMin.y,
+		mesh_data.m_Entries[0].mBbMin.z,
+		mesh_data.m_Entries[0].mBbMax.x,
+		mesh_data.m_Entries[0].mBbMax.y,
+		mesh_data.m_Entries[0].mBbMax.z
+	));
 }
 
 GLuint create_model_matrix_buffer(vector<glm::mat4> * matrix_data, int instanceCount, bool useObjectPos = true, bool createBuffer = true)
 {
-	int rows = (int)std::sqrt(300000);
+	int rows = (int)std::sqrt(INSTANCE_NUM);
 
 	for (int i = 0; i < instanceCount; i++)
 	{	
 		glm::vec3 tran;
 		if (useObjectPos) 
 		{
-			tran = objects[i].currPos;
+			tran = agents[i].currPos();
 		}
 		else
 		{
@@ -698,6 +727,29 @@ GLuint create_model_matrix_buffer(vector<glm::mat4> * matrix_data, int instanceC
 	return model_matrix_buffer;
 }
 
+void initGpuSimulation()
+{
+	// same start layout as the rendering instances, the arena is the area they cover
+	int count = model_matrix_data_rendering.size();
+	vector<glm::vec3> positions(count);
+	vector<glm::vec3> velocities(count);
+	glm::vec2 arenaMin(FLT_MAX);
+	glm::vec2 arenaMax(-FLT_MAX);
+
+	for (int i = 0; i < count; i++)
+	{
+		positions[i] = glm::vec3(model_matrix_data_rendering[i][3]);
+		velocities[i] = glm::vec3(simulation.random(5.5, 10.0), simulation.random(-5.5, 5.5), 0.0);
+		arenaMin = glm::min(arenaMin, glm::vec2(positions[i]));
+		arenaMax = glm::max(arenaMax, glm::vec2(positions[i]));
+	}
+
+	if (!gpuSimulation.init(positions, velocities, agents.restAABB, arenaMin, arenaMax, model_matrix_buffer))
+	{
+		std::cout << "GPU simulation unavailable" << std::endl;
+	}
+}
+
 //Initialize OpenGL state. This function only gets called once.
 void initOpenGL()
 {
@@ -727,9 +779,9 @@ void initOpenGL()
 	glGenVertexArrays(1, &attribless_arena_vao);
 
 	// init instance model matrix attribute
-	model_matrix_buffer = create_model_matrix_buffer(&model_matrix_data, 300000, false);
+	model_matrix_buffer = create_model_matrix_buffer(&model_matrix_data, INSTANCE_NUM, false);
 	//model_matrix_buffer_rendering = 
-	create_model_matrix_buffer(&model_matrix_data_rendering, 300000, false, false);
+	create_model_matrix_buffer(&model_matrix_data_rendering, INSTANCE_NUM, false, false);
 	// create instanced vertex attributes
 	glBindVertexArray(mesh_data.m_VAO);
 	glBindBuffer(GL_ARRAY_BUFFER, model_matrix_buffer);
@@ -743,18 +795,21 @@ void initOpenGL()
 		glEnableVertexAttribArray(AttribLoc::matPosInstance + i);
 		glVertexAttribDivisor(AttribLoc::matPosInstance + i, 1);
 	}
+	glBindVertexArray(0);
 
-	// init aabb box
-	glGenVertexArrays(INSTANCE_NUM, aabbVAOs);
-	for (int i = 0; i < INSTANCE_NUM; i++)
+	if (!gpuCulling.init(mesh_data, model_matrix_buffer, INSTANCE_NUM))
 	{
-		glBindVertexArray(aabbVAOs[i]);
-		aabbVBOs[i] = BVH::createAABBVbo(objects[i].aabb);
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
-		glBindVertexArray(0);
+		// compute shaders missing or failing, the agent bvh culls on the cpu instead
+		std::cout << "GPU culling unavailable" << std::endl;
+		cullingMode = CULLING_CPU_BVH;
 	}
-	
+	cpuCulling.init(INSTANCE_NUM);
+	// the tree boxes are rest pose boxes at the tick position, the animation and the interpolation reach past them
+	cpuCulling.margin = 0.25f * std::max(agents.restAABB.maxX_0 - agents.restAABB.minX_0,
+		std::max(agents.restAABB.maxY_0 - agents.restAABB.minY_0, agents.restAABB.maxZ_0 - agents.restAABB.minZ_0));
+
+	initGpuSimulation();
+
 
 	glGenBuffers(1, &light_ubo);
 	glBindBuffer(GL_UNIFORM_BUFFER, light_ubo);
@@ -767,6 +822,12 @@ void initOpenGL()
 	glBindBufferBase(GL_UNIFORM_BUFFER, UboBinding::material, material_ubo); //Associate this uniform buffer with the uniform block in the shader that has the same binding.
 
 	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	// the bake lights the mesh like the scene, so it goes after the light and material blocks
+	if (gpuCulling.isReady() && !impostorAtlas.bake(mesh_data, shader_program, width, height))
+	{
+		std::cout << "Impostors unavailable" << std::endl;
+	}
 }
 
 //C++ programs start executing in the main() function.
@@ -774,6 +835,13 @@ int main(int argc, char** argv)
 {
 	GLFWwindow* window;
 
+	// the spawn tree is mapped from this file on the next start instead of built
+	for (int a = 1; a + 1 < argc; a++)
+	{
+		if (string(argv[a]) == "-bvhsnapshot")
+			bvhSnapshotPath = argv[++a];
+	}
+
 	/* Initialize the library */
 	if (!glfwInit())
 	{
@@ -824,6 +892,10 @@ int main(int argc, char** argv)
 	ImGui_ImplGlfw_Shutdown();
 	ImGui::DestroyContext();
 
+	bvhRenderer.release();
+	gpuCulling.release();
+	cpuCulling.release();
+	impostorAtlas.release();
 	glfwTerminate();
 	return 0;
 }
\ No newline at end of file
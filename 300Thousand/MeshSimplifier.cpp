@@ -0,0 +1,402 @@
+#include "MeshSimplifier.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
+static const unsigned int NO_VERTEX = 0xFFFFFFFFu;
+
+MeshSimplifier::MeshSimplifier()
+	: maxError(0.1f), boneWeight(0.25f), boneIds(nullptr), boneWeights(nullptr), error(0.0f)
+{
+}
+
+int MeshSimplifier::simplify(const vec3* positions, const unsigned char* boneIds, const float* boneWeights, int vertexCount,
+	const unsigned int* indices, int indexCount, int targetIndexCount, vector<unsigned int>& out)
+{
+	this->boneIds = boneIds;
+	this->boneWeights = boneWeights;
+	error = 0.0f;
+	out.assign(indices, indices + indexCount);
+	if (indexCount <= targetIndexCount || vertexCount == 0)
+		return out.size();
+
+	// unit box, the error limit does not depend on the units of the mesh
+	vec3 boundsMin(FLT_MAX);
+	vec3 boundsMax(-FLT_MAX);
+	for (int i = 0; i < indexCount; i++)
+	{
+		boundsMin = glm::min(boundsMin, positions[indices[i]]);
+		boundsMax = glm::max(boundsMax, positions[indices[i]]);
+	}
+	float diagonal = length(boundsMax - boundsMin);
+	float scale = diagonal > 0.0f ? 1.0f / diagonal : 1.0f;
+	points.resize(vertexCount);
+	for (int v = 0; v < vertexCount; v++)
+		points[v] = (positions[v] - boundsMin) * scale;
+
+	// position groups, exact matches like the importer writes them on a seam
+	struct PositionHash
+	{
+		size_t operator()(const vec3& p) const
+		{
+			unsigned int bits[3];
+			memcpy(bits, &p[0], sizeof(bits));
+			return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+		}
+	};
+	unordered_map<vec3, unsigned int, PositionHash> firstAt;
+	positionRep.resize(vertexCount);
+	wedge.resize(vertexCount);
+	for (int v = 0; v < vertexCount; v++)
+	{
+		auto inserted = firstAt.insert(make_pair(positions[v], (unsigned int)v));
+		unsigned int first = inserted.first->second;
+		positionRep[v] = first;
+		wedge[v] = v;
+		if (first != (unsigned int)v)
+		{
+			wedge[v] = wedge[first];
+			wedge[first] = v;
+		}
+	}
+
+	classifyVertices(indices, indexCount);
+
+	Quadric zero = Quadric();
+	quadrics.assign(vertexCount, zero);
+	for (int t = 0; t + 2 < indexCount; t += 3)
+	{
+		const vec3& p0 = points[indices[t]];
+		vec3 normal = cross(points[indices[t + 1]] - p0, points[indices[t + 2]] - p0);
+		float area2 = length(normal);
+		if (area2 == 0.0f)
+			continue;
+		normal /= area2;
+		double w = area2 * 0.5;
+		double d = -dot(normal, p0);
+		Quadric q;
+		q.a00 = w * normal.x * normal.x; q.a11 = w * normal.y * normal.y; q.a22 = w * normal.z * normal.z;
+		q.a10 = w * normal.y * normal.x; q.a20 = w * normal.z * normal.x; q.a21 = w * normal.z * normal.y;
+		q.b0 = w * d * normal.x; q.b1 = w * d * normal.y; q.b2 = w * d * normal.z;
+		q.c = w * d * d;
+		q.weight = w;
+		for (int k = 0; k < 3; k++)
+		{
+			Quadric& r = quadrics[positionRep[indices[t + k]]];
+			r.a00 += q.a00; r.a11 += q.a11; r.a22 += q.a22;
+			r.a10 += q.a10; r.a20 += q.a20; r.a21 += q.a21;
+			r.b0 += q.b0; r.b1 += q.b1; r.b2 += q.b2;
+			r.c += q.c;
+			r.weight += q.weight;
+		}
+	}
+
+	remap.resize(vertexCount);
+	collapseLocked.resize(vertexCount);
+	float errorLimit = maxError * maxError;
+	vector<pair<unsigned int, unsigned int>> merged;
+
+	// passes of the cheapest independent collapses, the adjacency is rebuilt between passes
+	while ((int)out.size() > targetIndexCount)
+	{
+		buildAdjacency(out);
+
+		collapses.clear();
+		for (int t = 0; t < (int)out.size(); t += 3)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				unsigned int a = out[t + k];
+				unsigned int b = out[t + (k + 1) % 3];
+				if (canCollapse(a, b))
+					collapses.push_back({ a, b, collapseCost(a, b) });
+				if (canCollapse(b, a))
+					collapses.push_back({ b, a, collapseCost(b, a) });
+			}
+		}
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse& x, const Collapse& y)
+			{
+				return x.cost < y.cost || (x.cost == y.cost && (x.from < y.from || (x.from == y.from && x.to < y.to)));
+			});
+
+		for (int v = 0; v < vertexCount; v++)
+			remap[v] = v;
+		std::fill(collapseLocked.begin(), collapseLocked.end(), 0);
+		merged.clear();
+
+		// a collapse takes two triangles, stop the pass once enough are gone
+		int trianglesToRemove = (out.size() - targetIndexCount + 2) / 3;
+		int removed = 0;
+		for (const Collapse& c : collapses)
+		{
+			if (c.cost > errorLimit || removed >= trianglesToRemove)
+				break;
+			if (collapseLocked[c.from] || collapseLocked[c.to])
+				continue;
+
+			// a seam vertex takes its twin along, onto the twin of the target on the other side
+			unsigned int twinFrom = NO_VERTEX;
+			unsigned int twinTo = NO_VERTEX;
+			if (kind[c.from] == VERTEX_SEAM)
+			{
+				twinFrom = wedge[c.from];
+				twinTo = c.to == openNext[c.from] ? openPrev[twinFrom] : openNext[twinFrom];
+				if (collapseLocked[twinFrom] || collapseLocked[twinTo])
+					continue;
+			}
+
+			if (flips(c.from, c.to, out) || (twinFrom != NO_VERTEX && flips(twinFrom, twinTo, out)))
+				continue;
+
+			remap[c.from] = c.to;
+			collapseLocked[c.from] = collapseLocked[c.to] = 1;
+			if (twinFrom != NO_VERTEX)
+			{
+				remap[twinFrom] = twinTo;
+				collapseLocked[twinFrom] = collapseLocked[twinTo] = 1;
+				unlinkSeam(c.from, c.to);
+				unlinkSeam(twinFrom, twinTo);
+			}
+			merged.push_back(make_pair(c.from, c.to));
+			error = std::max(error, c.cost);
+			removed += 2;
+		}
+
+		if (merged.empty())
+			break;
+
+		for (const pair<unsigned int, unsigned int>& m : merged)
+		{
+			Quadric& r = quadrics[positionRep[m.second]];
+			const Quadric& q = quadrics[positionRep[m.first]];
+			r.a00 += q.a00; r.a11 += q.a11; r.a22 += q.a22;
+			r.a10 += q.a10; r.a20 += q.a20; r.a21 += q.a21;
+			r.b0 += q.b0; r.b1 += q.b1; r.b2 += q.b2;
+			r.c += q.c;
+			r.weight += q.weight;
+		}
+
+		// remap and drop the triangles that lost a corner
+		int write = 0;
+		for (int t = 0; t < (int)out.size(); t += 3)
+		{
+			unsigned int a = remap[out[t]];
+			unsigned int b = remap[out[t + 1]];
+			unsigned int c = remap[out[t + 2]];
+			if (a == b || b == c || c == a)
+				continue;
+			out[write++] = a;
+			out[write++] = b;
+			out[write++] = c;
+		}
+		out.resize(write);
+	}
+
+	error = std::sqrt(error);
+	return out.size();
+}
+
+float MeshSimplifier::getError() const
+{
+	return error;
+}
+
+void MeshSimplifier::classifyVertices(const unsigned int* indices, int indexCount)
+{
+	int vertexCount = points.size();
+	buildAdjacency(vector<unsigned int>(indices, indices + indexCount));
+
+	// an edge is open when no triangle runs it the other way, a seam is open on both of its sides
+	vector<int> openOut(vertexCount, 0);
+	vector<int> openIn(vertexCount, 0);
+	vector<unsigned char> used(vertexCount, 0);
+	openNext.assign(vertexCount, NO_VERTEX);
+	openPrev.assign(vertexCount, NO_VERTEX);
+	for (int t = 0; t + 2 < indexCount; t += 3)
+	{
+		for (int k = 0; k < 3; k++)
+		{
+			unsigned int a = indices[t + k];
+			unsigned int b = indices[t + (k + 1) % 3];
+			used[a] = 1;
+			if (!hasEdge(b, a, indices))
+			{
+				openOut[a]++;
+				openIn[b]++;
+				openNext[a] = b;
+				openPrev[b] = a;
+			}
+		}
+	}
+
+	kind.assign(vertexCount, VERTEX_LOCKED);
+	for (int v = 0; v < vertexCount; v++)
+	{
+		if (!used[v])
+			continue;
+		bool single = wedge[v] == (unsigned int)v;
+		bool pair = !single && wedge[wedge[v]] == (unsigned int)v;
+		if (single && openOut[v] == 0 && openIn[v] == 0)
+			kind[v] = VERTEX_MANIFOLD;
+		else if (pair && openOut[v] == 1 && openIn[v] == 1)
+			kind[v] = VERTEX_SEAM;
+	}
+
+	// both sides of the seam have to agree, the open edges of the twin run the other way
+	for (int v = 0; v < vertexCount; v++)
+	{
+		if (kind[v] != VERTEX_SEAM)
+			continue;
+		unsigned int twin = wedge[v];
+		if (openPrev[twin] == NO_VERTEX || openNext[twin] == NO_VERTEX ||
+			positionRep[openPrev[twin]] != positionRep[openNext[v]] || positionRep[openNext[twin]] != positionRep[openPrev[v]])
+			kind[v] = VERTEX_LOCKED;
+	}
+	for (int v = 0; v < vertexCount; v++)
+	{
+		if (kind[v] == VERTEX_SEAM && kind[wedge[v]] != VERTEX_SEAM)
+			kind[v] = VERTEX_LOCKED;
+	}
+}
+
+void MeshSimplifier::unlinkSeam(unsigned int from, unsigned int to)
+{
+	// the open edge from -> to is gone, its other neighbour now runs to the target directly
+	if (to == openNext[from])
+	{
+		unsigned int prev = openPrev[from];
+		if (prev != NO_VERTEX)
+			openNext[prev] = to;
+		openPrev[to] = prev;
+	}
+	else
+	{
+		unsigned int next = openNext[from];
+		if (next != NO_VERTEX)
+			openPrev[next] = to;
+		openNext[to] = next;
+	}
+	openNext[from] = openPrev[from] = NO_VERTEX;
+}
+
+void MeshSimplifier::buildAdjacency(const vector<unsigned int>& indices)
+{
+	int vertexCount = points.size();
+	triangleOffsets.assign(vertexCount + 1, 0);
+	for (unsigned int v : indices)
+		triangleOffsets[v + 1]++;
+	for (int v = 0; v < vertexCount; v++)
+		triangleOffsets[v + 1] += triangleOffsets[v];
+
+	triangleList.resize(indices.size());
+	vector<unsigned int> cursor(triangleOffsets.begin(), triangleOffsets.end() - 1);
+	for (int i = 0; i < (int)indices.size(); i++)
+		triangleList[cursor[indices[i]]++] = i / 3;
+}
+
+bool MeshSimplifier::canCollapse(unsigned int from, unsigned int to) const
+{
+	if (positionRep[from] == positionRep[to] || kind[from] == VERTEX_LOCKED)
+		return false;
+	if (kind[from] == VERTEX_MANIFOLD)
+		return true;
+
+	// seam vertices move along the seam only, and the other side has to have the matching edge
+	if (to != openNext[from] && to != openPrev[from])
+		return false;
+	unsigned int twinFrom = wedge[from];
+	unsigned int twinTo = to == openNext[from] ? openPrev[twinFrom] : openNext[twinFrom];
+	return twinTo != NO_VERTEX && positionRep[twinTo] == positionRep[to];
+}
+
+float MeshSimplifier::collapseCost(unsigned int from, unsigned int to) const
+{
+	const Quadric& q0 = quadrics[positionRep[from]];
+	const Quadric& q1 = quadrics[positionRep[to]];
+	const vec3& p = points[to];
+	double x = p.x, y = p.y, z = p.z;
+	double planes =
+		(q0.a00 + q1.a00) * x * x + (q0.a11 + q1.a11) * y * y + (q0.a22 + q1.a22) * z * z +
+		2.0 * ((q0.a10 + q1.a10) * x * y + (q0.a20 + q1.a20) * x * z + (q0.a21 + q1.a21) * y * z) +
+		2.0 * ((q0.b0 + q1.b0) * x + (q0.b1 + q1.b1) * y + (q0.b2 + q1.b2) * z) +
+		(q0.c + q1.c);
+	double weight = q0.weight + q1.weight;
+	float cost = weight > 0.0 ? (float)std::max(planes / weight, 0.0) : 0.0f;
+
+	vec3 edge = points[to] - points[from];
+	return cost + boneWeight * boneDistance(from, to) * dot(edge, edge);
+}
+
+bool MeshSimplifier::flips(unsigned int from, unsigned int to, const vector<unsigned int>& indices) const
+{
+	// corners already moved in this pass count at their new place
+	const vec3& target = points[to];
+	for (unsigned int k = triangleOffsets[from]; k < triangleOffsets[from + 1]; k++)
+	{
+		unsigned int t = triangleList[k] * 3;
+		unsigned int corners[3] = { remap[indices[t]], remap[indices[t + 1]], remap[indices[t + 2]] };
+		if (corners[0] == to || corners[1] == to || corners[2] == to)
+			continue;  // goes away
+
+		const vec3& a = points[corners[0]];
+		const vec3& b = points[corners[1]];
+		const vec3& c = points[corners[2]];
+		vec3 before = cross(b - a, c - a);
+		vec3 na = corners[0] == from ? target : a;
+		vec3 nb = corners[1] == from ? target : b;
+		vec3 nc = corners[2] == from ? target : c;
+		vec3 after = cross(nb - na, nc - na);
+		if (dot(before, after) <= 0.0f)
+			return true;
+	}
+	return false;
+}
+
+float MeshSimplifier::boneDistance(unsigned int a, unsigned int b) const
+{
+	if (boneIds == nullptr || boneWeights == nullptr)
+		return 0.0f;
+
+	// half the l1 distance of the two sparse weight vectors, 0 for the same skinning and 1 for disjoint bones
+	const unsigned char* idsA = boneIds + a * 4;
+	const unsigned char* idsB = boneIds + b * 4;
+	const float* weightsA = boneWeights + a * 4;
+	const float* weightsB = boneWeights + b * 4;
+	float distance = 0.0f;
+	for (int i = 0; i < 4; i++)
+	{
+		if (weightsA[i] == 0.0f)
+			continue;
+		float other = 0.0f;
+		for (int j = 0; j < 4; j++)
+			other += idsB[j] == idsA[i] ? weightsB[j] : 0.0f;
+		distance += std::abs(weightsA[i] - other);
+	}
+	for (int j = 0; j < 4; j++)
+	{
+		if (weightsB[j] == 0.0f)
+			continue;
+		bool shared = false;
+		for (int i = 0; i < 4; i++)
+			shared = shared || (idsA[i] == idsB[j] && weightsA[i] > 0.0f);
+		if (!shared)
+			distance += weightsB[j];
+	}
+	return distance * 0.5f;
+}
+
+bool MeshSimplifier::hasEdge(unsigned int from, unsigned int to, const unsigned int* indices) const
+{
+	for (unsigned int k = triangleOffsets[from]; k < triangleOffsets[from + 1]; k++)
+	{
+		unsigned int t = triangleList[k] * 3;
+		for (int c = 0; c < 3; c++)
+		{
+			if (indices[t + c] == from && indices[t + (c + 1) % 3] == to)
+				return true;
+		}
+	}
+	return false;
+}
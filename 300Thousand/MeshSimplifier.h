@@ -0,0 +1,77 @@
+#pragma once
+#include <vector>
+#include <glm/glm.hpp>
+
+using namespace std;
+using namespace glm;
+
+/*
+ quadric error edge collapse (garland / heckbert) for the lod chain of a skinned mesh. every collapse
+ moves one vertex onto a neighbour (a half edge collapse), so a lod keeps the positions, normals, uvs and
+ bone weights of the full mesh and needs nothing but its own indices. vertices that share a position (uv
+ and normal seams) only collapse along their seam and both sides at once, so no crack opens, the border
+ of an open mesh stays. the cost adds the bone weight difference of the two ends, scaled by the edge
+ length, so the mesh does not melt across joints before it loses flat detail.
+*/
+
+class MeshSimplifier
+{
+public:
+	MeshSimplifier();
+
+	// positions of vertexCount vertices, bone ids and weights 4 per vertex (both may be null), indices 3
+	// per triangle. writes the simplified indices (same vertices) to out and returns how many there are,
+	// down to targetIndexCount unless the next collapse would pass maxError or none is left
+	int simplify(const vec3* positions, const unsigned char* boneIds, const float* boneWeights, int vertexCount,
+		const unsigned int* indices, int indexCount, int targetIndexCount, vector<unsigned int>& out);
+	float getError() const;  // largest collapse of the last simplify, relative to the bounding box diagonal
+
+	float maxError;    // relative to the bounding box diagonal
+	float boneWeight;  // scales the bone weight term of the cost
+
+private:
+	enum VertexKind { VERTEX_MANIFOLD, VERTEX_SEAM, VERTEX_LOCKED };
+
+	// plane distance squared summed over the triangles around a position, area weighted
+	struct Quadric
+	{
+		double a00, a11, a22, a10, a20, a21;
+		double b0, b1, b2;
+		double c;
+		double weight;
+	};
+
+	struct Collapse
+	{
+		unsigned int from;
+		unsigned int to;
+		float cost;
+	};
+
+	void classifyVertices(const unsigned int* indices, int indexCount);
+	void buildAdjacency(const vector<unsigned int>& indices);
+	void unlinkSeam(unsigned int from, unsigned int to);  // a seam collapse, relinks the open edge chain around from
+	bool canCollapse(unsigned int from, unsigned int to) const;
+	float collapseCost(unsigned int from, unsigned int to) const;
+	bool flips(unsigned int from, unsigned int to, const vector<unsigned int>& indices) const;
+	float boneDistance(unsigned int a, unsigned int b) const;
+	bool hasEdge(unsigned int from, unsigned int to, const unsigned int* indices) const;  // some triangle runs from -> to
+
+	const unsigned char* boneIds;
+	const float* boneWeights;
+	float error;
+
+	vector<vec3> points;                // normalized to the unit box
+	vector<unsigned int> positionRep;   // first vertex with the same position
+	vector<unsigned int> wedge;         // next vertex with the same position, a ring
+	vector<unsigned char> kind;
+	vector<unsigned int> openNext;      // seam vertices: the end of their open edge, and its start
+	vector<unsigned int> openPrev;
+	vector<Quadric> quadrics;           // per position, at positionRep
+
+	vector<unsigned int> triangleOffsets;  // triangles around each vertex
+	vector<unsigned int> triangleList;
+	vector<unsigned int> remap;
+	vector<unsigned char> collapseLocked;
+	vector<Collapse> collapses;
+};
@@ -10,6 +10,12 @@ namespace UniformLoc
    const int AnimTexHeight = 6;
    const int AnimTexWidth = 7;
    const int AnimationIndex = 8;
+   const int ImpostorDistance = 10;   // meshes fade into impostors from here
+   const int ImpostorFadeWidth = 11;  // over this many world units
+   const int ImpostorGrid = 12;       // azimuths, elevations, frames of the atlas
+   const int ImpostorCenter = 13;
+   const int ImpostorHalfSize = 14;
+   const int ImpostorMaxElevation = 15;
    const int Bones = 20; //array of 100 bones
 };
 
@@ -21,4 +27,49 @@ namespace AttribLoc
    const int BoneIds = 3;
    const int BoneWeights = 4;
    const int matPosInstance = 8;
+   const int instanceIndex = 12;  // original index of a culled instance, keeps its animation phase
+};
+
+namespace ComputeUniformLoc
+{
+   const int AgentCount = 0;
+   const int DeltaTime = 1;
+   const int ArenaMin = 2;
+   const int ArenaMax = 3;
+   const int CellSize = 4;
+   const int TableMask = 5;
+   const int RestMin = 6;
+   const int RestMax = 7;
+   const int InstanceCount = 8;
+   const int FrustumPlanes = 9;   // array of 6 planes, 9 .. 14
+   const int BoundsCenter = 15;
+   const int BoundsExtent = 16;
+   const int CommandCount = 17;
+   const int LodCount = 18;
+   const int LodScreenSizes = 19;  // array of MAX_MESH_LODS - 1 thresholds, 19 .. 21
+   const int EyePosition = 22;
+   const int ProjectionScale = 23;
+   const int EntryCount = 24;
+   const int BoundsRadius = 25;
+   const int ImpostorDistance = 26;
+   const int ImpostorFadeWidth = 27;
+};
+
+namespace SsboBinding
+{
+   const int AgentsIn = 0;
+   const int AgentsOut = 1;
+   const int CellCount = 2;
+   const int CellStart = 3;
+   const int SortedAgents = 4;
+   const int AgentCell = 5;
+   const int ModelMatrices = 6;
+   const int CullInstances = 7;
+   const int VisibleMatrices = 8;
+   const int VisibleIndices = 9;
+   const int LodCounts = 10;
+   const int DrawCommands = 11;
+   const int InstanceLods = 12;
+   const int ImpostorInstances = 13;
+   const int ImpostorCommand = 14;
 };
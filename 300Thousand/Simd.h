@@ -0,0 +1,20 @@
+#pragma once
+
+/*
+ instruction set selection for the simd kernels.
+ SIMD_AVX2 is set when the compiler targets avx2 (/arch:AVX2 on msvc, -mavx2 on gcc/clang),
+ SIMD_SSE whenever sse2 is available (always on x64), otherwise the kernels fall back to scalar loops.
+*/
+
+#if defined(__AVX2__)
+#define SIMD_AVX2 1
+#include <immintrin.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SIMD_SSE 1
+#include <emmintrin.h>
+#endif
+
+// lanes of the widest path, agent arrays are padded to a multiple of this
+const int SIMD_WIDTH = 8;
@@ -0,0 +1,606 @@
+#include "Simulation.h"
+#include <chrono>
+#include <cfloat>
+#include <algorithm>
+
+typedef std::chrono::high_resolution_clock Clock;
+
+// time of impact of a pair that does not meet during the tick, impacts are fractions of the tick in [0, 1)
+static const float NO_IMPACT = 2.0f;
+
+static double elapsedMs(Clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+Simulation::Simulation(unsigned int seed)
+	: broadPhaseType(SPATIAL_HASH), enableBVH(true), bvhBuildType(BVH_BINNED_SAH), refitBVH(true), bvhRotateInterval(16), bvhRebuildThreshold(1.25f), bvhMetricsSamples(0), continuousCollision(true), arenaMin(-100.0f), arenaMax(100.0f), generator(seed), refitsSinceRotation(0)
+{
+}
+
+Simulation::~Simulation()
+{
+}
+
+float Simulation::random(float min, float max)
+{
+	std::uniform_real_distribution<float> distribution(min, max);
+	return min + distribution(generator);
+}
+
+void Simulation::spawn(int count, int rows, const AABB& restAABB)
+{
+	// every agent shares the rest box of the mesh
+	agents.clear();
+	agents.setRestAABB(restAABB);
+	contacts.clear();
+
+	for (int i = 0; i < count; i++)
+	{
+		// set up translate position
+		glm::vec3 _position = glm::vec3(((i % rows) - 1) * 10, ((i / rows) - 1) * 10, 0);
+
+		// set up translate velocity
+		glm::vec3 _velocity = glm::vec3(random(5.5, 10.0), random(-5.5, 5.5), 0.0);
+
+		// update aabb
+		glm::vec3 scale = glm::vec3(1.f);
+		AABB aabb = agents.restAABB;
+		aabb.update(_position, scale);
+
+		SceneObject sceneObject(i, _position, glm::vec3(0, 0, 0), _velocity, aabb);
+		agents.add(sceneObject);
+	}
+
+	// the old topology has nothing to do with the new crowd
+	bvh.clear();
+	if (!enableBVH)
+		return;
+
+	// the layout only depends on count, rows and the rest box, so the tree of the last start usually fits
+	bool useSnapshot = !bvhSnapshotPath.empty() && bvhBuildType != BVH_DYNAMIC;
+	unsigned long long sceneKey = useSnapshot ? BVH::snapshotKey(agents.lanes(), bvhBuildType) : 0;
+	if (useSnapshot && bvh.loadSnapshot(bvhSnapshotPath, agents.size(), sceneKey))
+		return;
+	updateBVH();
+	if (useSnapshot)
+		bvh.saveSnapshot(bvhSnapshotPath, sceneKey);
+}
+
+void Simulation::tick(float deltaTime)
+{
+	Clock::time_point start = Clock::now();
+	integrate(deltaTime);
+	timings.integrate = elapsedMs(start);
+
+	start = Clock::now();
+	broadPhase();
+	timings.broadPhase = elapsedMs(start);
+
+	start = Clock::now();
+	response(deltaTime);
+	timings.response = elapsedMs(start);
+
+	// the bvh broad-phase already updated the tree, but to the boxes from before the response. the
+	// culling, the overlay and the profiler read it after the tick, so its bounds follow the response
+	timings.bvhUpdate = 0.0;
+	if (enableBVH)
+	{
+		start = Clock::now();
+		if (broadPhaseType != BVH_SELF_COLLISION)
+			updateBVH();
+		else if ((bvh.isDynamic() || bvh.getFlatNodeCount() > 0) && bvh.getPrimitiveCount() == agents.size())
+			bvh.refit(agents.lanes(), false);
+		timings.bvhUpdate = elapsedMs(start);
+	}
+
+	// outside the timings, the sample queries would count as bvh update otherwise
+	if (enableBVH && bvhMetricsSamples > 0)
+		bvhProfiler.measure(bvh, agents.lanes(), bvhMetricsSamples);
+}
+
+void Simulation::integrate(float deltaTime)
+{
+	glm::vec3 scale = glm::vec3(1.f);
+
+	// the static tree is only built again when the arena or an obstacle changed
+	obstacles.setArena(arenaMin, arenaMax);
+	obstacles.update();
+
+	if (continuousCollision)
+	{
+		// move, then reflect whatever went into an obstacle at its impact, the broad-phase sees the whole move
+		agents.integrate(deltaTime);
+		collideObstacles(deltaTime);
+		agents.updateSweptAABBs(scale);
+	}
+	else
+	{
+		// bounce off the obstacles the boxes of the last tick touch, then move, with the simd kernels of the agent store
+		collideObstacles(deltaTime);
+		agents.integrate(deltaTime);
+
+		// update bounding box
+		agents.updateAABBs(scale);
+	}
+
+	// reset the collision status
+	agents.resetCollisionStatus();
+}
+
+template <typename BroadPhase>
+void Simulation::gatherCandidatePairs(BroadPhase& broadPhase, int count)
+{
+	chunkPairs.resize(threadPool.getThreadCount());
+	for (size_t c = 0; c < chunkPairs.size(); c++)
+		chunkPairs[c].clear();
+
+	threadPool.parallelFor(count, [this, &broadPhase](int begin, int end, int chunk)
+		{
+			broadPhase.findPairs(chunkPairs[chunk], begin, end, chunk);
+		});
+
+	// chunks are contiguous ranges, so joining them in order gives the single thread list
+	for (size_t c = 0; c < chunkPairs.size(); c++)
+		candidatePairs.insert(candidatePairs.end(), chunkPairs[c].begin(), chunkPairs[c].end());
+}
+
+void Simulation::broadPhase()
+{
+	candidatePairs.clear();
+
+	if (broadPhaseType == SWEEP_AND_PRUNE)
+	{
+		// broad-phase: persistent x endpoint list, re-sorted incrementally every frame
+		sweepAndPrune.update(agents);
+		gatherCandidatePairs(sweepAndPrune, agents.size());
+	}
+	else if (broadPhaseType == BVH_SELF_COLLISION)
+	{
+		// broad-phase: the tree on this tick's boxes against itself
+		updateBVH();
+		bvh.findPairs(candidatePairs, threadPool);
+	}
+	else
+	{
+		// broad-phase: only pairs from neighbouring grid cells can overlap
+		grid.build(agents, threadPool.getThreadCount());
+		gatherCandidatePairs(grid, agents.size());
+	}
+
+	timings.candidatePairs = candidatePairs.size();
+}
+
+void Simulation::response(float deltaTime)
+{
+	// with continuous collision only the swept pairs that really meet during the tick are contacts
+	const vector<pair<int, int>>& contactPairs = continuousCollision ? sweptCollision() : candidatePairs;
+
+	// persisting contacts are already moving apart, flipping them again would lock the pair together
+	contacts.update(contactPairs);
+	timings.beginContacts = contacts.getBeginCount();
+	timings.endContacts = contacts.getEndCount();
+
+	newPairs.clear();
+	for (size_t k = 0; k < contactPairs.size(); k++)
+	{
+		int i = contactPairs[k].first;
+		int j = contactPairs[k].second;
+
+		if (contacts.isNew(k))
+		{
+			newPairs.push_back(contactPairs[k]);
+		}
+		else
+		{
+			// still touching, keep the debug colour
+			agents.collisionStatus[i] = 1;
+			agents.collisionStatus[j] = 1;
+		}
+	}
+
+	if (continuousCollision)
+	{
+		// the earliest impact of every agent is resolved at its time of impact, the rest falls back
+		// to the overlap response at the end of the tick
+		resolveImpacts(deltaTime);
+		agents.updateAABBs(glm::vec3(1.f));
+	}
+
+	// narrow-phase and response, one phase at a time, the pairs of a phase never share an agent
+	collisionPhases.build(newPairs, agents.size());
+	for (int phase = 0; phase < collisionPhases.getPhaseCount(); phase++)
+	{
+		int phaseBegin = collisionPhases.getPhaseBegin(phase);
+
+		threadPool.parallelFor(collisionPhases.getPhaseEnd(phase) - phaseBegin, [this, phaseBegin, deltaTime](int begin, int end, int)
+			{
+				for (int k = phaseBegin + begin; k < phaseBegin + end; k++)
+				{
+					collisionResponse(collisionPhases.getPair(k).first, collisionPhases.getPair(k).second, deltaTime);
+				}
+			}, 256);
+	}
+}
+
+float Simulation::timeOfImpact(int i, int j, int& axis) const
+{
+	// boxes at the start of the tick, j moving relative to i, slab test on x and y
+	const AABB& rest = agents.restAABB;
+	float start[2][2] = {
+		{ agents.prevX[i] - agents.prevX[j], agents.prevY[i] - agents.prevY[j] },   // offset of i from j
+		{ agents.posX[j] - agents.prevX[j] - (agents.posX[i] - agents.prevX[i]),    // move of j relative to i
+		  agents.posY[j] - agents.prevY[j] - (agents.posY[i] - agents.prevY[i]) } };
+	float extent[2] = { rest.maxX_0 - rest.minX_0, rest.maxY_0 - rest.minY_0 };
+
+	float enter = -FLT_MAX;
+	float leave = FLT_MAX;
+	axis = 0;
+	for (int a = 0; a < 2; a++)
+	{
+		// boxes share the rest extent, so j overlaps i on this axis while |offset| < extent
+		float offset = start[0][a];
+		float move = start[1][a];
+		float axisEnter, axisLeave;
+		if (move == 0.0f)
+		{
+			if (std::abs(offset) >= extent[a])
+				return NO_IMPACT;
+			axisEnter = -FLT_MAX;
+			axisLeave = FLT_MAX;
+		}
+		else
+		{
+			float t0 = (offset - extent[a]) / move;
+			float t1 = (offset + extent[a]) / move;
+			axisEnter = std::min(t0, t1);
+			axisLeave = std::max(t0, t1);
+		}
+
+		if (axisEnter > enter)
+		{
+			enter = axisEnter;
+			axis = a;
+		}
+		leave = std::min(leave, axisLeave);
+	}
+
+	if (enter >= leave || enter >= 1.0f || leave <= 0.0f)
+		return NO_IMPACT;
+
+	return std::max(enter, 0.0f);
+}
+
+float Simulation::obstacleImpact(int i, const AABB& obstacle, int& axis) const
+{
+	// the box of i moving from prev to curr against the resting obstacle, slab test on x and y
+	const AABB& rest = agents.restAABB;
+	float start[2] = { agents.prevX[i], agents.prevY[i] };
+	float move[2] = { agents.posX[i] - agents.prevX[i], agents.posY[i] - agents.prevY[i] };
+	float lo[2] = { rest.minX_0, rest.minY_0 };
+	float hi[2] = { rest.maxX_0, rest.maxY_0 };
+	float obstacleMin[2] = { obstacle.minX, obstacle.minY };
+	float obstacleMax[2] = { obstacle.maxX, obstacle.maxY };
+
+	float enter = -FLT_MAX;
+	float leave = FLT_MAX;
+	axis = 0;
+	for (int a = 0; a < 2; a++)
+	{
+		float boxMin = start[a] + lo[a];
+		float boxMax = start[a] + hi[a];
+		float axisEnter, axisLeave;
+		if (move[a] == 0.0f)
+		{
+			if (boxMax <= obstacleMin[a] || boxMin >= obstacleMax[a])
+				return NO_IMPACT;
+			axisEnter = -FLT_MAX;
+			axisLeave = FLT_MAX;
+		}
+		else
+		{
+			float t0 = (obstacleMin[a] - boxMax) / move[a];
+			float t1 = (obstacleMax[a] - boxMin) / move[a];
+			axisEnter = std::min(t0, t1);
+			axisLeave = std::max(t0, t1);
+		}
+
+		if (axisEnter > enter)
+		{
+			enter = axisEnter;
+			axis = a;
+		}
+		leave = std::min(leave, axisLeave);
+	}
+
+	if (enter >= leave || enter >= 1.0f || leave <= 0.0f)
+		return NO_IMPACT;
+
+	return std::max(enter, 0.0f);
+}
+
+bool Simulation::pushOutOfObstacle(int i, const AABB& obstacle)
+{
+	// shortest way out of the obstacle on x or y, the velocity on that axis is turned away from it
+	const AABB& rest = agents.restAABB;
+	float boxMinX = agents.posX[i] + rest.minX_0;
+	float boxMaxX = agents.posX[i] + rest.maxX_0;
+	float boxMinY = agents.posY[i] + rest.minY_0;
+	float boxMaxY = agents.posY[i] + rest.maxY_0;
+	if (!(boxMinX < obstacle.maxX && boxMaxX > obstacle.minX && boxMinY < obstacle.maxY && boxMaxY > obstacle.minY))
+		return false;
+
+	float push[4] = { obstacle.minX - boxMaxX, obstacle.maxX - boxMinX, obstacle.minY - boxMaxY, obstacle.maxY - boxMinY };
+	int best = 0;
+	for (int k = 1; k < 4; k++)
+	{
+		if (std::abs(push[k]) < std::abs(push[best]))
+			best = k;
+	}
+
+	float& pos = best < 2 ? agents.posX[i] : agents.posY[i];
+	float& vel = best < 2 ? agents.velX[i] : agents.velY[i];
+	pos += push[best];
+	vel = push[best] < 0.0f ? -std::abs(vel) : std::abs(vel);
+	return true;
+}
+
+void Simulation::collideObstacles(float deltaTime)
+{
+	// every agent against the static tree, an agent only moves itself so any split gives the same result
+	const AABB& rest = agents.restAABB;
+	int chunkCount = threadPool.getThreadCount();
+	obstacleHits.resize(chunkCount);
+	chunkObstacleContacts.assign(chunkCount, 0);
+	threadPool.parallelFor(agents.size(), [this, &rest, deltaTime](int begin, int end, int chunk)
+		{
+			vector<int>& hits = obstacleHits[chunk];
+			if (hits.empty())
+				hits.resize(16);
+
+			for (int i = begin; i < end; i++)
+			{
+				// with continuous collision the box covers the whole step, otherwise it is the box of the last tick
+				AABB box = agents.aabb(i);
+				if (continuousCollision)
+				{
+					box.minX = std::min(agents.prevX[i], agents.posX[i]) + rest.minX_0;
+					box.maxX = std::max(agents.prevX[i], agents.posX[i]) + rest.maxX_0;
+					box.minY = std::min(agents.prevY[i], agents.posY[i]) + rest.minY_0;
+					box.maxY = std::max(agents.prevY[i], agents.posY[i]) + rest.maxY_0;
+				}
+
+				int found = obstacles.query(box, hits.data(), hits.size());
+				if (found == 0)
+					continue;
+				if (found > (int)hits.size())
+				{
+					hits.resize(found);
+					obstacles.query(box, hits.data(), hits.size());
+				}
+
+				if (continuousCollision)
+				{
+					// the earliest obstacle the step runs into, back to the impact and the rest of the tick going back
+					float earliest = NO_IMPACT;
+					int earliestAxis = 0;
+					for (int k = 0; k < found; k++)
+					{
+						int axis;
+						float t = obstacleImpact(i, obstacles.aabb(hits[k]), axis);
+						if (t > 0.0f && t < earliest)
+						{
+							earliest = t;
+							earliestAxis = axis;
+						}
+					}
+
+					if (earliest != NO_IMPACT)
+					{
+						float& pos = earliestAxis == 0 ? agents.posX[i] : agents.posY[i];
+						float& vel = earliestAxis == 0 ? agents.velX[i] : agents.velY[i];
+						float prev = earliestAxis == 0 ? agents.prevX[i] : agents.prevY[i];
+						float impact = prev + (pos - prev) * earliest;
+						vel = -vel;
+						pos = impact + vel * (1.0f - earliest) * deltaTime;
+						chunkObstacleContacts[chunk]++;
+					}
+				}
+
+				// whatever still overlaps after the step (corners, a start inside) is pushed out
+				for (int k = 0; k < found; k++)
+				{
+					if (pushOutOfObstacle(i, obstacles.aabb(hits[k])))
+						chunkObstacleContacts[chunk]++;
+				}
+			}
+		}, 256);
+
+	timings.obstacleContacts = 0;
+	for (int c = 0; c < chunkCount; c++)
+		timings.obstacleContacts += chunkObstacleContacts[c];
+}
+
+const vector<pair<int, int>>& Simulation::sweptCollision()
+{
+	// narrow-phase on the swept candidates, every pair on its own so any split gives the same list
+	int candidateCount = candidatePairs.size();
+	pairImpact.resize(candidateCount);
+	pairAxis.resize(candidateCount);
+	threadPool.parallelFor(candidateCount, [this](int begin, int end, int)
+		{
+			for (int k = begin; k < end; k++)
+			{
+				pairImpact[k] = timeOfImpact(candidatePairs[k].first, candidatePairs[k].second, pairAxis[k]);
+			}
+		}, 256);
+
+	hitPairs.clear();
+	hitImpact.clear();
+	hitAxis.clear();
+	for (int k = 0; k < candidateCount; k++)
+	{
+		if (pairImpact[k] == NO_IMPACT)
+			continue;
+
+		hitPairs.push_back(candidatePairs[k]);
+		hitImpact.push_back(pairImpact[k]);
+		hitAxis.push_back(pairAxis[k]);
+	}
+
+	return hitPairs;
+}
+
+void Simulation::resolveImpacts(float deltaTime)
+{
+	// earliest new impact of every agent, ties go to the lower agent pair so the broad-phase order does not matter
+	int hitCount = hitPairs.size();
+	earliestImpact.assign(agents.size(), NO_IMPACT);
+	earliestPair.assign(agents.size(), -1);
+	for (int h = 0; h < hitCount; h++)
+	{
+		// overlapping from the start (time 0) has no impact to go back to, the overlap response takes it
+		if (!contacts.isNew(h) || hitImpact[h] <= 0.0f)
+			continue;
+
+		int ends[2] = { hitPairs[h].first, hitPairs[h].second };
+		for (int e : ends)
+		{
+			int best = earliestPair[e];
+			if (hitImpact[h] < earliestImpact[e] || (hitImpact[h] == earliestImpact[e] && hitPairs[h] < hitPairs[best]))
+			{
+				earliestImpact[e] = hitImpact[h];
+				earliestPair[e] = h;
+			}
+		}
+	}
+
+	// a pair is resolved here when it is the first impact of both agents, so no agent is touched twice
+	sweptPairs.clear();
+	for (int h = 0; h < hitCount; h++)
+	{
+		if (earliestPair[hitPairs[h].first] == h && earliestPair[hitPairs[h].second] == h)
+			sweptPairs.push_back(h);
+	}
+
+	threadPool.parallelFor(sweptPairs.size(), [this, deltaTime](int begin, int end, int)
+		{
+			for (int s = begin; s < end; s++)
+			{
+				int h = sweptPairs[s];
+				int ends[2] = { hitPairs[h].first, hitPairs[h].second };
+				float t = hitImpact[h];
+
+				for (int e : ends)
+				{
+					agents.collisionStatus[e] = 1;
+
+					// back to the impact on the hit normal, bounce, and spend the rest of the tick going back
+					if (hitAxis[h] == 0)
+					{
+						float impact = agents.prevX[e] + (agents.posX[e] - agents.prevX[e]) * t;
+						agents.velX[e] = -agents.velX[e];
+						agents.posX[e] = impact + agents.velX[e] * (1.0f - t) * deltaTime;
+					}
+					else
+					{
+						float impact = agents.prevY[e] + (agents.posY[e] - agents.prevY[e]) * t;
+						agents.velY[e] = -agents.velY[e];
+						agents.posY[e] = impact + agents.velY[e] * (1.0f - t) * deltaTime;
+					}
+				}
+			}
+		}, 256);
+
+	// the overlap response only gets the new contacts that were not resolved at their impact
+	newPairs.clear();
+	for (int h = 0; h < hitCount; h++)
+	{
+		if (contacts.isNew(h) && !(earliestPair[hitPairs[h].first] == h && earliestPair[hitPairs[h].second] == h))
+			newPairs.push_back(hitPairs[h]);
+	}
+}
+
+void Simulation::collisionResponse(int i, int j, float deltaTime)
+{
+	AABB aabb_1 = agents.aabb(i);
+	AABB aabb_2 = agents.aabb(j);
+
+	if (aabb_1.overlap(aabb_2))
+	{
+		// change the uniform collision status
+		agents.collisionStatus[i] = 1;
+		agents.collisionStatus[j] = 1;
+
+		// difference of distance in x and y
+		glm::vec3 deltaArea = aabb_1.intersection(aabb_2);
+
+		// update position
+		// calculate the first collision axis
+		float delta_time_x = deltaArea.x / (agents.velX[i] + agents.velX[j]);
+		float delta_time_y = deltaArea.y / (agents.velY[i] + agents.velY[j]);
+		if (delta_time_x <= delta_time_y)
+		{
+			// x direction is the hit normal
+			agents.posX[i] -= agents.velX[i] * deltaTime;
+			agents.posX[j] -= agents.velX[j] * deltaTime;
+
+			// update velocity
+			agents.velX[i] = -agents.velX[i];
+			agents.velX[j] = -agents.velX[j];
+		}
+		else
+		{
+			// y direction is the hit normal
+			agents.posY[i] -= agents.velY[i] * deltaTime;
+			agents.posY[j] -= agents.velY[j] * deltaTime;
+
+			// update velocity
+			agents.velY[i] = -agents.velY[i];
+			agents.velY[j] = -agents.velY[j];
+		}
+
+		// update bounding box
+		glm::vec3 scale = glm::vec3(1.f);
+		agents.updateAABB(i, scale);
+		agents.updateAABB(j, scale);
+	}
+}
+
+void Simulation::updateBVH()
+{
+	// the agents move a little per tick, refitting keeps the topology and costs one pass over the nodes
+	timings.bvhRebuilt = false;
+	if (bvhBuildType == BVH_DYNAMIC)
+	{
+		// incremental, only agents that left their fat box go back into the tree
+		bvh.updateDynamic(agents, bvhSettings);
+		timings.bvhReinserts = bvh.getReinsertCount();
+		return;
+	}
+
+	if (refitBVH && bvh.getFlatNodeCount() > 0 && bvh.getPrimitiveCount() == agents.size())
+	{
+		// bounds only on most ticks, the rotation pass costs about a build of the query copies
+		bool rotate = bvhRotateInterval > 0 && ++refitsSinceRotation >= bvhRotateInterval;
+		if (rotate)
+			refitsSinceRotation = 0;
+		bvh.refit(agents.lanes(), rotate);
+		if (bvh.getSAHCost() <= bvh.getBuildSAHCost() * bvhRebuildThreshold)
+			return;
+	}
+
+	// rebuilt from scratch into the same node array
+	timings.bvhRebuilt = true;
+	if (bvhBuildType == BVH_INSERTION)
+		bvh.buildInsertion(agents);
+	else if (bvhBuildType == BVH_LBVH)
+		bvh.buildLBVH(agents.lanes(), threadPool);
+	else
+		bvh.build(agents.lanes(), bvhSettings);
+}
+
+const SimulationTimings& Simulation::getTimings() const
+{
+	return timings;
+}
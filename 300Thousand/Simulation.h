@@ -0,0 +1,121 @@
+#pragma once
+#include <vector>
+#include <utility>
+#include <random>
+#include <string>
+#include <glm/glm.hpp>
+#include "AABB.h"
+#include "AgentStore.h"
+#include "BVH.h"
+#include "SpatialHashGrid.h"
+#include "SweepAndPrune.h"
+#include "ThreadPool.h"
+#include "CollisionPhases.h"
+#include "ContactCache.h"
+#include "StaticObstacles.h"
+#include "BVHProfiler.h"
+
+using namespace std;
+using namespace glm;
+
+enum BroadPhaseType { SPATIAL_HASH = 0, SWEEP_AND_PRUNE = 1, BVH_SELF_COLLISION = 2 };
+
+// milliseconds spent in each stage of the last tick
+struct SimulationTimings
+{
+	double integrate = 0.0;
+	double broadPhase = 0.0;
+	double response = 0.0;
+	double bvhUpdate = 0.0;
+	int candidatePairs = 0;
+	int obstacleContacts = 0;  // agents bounced off static geometry
+	bool bvhRebuilt = false;   // full build instead of a refit
+	int bvhReinserts = 0;      // dynamic tree proxies moved to a new place
+	int beginContacts = 0;
+	int endContacts = 0;
+};
+
+/*
+ the agent simulation without any gl, shared by the viewer and the headless benchmark.
+ one tick = obstacle bounce + integrate, broad-phase, contact cache, phased collision response, bvh update.
+ only contacts that began this tick get a response, the others were resolved when they began.
+ the arena walls and other static geometry sit in their own tree (StaticObstacles) that is built once,
+ every agent queries it, the per-tick agent tree only holds agents, obstacles are never paired up.
+ with continuous collision the broad-phase runs on swept boxes, every agent is bounced at the time
+ of impact of its earliest new contact and of the first obstacle it runs into, so fast agents do not tunnel.
+ the bvh is refitted in place, rotated every bvhRotateInterval ticks and only rebuilt once its sah
+ cost drifted past the threshold. as the broad-phase it is updated to the boxes of the tick first and
+ descended against itself.
+ the same seed gives the same run for any thread count.
+*/
+class Simulation
+{
+public:
+	Simulation(unsigned int seed = 2022);
+	~Simulation();
+
+	// lays the agents out on a grid of rows columns, 10 units apart, with random velocities
+	void spawn(int count, int rows, const AABB& restAABB);
+	void tick(float deltaTime);
+
+	// the stages of a tick, in order
+	void integrate(float deltaTime);
+	void broadPhase();
+	void response(float deltaTime);
+	void updateBVH();
+
+	float random(float min, float max);
+	const SimulationTimings& getTimings() const;
+
+	AgentStore agents;  // aabb, position, velocity as structure of arrays
+	BVH bvh;
+	StaticObstacles obstacles;  // the walls from arenaMin / arenaMax come first
+	ThreadPool threadPool;
+	ContactCache contacts;  // begin / persist / end events for consumers outside the tick
+
+	int broadPhaseType;
+	bool enableBVH;     // update the bvh every tick
+	int bvhBuildType;   // BVHBuildType, used for every full build, BVH_DYNAMIC never rebuilds
+	BVHBuildSettings bvhSettings;
+	bool refitBVH;                // refit between full builds
+	int bvhRotateInterval;        // refits per rotation pass, the pass lays out the query copies again, 0 = never
+	float bvhRebuildThreshold;    // rebuild when the sah cost grows past this factor of the last build
+	string bvhSnapshotPath;       // spawn maps the tree from here instead of building, saves it on a miss
+	int bvhMetricsSamples;        // agent boxes bvhProfiler queries after every bvh update, 0 = off
+	BVHProfiler bvhProfiler;      // open its log for a json line per tick
+	bool continuousCollision;  // swept boxes and time of impact instead of end of tick overlap
+	float arenaMin;     // walls, same bound on x and y, put into obstacles at the start of every tick
+	float arenaMax;
+
+private:
+	void collisionResponse(int i, int j, float deltaTime);
+	float timeOfImpact(int i, int j, int& axis) const;  // axis 0 = x, 1 = y is the hit normal
+	float obstacleImpact(int i, const AABB& obstacle, int& axis) const;
+	bool pushOutOfObstacle(int i, const AABB& obstacle);  // false when they do not overlap
+	void collideObstacles(float deltaTime);
+	const vector<pair<int, int>>& sweptCollision();
+	void resolveImpacts(float deltaTime);
+	template <typename BroadPhase>
+	void gatherCandidatePairs(BroadPhase& broadPhase, int count);
+
+	SpatialHashGrid grid;
+	SweepAndPrune sweepAndPrune;
+	vector<pair<int, int>> candidatePairs;
+	vector<pair<int, int>> newPairs;            // candidate pairs that began this tick
+	vector<float> pairImpact;                   // time of impact per candidate pair
+	vector<int> pairAxis;
+	vector<pair<int, int>> hitPairs;            // candidates that meet during the tick
+	vector<float> hitImpact;
+	vector<int> hitAxis;
+	vector<float> earliestImpact;               // per agent
+	vector<int> earliestPair;
+	vector<int> sweptPairs;                     // hit pairs resolved at their time of impact
+	vector<vector<pair<int, int>>> chunkPairs;  // per worker chunk, joined in chunk order
+	vector<vector<int>> obstacleHits;           // per worker chunk, query scratch
+	vector<int> chunkObstacleContacts;
+	CollisionPhases collisionPhases;
+
+	std::mt19937 generator;
+	SimulationTimings timings;
+	int refitsSinceRotation;
+};
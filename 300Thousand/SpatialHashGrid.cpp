@@ -0,0 +1,122 @@
+#include "SpatialHashGrid.h"
+
+SpatialHashGrid::SpatialHashGrid()
+	: cellSize(1.0f), tableMask(0), maxBucketSize(0)
+{
+}
+
+void SpatialHashGrid::build(const AgentStore& agents, int chunkCount)
+{
+	int count = agents.size();
+
+	// the cell has to cover the largest box, otherwise overlapping pairs could be two cells apart
+	float maxExtent = 0.0f;
+	for (int i = 0; i < count; i++)
+	{
+		maxExtent = std::max(maxExtent, std::max(agents.maxX[i] - agents.minX[i], agents.maxY[i] - agents.minY[i]));
+	}
+	cellSize = maxExtent > 0.0f ? maxExtent : 1.0f;
+
+	// about two buckets per object keeps the hash collisions low
+	unsigned int tableSize = 1;
+	while (tableSize < 2 * (unsigned int)count)
+		tableSize <<= 1;
+	tableMask = tableSize - 1;
+
+	cellX.resize(count);
+	cellY.resize(count);
+	objectBucket.resize(count);
+	sortedObjects.resize(count);
+	objectSlot.resize(count);
+	sortedMinX.resize(count);
+	sortedMinY.resize(count);
+	sortedMaxX.resize(count);
+	sortedMaxY.resize(count);
+	bucketStart.assign(tableSize + 1, 0);
+
+	// count objects per bucket
+	for (int i = 0; i < count; i++)
+	{
+		cellX[i] = (int)floor((agents.minX[i] + agents.maxX[i]) * 0.5f / cellSize);
+		cellY[i] = (int)floor((agents.minY[i] + agents.maxY[i]) * 0.5f / cellSize);
+		objectBucket[i] = hashCell(cellX[i], cellY[i]);
+		bucketStart[objectBucket[i] + 1]++;
+	}
+
+	// prefix sum into start offsets
+	maxBucketSize = 0;
+	for (unsigned int b = 0; b < tableSize; b++)
+	{
+		maxBucketSize = std::max(maxBucketSize, bucketStart[b + 1]);
+		bucketStart[b + 1] += bucketStart[b];
+	}
+
+	chunkHits.resize(std::max(chunkCount, 1));
+	for (size_t c = 0; c < chunkHits.size(); c++)
+		chunkHits[c].resize(std::max((size_t)maxBucketSize, chunkHits[c].size()));
+
+	// scatter, walking the objects in order keeps every bucket sorted by object index
+	bucketFill.assign(bucketStart.begin(), bucketStart.end() - 1);
+	for (int i = 0; i < count; i++)
+	{
+		int k = bucketFill[objectBucket[i]]++;
+		sortedObjects[k] = i;
+		objectSlot[i] = k;
+		sortedMinX[k] = agents.minX[i];
+		sortedMinY[k] = agents.minY[i];
+		sortedMaxX[k] = agents.maxX[i];
+		sortedMaxY[k] = agents.maxY[i];
+	}
+}
+
+void SpatialHashGrid::findPairs(vector<pair<int, int>>& pairs)
+{
+	findPairs(pairs, 0, cellX.size(), 0);
+}
+
+void SpatialHashGrid::findPairs(vector<pair<int, int>>& pairs, int begin, int end, int chunk)
+{
+	vector<int>& hits = chunkHits[chunk];
+
+	for (int i = begin; i < end; i++)
+	{
+		int k = objectSlot[i];
+		AABB query(sortedMinX[k], sortedMinY[k], 0.0f, sortedMaxX[k], sortedMaxY[k], 0.0f);
+
+		for (int dy = -1; dy <= 1; dy++)
+		{
+			for (int dx = -1; dx <= 1; dx++)
+			{
+				int x = cellX[i] + dx;
+				int y = cellY[i] + dy;
+				unsigned int bucket = hashCell(x, y);
+
+				int start = bucketStart[bucket];
+				AABBLanes boxes = { sortedMinX.data() + start, sortedMinY.data() + start, nullptr,
+					sortedMaxX.data() + start, sortedMaxY.data() + start, nullptr, bucketStart[bucket + 1] - start };
+				int hitCount = overlapIndices(query, boxes, hits.data());
+
+				for (int h = 0; h < hitCount; h++)
+				{
+					int j = sortedObjects[start + hits[h]];
+
+					// (a,b) vs (b,a), and other cells hashed into the same bucket
+					if (j <= i || cellX[j] != x || cellY[j] != y)
+						continue;
+
+					pairs.push_back(pair<int, int>(i, j));
+				}
+			}
+		}
+	}
+}
+
+float SpatialHashGrid::getCellSize() const
+{
+	return cellSize;
+}
+
+unsigned int SpatialHashGrid::hashCell(int x, int y) const
+{
+	return ((unsigned int)x * 73856093u ^ (unsigned int)y * 19349663u) & tableMask;
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <vector>
+#include <utility>
+#include "AABB.h"
+#include "AgentStore.h"
+
+using namespace std;
+
+/*
+ uniform grid broad-phase on the xy plane (same plane AABB::overlap tests).
+ every object is binned by the cell of its aabb center, and the cell size is at least the largest
+ aabb extent, so two overlapping boxes always sit in the same or in neighbouring cells.
+ cells are hashed into a power of two table and sorted with a counting sort, nothing is allocated
+ per frame once the vectors reached their size. the bounds are sorted along, so every neighbouring
+ bucket is tested with one batched overlap call and only overlapping pairs come out. the hits of that
+ call land in a scratch buffer per pool chunk, sized by build().
+*/
+
+class SpatialHashGrid
+{
+public:
+	SpatialHashGrid();
+	void build(const AgentStore& agents, int chunkCount = 1);  // chunkCount: pool chunks findPairs runs on at once
+	void findPairs(vector<pair<int, int>>& pairs);
+	void findPairs(vector<pair<int, int>>& pairs, int begin, int end, int chunk = 0);  // pairs (i, j) with begin <= i < end
+	float getCellSize() const;
+
+private:
+	unsigned int hashCell(int x, int y) const;
+
+	float cellSize;
+	unsigned int tableMask;
+	vector<int> cellX;          // cell coordinate of each object
+	vector<int> cellY;
+	vector<unsigned int> objectBucket;  // hash bucket of each object
+	vector<int> bucketStart;    // start offset of each bucket in sortedObjects, size = table size + 1
+	vector<int> bucketFill;     // scatter cursor of each bucket while building
+	vector<int> sortedObjects;  // object indices grouped by bucket, ascending inside a bucket
+	vector<int> objectSlot;     // position of each object in sortedObjects
+	vector<float> sortedMinX;   // xy bounds in sortedObjects order, each bucket is a contiguous batch for overlapIndices
+	vector<float> sortedMinY;
+	vector<float> sortedMaxX;
+	vector<float> sortedMaxY;
+	int maxBucketSize;
+	vector<vector<int>> chunkHits;  // overlapIndices output per chunk, maxBucketSize each
+};
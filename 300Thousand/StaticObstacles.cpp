@@ -0,0 +1,132 @@
+#include "StaticObstacles.h"
+#include <cfloat>
+
+// z extent of the walls, the agent tests are xy only, finite so the sah areas of the tree stay finite
+static const float WALL_HEIGHT = 1000.0f;
+
+StaticObstacles::StaticObstacles()
+	: wallThickness(10.0f), wallCount(0), arenaMin(0.0f), arenaMax(0.0f),
+	innerBounds(FLT_MAX, FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX, -FLT_MAX), dirty(false), rebuilt(false)
+{
+}
+
+void StaticObstacles::clear()
+{
+	minX.clear(); minY.clear(); minZ.clear();
+	maxX.clear(); maxY.clear(); maxZ.clear();
+	wallCount = 0;
+	dirty = true;
+}
+
+int StaticObstacles::add(const AABB& aabb)
+{
+	int index = minX.size();
+	minX.push_back(0.0f); minY.push_back(0.0f); minZ.push_back(0.0f);
+	maxX.push_back(0.0f); maxY.push_back(0.0f); maxZ.push_back(0.0f);
+	setBox(index, aabb);
+	dirty = true;
+	return index;
+}
+
+void StaticObstacles::setArena(float minBound, float maxBound)
+{
+	// left, right, bottom, top, the side walls run past the corners so nothing slips through them
+	arenaMin = minBound;
+	arenaMax = maxBound;
+	float lo = minBound - wallThickness;
+	float hi = maxBound + wallThickness;
+	AABB walls[4] = {
+		AABB(lo, lo, -WALL_HEIGHT, minBound, hi, WALL_HEIGHT),
+		AABB(maxBound, lo, -WALL_HEIGHT, hi, hi, WALL_HEIGHT),
+		AABB(lo, lo, -WALL_HEIGHT, hi, minBound, WALL_HEIGHT),
+		AABB(lo, maxBound, -WALL_HEIGHT, hi, hi, WALL_HEIGHT) };
+
+	if (wallCount == 0)
+	{
+		// the walls go in front of the obstacles that are already there
+		vector<AABB> others;
+		for (int i = 0; i < size(); i++)
+			others.push_back(aabb(i));
+		clear();
+		for (int w = 0; w < 4; w++)
+			add(walls[w]);
+		for (const AABB& other : others)
+			add(other);
+		wallCount = 4;
+		return;
+	}
+
+	for (int w = 0; w < 4; w++)
+	{
+		if (minX[w] != walls[w].minX || maxX[w] != walls[w].maxX || minY[w] != walls[w].minY || maxY[w] != walls[w].maxY)
+		{
+			setBox(w, walls[w]);
+			dirty = true;
+		}
+	}
+}
+
+int StaticObstacles::size() const
+{
+	return minX.size();
+}
+
+int StaticObstacles::getWallCount() const
+{
+	return wallCount;
+}
+
+AABB StaticObstacles::aabb(int i) const
+{
+	return AABB(minX[i], minY[i], minZ[i], maxX[i], maxY[i], maxZ[i]);
+}
+
+AABBLanes StaticObstacles::lanes() const
+{
+	return { minX.data(), minY.data(), minZ.data(), maxX.data(), maxY.data(), maxZ.data(), size() };
+}
+
+void StaticObstacles::update()
+{
+	rebuilt = dirty;
+	if (!dirty)
+		return;
+
+	// few boxes and built rarely, so the tree gets the best sah split at every level
+	BVHBuildSettings settings;
+	settings.binCount = 32;
+	tree.build(lanes(), settings);
+	dirty = false;
+
+	innerBounds = AABB(FLT_MAX, FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for (int i = wallCount; i < size(); i++)
+		innerBounds = innerBounds.unions(aabb(i));
+}
+
+bool StaticObstacles::wasRebuilt() const
+{
+	return rebuilt;
+}
+
+const BVH& StaticObstacles::getTree() const
+{
+	return tree;
+}
+
+int StaticObstacles::query(const AABB& aabb, int* results, int capacity) const
+{
+	if (size() == 0)
+		return 0;
+
+	// inside the walls and away from every other obstacle is the common case, no tree walk for it
+	bool insideWalls = wallCount == 0 || (aabb.minX >= arenaMin && aabb.maxX <= arenaMax && aabb.minY >= arenaMin && aabb.maxY <= arenaMax);
+	if (insideWalls && !aabb.overlap(innerBounds))
+		return 0;
+	return tree.query(aabb, -1, results, capacity);
+}
+
+void StaticObstacles::setBox(int i, const AABB& aabb)
+{
+	minX[i] = aabb.minX; minY[i] = aabb.minY; minZ[i] = aabb.minZ;
+	maxX[i] = aabb.maxX; maxY[i] = aabb.maxY; maxZ[i] = aabb.maxZ;
+}
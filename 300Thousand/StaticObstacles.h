@@ -0,0 +1,48 @@
+#pragma once
+#include <vector>
+#include "AABB.h"
+#include "BVH.h"
+
+using namespace std;
+
+/*
+ the geometry that never moves (arena walls, pillars, props) in its own tree, next to the per-tick
+ tree of the agents. the tree is built once and only again after the set changed, so a complex arena
+ adds nothing to the bvh update. the broad-phase asks it about agents only, obstacles never meet each
+ other. the four arena walls are the first obstacles, slabs of wallThickness just outside the bounds.
+*/
+
+class StaticObstacles
+{
+public:
+	StaticObstacles();
+	void clear();  // walls too
+	int add(const AABB& aabb);  // returns the index of the obstacle
+	void setArena(float minBound, float maxBound);  // replaces the walls, same bound on x and y
+	int size() const;
+	int getWallCount() const;
+	AABB aabb(int i) const;
+	AABBLanes lanes() const;
+
+	void update();  // builds the tree if the set changed since the last update
+	bool wasRebuilt() const;  // by the last update()
+	const BVH& getTree() const;
+
+	// obstacles whose box overlaps aabb, same contract as BVH::query
+	int query(const AABB& aabb, int* results, int capacity) const;
+
+	float wallThickness;
+
+private:
+	void setBox(int i, const AABB& aabb);
+
+	vector<float> minX, minY, minZ;
+	vector<float> maxX, maxY, maxZ;
+	int wallCount;
+	float arenaMin;
+	float arenaMax;
+	AABB innerBounds;  // of the obstacles that are not walls
+	bool dirty;
+	bool rebuilt;
+	BVH tree;
+};
@@ -0,0 +1,98 @@
+#include "SweepAndPrune.h"
+#include <algorithm>
+
+SweepAndPrune::SweepAndPrune()
+	: swapCount(0)
+{
+}
+
+void SweepAndPrune::update(const AgentStore& agents)
+{
+	if ((int)endpoints.size() != agents.size())
+	{
+		// first frame or the population changed, start from a full sort
+		rebuild(agents);
+		return;
+	}
+
+	// refresh the bounds in the order of last frame
+	for (int k = 0; k < (int)endpoints.size(); k++)
+	{
+		int i = endpoints[k].object;
+		endpoints[k].minX = agents.minX[i];
+		endpoints[k].maxX = agents.maxX[i];
+		endpoints[k].minY = agents.minY[i];
+		endpoints[k].maxY = agents.maxY[i];
+	}
+
+	insertionSort();
+}
+
+void SweepAndPrune::rebuild(const AgentStore& agents)
+{
+	endpoints.resize(agents.size());
+	for (int i = 0; i < agents.size(); i++)
+	{
+		endpoints[i] = { agents.minX[i], agents.maxX[i], agents.minY[i], agents.maxY[i], i };
+	}
+
+	std::sort(endpoints.begin(), endpoints.end(),
+		[](const SweepEndpoint& a, const SweepEndpoint& b) { return a.minX < b.minX; });
+
+	swapCount = 0;
+}
+
+void SweepAndPrune::insertionSort()
+{
+	swapCount = 0;
+
+	for (int i = 1; i < (int)endpoints.size(); i++)
+	{
+		SweepEndpoint endpoint = endpoints[i];
+		int j = i - 1;
+
+		while (j >= 0 && endpoints[j].minX > endpoint.minX)
+		{
+			endpoints[j + 1] = endpoints[j];
+			j--;
+			swapCount++;
+		}
+
+		endpoints[j + 1] = endpoint;
+	}
+}
+
+void SweepAndPrune::findPairs(vector<pair<int, int>>& pairs) const
+{
+	findPairs(pairs, 0, endpoints.size());
+}
+
+void SweepAndPrune::findPairs(vector<pair<int, int>>& pairs, int begin, int end, int) const
+{
+	int count = endpoints.size();
+
+	for (int i = begin; i < end; i++)
+	{
+		const SweepEndpoint& a = endpoints[i];
+
+		// every box starting before a ends overlaps a on x
+		for (int j = i + 1; j < count && endpoints[j].minX < a.maxX; j++)
+		{
+			const SweepEndpoint& b = endpoints[j];
+
+			if (a.minY < b.maxY && a.maxY > b.minY)
+			{
+				// keep the (lower, higher) object order the response code expects
+				if (a.object < b.object)
+					pairs.push_back(pair<int, int>(a.object, b.object));
+				else
+					pairs.push_back(pair<int, int>(b.object, a.object));
+			}
+		}
+	}
+}
+
+int SweepAndPrune::getSwapCount() const
+{
+	return swapCount;
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <vector>
+#include <utility>
+#include "AABB.h"
+#include "AgentStore.h"
+
+using namespace std;
+
+/*
+ sort and sweep broad-phase on the x axis.
+ the endpoint list is kept between frames, agents only move velocity * delta_time per frame,
+ so the list is almost sorted already and an insertion sort fixes it in close to linear time.
+ the sweep walks the list and tests the y axis of every x overlap (same xy plane AABB::overlap tests).
+*/
+
+struct SweepEndpoint
+{
+	float minX;
+	float maxX;
+	float minY;
+	float maxY;
+	int object;
+};
+
+class SweepAndPrune
+{
+public:
+	SweepAndPrune();
+	void update(const AgentStore& agents);
+	void findPairs(vector<pair<int, int>>& pairs) const;
+	// sweep starting at sorted endpoints [begin, end), chunk like SpatialHashGrid, the sweep needs no scratch
+	void findPairs(vector<pair<int, int>>& pairs, int begin, int end, int chunk = 0) const;
+	int getSwapCount() const;
+
+private:
+	void rebuild(const AgentStore& agents);
+	void insertionSort();
+
+	vector<SweepEndpoint> endpoints;  // sorted by minX, persistent across frames
+	int swapCount;  // insertion sort moves in the last update, shows how coherent the frame was
+};
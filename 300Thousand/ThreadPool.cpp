@@ -0,0 +1,115 @@
+#include "ThreadPool.h"
+#include <algorithm>
+
+ThreadPool::ThreadPool(int threadCount)
+	: job(nullptr), jobCount(0), chunkCount(0), generation(0), pending(0), stopping(false)
+{
+	start(threadCount);
+}
+
+ThreadPool::~ThreadPool()
+{
+	stop();
+}
+
+void ThreadPool::resize(int threadCount)
+{
+	stop();
+	start(threadCount);
+}
+
+int ThreadPool::getThreadCount() const
+{
+	return workers.size() + 1;
+}
+
+void ThreadPool::start(int threadCount)
+{
+	if (threadCount <= 0)
+		threadCount = std::max(1, (int)thread::hardware_concurrency());
+
+	stopping = false;
+	for (int w = 1; w < threadCount; w++)
+		workers.push_back(thread(&ThreadPool::workerLoop, this, w, generation));
+}
+
+void ThreadPool::stop()
+{
+	{
+		lock_guard<mutex> lock(jobMutex);
+		stopping = true;
+	}
+	jobReady.notify_all();
+
+	for (thread& worker : workers)
+		worker.join();
+	workers.clear();
+}
+
+void ThreadPool::parallelFor(int count, const function<void(int, int, int)>& task, int minChunkSize)
+{
+	if (count <= 0)
+		return;
+
+	int chunks = std::min(getThreadCount(), (count + minChunkSize - 1) / std::max(1, minChunkSize));
+	chunks = std::max(1, chunks);
+
+	if (chunks == 1)
+	{
+		task(0, count, 0);
+		return;
+	}
+
+	{
+		lock_guard<mutex> lock(jobMutex);
+		job = &task;
+		jobCount = count;
+		chunkCount = chunks;
+		pending = chunks - 1;
+		generation++;
+	}
+	jobReady.notify_all();
+
+	// the calling thread takes the first chunk
+	task(0, count / chunks, 0);
+
+	unique_lock<mutex> lock(jobMutex);
+	jobDone.wait(lock, [this] { return pending == 0; });
+	job = nullptr;
+}
+
+void ThreadPool::workerLoop(int worker, int seenGeneration)
+{
+	while (true)
+	{
+		const function<void(int, int, int)>* task;
+		int count, chunks;
+		{
+			unique_lock<mutex> lock(jobMutex);
+			jobReady.wait(lock, [this, seenGeneration] { return stopping || generation != seenGeneration; });
+			if (stopping)
+				return;
+
+			seenGeneration = generation;
+			task = job;
+			count = jobCount;
+			chunks = chunkCount;
+		}
+
+		// workers beyond the chunk count of this job sit it out
+		if (worker >= chunks)
+			continue;
+
+		int begin = (int)((long long)count * worker / chunks);
+		int end = (int)((long long)count * (worker + 1) / chunks);
+		(*task)(begin, end, worker);
+
+		bool last;
+		{
+			lock_guard<mutex> lock(jobMutex);
+			last = --pending == 0;
+		}
+		if (last)
+			jobDone.notify_one();
+	}
+}
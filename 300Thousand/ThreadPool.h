@@ -0,0 +1,43 @@
+#pragma once
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+using namespace std;
+
+/*
+ fixed pool of worker threads for the simulation passes.
+ parallelFor splits a range into contiguous chunks in index order, chunk 0 runs on the calling thread,
+ so writing per-chunk results and joining them in chunk order gives the same result as one thread.
+*/
+
+class ThreadPool
+{
+public:
+	ThreadPool(int threadCount = 0);  // 0 = one thread per hardware thread
+	~ThreadPool();
+	void resize(int threadCount);
+	int getThreadCount() const;  // including the calling thread
+
+	// task(begin, end, chunk) for every chunk of [0, count), blocks until all chunks are done
+	void parallelFor(int count, const function<void(int, int, int)>& task, int minChunkSize = 1024);
+
+private:
+	void start(int threadCount);
+	void stop();
+	void workerLoop(int worker, int seenGeneration);
+
+	vector<thread> workers;
+	mutex jobMutex;
+	condition_variable jobReady;
+	condition_variable jobDone;
+
+	const function<void(int, int, int)>* job;
+	int jobCount;
+	int chunkCount;
+	int generation;  // bumped for every job so sleeping workers know there is new work
+	int pending;     // chunks still running on workers
+	bool stopping;
+};
@@ -0,0 +1,48 @@
+#version 430
+layout(local_size_x = 64) in;
+
+#define MAX_LODS 4
+#define LOD_SLOTS (MAX_LODS + 1)
+#define IMPOSTOR_SLOT MAX_LODS
+
+layout(location = 17) uniform int command_count;
+layout(location = 24) uniform int entry_count;
+
+// matches DrawElementsIndirectCommand (std430, 20 bytes)
+struct DrawCommand
+{
+	uint count;
+	uint instance_count;
+	uint first_index;
+	int base_vertex;
+	uint base_instance;
+};
+
+layout(std430, binding = 10) buffer LodCounts { uint lod_counts[LOD_SLOTS]; uint lod_cursors[LOD_SLOTS]; };
+layout(std430, binding = 11) buffer DrawCommands { DrawCommand commands[]; };
+// matches DrawArraysIndirectCommand, one quad per impostor
+layout(std430, binding = 14) buffer ImpostorCommand { uint quad_count; uint impostor_count; uint first_vertex; uint impostor_base; };
+
+// the commands are lod major, every entry of a lod draws the same range of the compacted instances.
+// the lods follow each other in the compacted buffers, the scatter pass starts each at its cursor.
+// the invocation after the last command does the impostors, they have buffers of their own
+void main(void)
+{
+	uint c = gl_GlobalInvocationID.x;
+	if (c < uint(command_count))
+	{
+		uint lod = c / uint(entry_count);
+		uint base = 0;
+		for (uint l = 0; l < lod; l++)
+			base += lod_counts[l];
+		commands[c].instance_count = lod_counts[lod];
+		commands[c].base_instance = base;
+		if (c % uint(entry_count) == 0)
+			lod_cursors[lod] = base;
+	}
+	else if (c == uint(command_count))
+	{
+		impostor_count = lod_counts[IMPOSTOR_SLOT];
+		lod_cursors[IMPOSTOR_SLOT] = 0;
+	}
+}
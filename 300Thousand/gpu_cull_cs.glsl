@@ -0,0 +1,79 @@
+#version 430
+layout(local_size_x = 256) in;
+
+#define MAX_LODS 4
+#define LOD_SLOTS (MAX_LODS + 1)  // the mesh lods and the impostors
+#define IMPOSTOR_SLOT MAX_LODS
+#define CULLED 0xFFFFFFFFu
+#define NO_MESH 7u
+#define IMPOSTOR_BIT 8u
+
+layout(location = 8) uniform int instance_count;
+layout(location = 9) uniform vec4 frustum_planes[6];
+layout(location = 15) uniform vec3 bounds_center;  // mesh box in model space
+layout(location = 16) uniform vec3 bounds_extent;
+layout(location = 18) uniform int lod_count;
+layout(location = 19) uniform float lod_screen_sizes[MAX_LODS - 1];
+layout(location = 22) uniform vec3 eye_position;
+layout(location = 23) uniform float projection_scale;  // P[1][1]
+layout(location = 25) uniform float bounds_radius;     // of the sphere around the mesh box
+layout(location = 26) uniform float impostor_distance;  // 3e38 without impostors
+layout(location = 27) uniform float impostor_fade_width;
+
+layout(std430, binding = 7) readonly buffer Instances { mat4 instances[]; };
+layout(std430, binding = 10) buffer LodCounts { uint lod_counts[LOD_SLOTS]; uint lod_cursors[LOD_SLOTS]; };
+layout(std430, binding = 12) writeonly buffer InstanceLods { uint instance_lods[]; };
+
+shared uint group_counts[LOD_SLOTS];
+
+// the frustum test and the lod of every instance, and how many instances each lod gets. past the
+// impostor distance an instance is an impostor, inside the fade band both a mesh and an impostor.
+// gpu_cull_scatter_cs.glsl moves them into place once the commands pass has the offsets
+void main(void)
+{
+	uint i = gl_GlobalInvocationID.x;
+	if (gl_LocalInvocationIndex < LOD_SLOTS)
+		group_counts[gl_LocalInvocationIndex] = 0;
+	barrier();
+
+	// world box of the instance, the center moves with the matrix and the extent spreads over |M|
+	bool visible = i < uint(instance_count);
+	uint lod = 0;
+	bool mesh = true;
+	bool impostor = false;
+	if (visible)
+	{
+		mat4 M = instances[i];
+		vec3 center = (M * vec4(bounds_center, 1.0)).xyz;
+		vec3 extent = abs(M[0].xyz) * bounds_extent.x + abs(M[1].xyz) * bounds_extent.y + abs(M[2].xyz) * bounds_extent.z;
+		for (int p = 0; p < 6; p++)
+		{
+			vec4 plane = frustum_planes[p];
+			visible = visible && dot(plane.xyz, center) + plane.w + dot(abs(plane.xyz), extent) >= 0.0;
+		}
+
+		// diameter of the bounding sphere over the screen height, same rule as SelectLod
+		float scale = max(length(M[0].xyz), max(length(M[1].xyz), length(M[2].xyz)));
+		float eye_distance = max(length(center - eye_position), 1e-4);
+		float screen_size = bounds_radius * scale * projection_scale / eye_distance;
+		while (int(lod) < lod_count - 1 && screen_size < lod_screen_sizes[lod])
+			lod++;
+
+		// from the instance origin, like the fade in the vertex shaders
+		float origin_distance = distance(M[3].xyz, eye_position);
+		mesh = origin_distance < impostor_distance + impostor_fade_width;
+		impostor = origin_distance > impostor_distance;
+	}
+
+	if (visible && mesh)
+		atomicAdd(group_counts[lod], 1u);
+	if (visible && impostor)
+		atomicAdd(group_counts[IMPOSTOR_SLOT], 1u);
+	if (i < uint(instance_count))
+		instance_lods[i] = visible ? (mesh ? lod : NO_MESH) | (impostor ? IMPOSTOR_BIT : 0u) : CULLED;
+	barrier();
+
+	// one global atomic per lod and work group
+	if (gl_LocalInvocationIndex < LOD_SLOTS && group_counts[gl_LocalInvocationIndex] > 0)
+		atomicAdd(lod_counts[gl_LocalInvocationIndex], group_counts[gl_LocalInvocationIndex]);
+}
@@ -0,0 +1,65 @@
+#version 430
+layout(local_size_x = 256) in;
+
+#define MAX_LODS 4
+#define LOD_SLOTS (MAX_LODS + 1)
+#define IMPOSTOR_SLOT MAX_LODS
+#define CULLED 0xFFFFFFFFu
+#define NO_MESH 7u
+#define IMPOSTOR_BIT 8u
+
+layout(location = 8) uniform int instance_count;
+
+layout(std430, binding = 7) readonly buffer Instances { mat4 instances[]; };
+layout(std430, binding = 8) writeonly buffer VisibleMatrices { mat4 visible_matrices[]; };
+layout(std430, binding = 9) writeonly buffer VisibleIndices { uint visible_indices[]; };
+layout(std430, binding = 10) buffer LodCounts { uint lod_counts[LOD_SLOTS]; uint lod_cursors[LOD_SLOTS]; };
+layout(std430, binding = 12) readonly buffer InstanceLods { uint instance_lods[]; };
+
+// the impostors only need the position and the animation phase
+struct ImpostorInstance
+{
+	vec3 position;
+	uint index;
+};
+layout(std430, binding = 13) writeonly buffer ImpostorInstances { ImpostorInstance impostors[]; };
+
+shared uint group_counts[LOD_SLOTS];
+shared uint group_bases[LOD_SLOTS];
+
+// every visible instance goes to the range of its lod and, past the impostor distance, to the
+// impostors. one global atomic per lod and work group
+void main(void)
+{
+	uint i = gl_GlobalInvocationID.x;
+	if (gl_LocalInvocationIndex < LOD_SLOTS)
+		group_counts[gl_LocalInvocationIndex] = 0;
+	barrier();
+
+	uint code = i < uint(instance_count) ? instance_lods[i] : CULLED;
+	uint lod = code & NO_MESH;
+	bool mesh = code != CULLED && lod != NO_MESH;
+	bool impostor = code != CULLED && (code & IMPOSTOR_BIT) != 0u;
+	uint slot = 0;
+	uint impostor_slot = 0;
+	if (mesh)
+		slot = atomicAdd(group_counts[lod], 1u);
+	if (impostor)
+		impostor_slot = atomicAdd(group_counts[IMPOSTOR_SLOT], 1u);
+	barrier();
+
+	if (gl_LocalInvocationIndex < LOD_SLOTS && group_counts[gl_LocalInvocationIndex] > 0)
+		group_bases[gl_LocalInvocationIndex] = atomicAdd(lod_cursors[gl_LocalInvocationIndex], group_counts[gl_LocalInvocationIndex]);
+	barrier();
+
+	if (mesh)
+	{
+		visible_matrices[group_bases[lod] + slot] = instances[i];
+		visible_indices[group_bases[lod] + slot] = i;
+	}
+	if (impostor)
+	{
+		impostors[group_bases[IMPOSTOR_SLOT] + impostor_slot].position = instances[i][3].xyz;
+		impostors[group_bases[IMPOSTOR_SLOT] + impostor_slot].index = i;
+	}
+}
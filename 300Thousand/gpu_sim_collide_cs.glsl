@@ -0,0 +1,92 @@
+#version 430
+layout(local_size_x = 256) in;
+
+layout(location = 0) uniform int agent_count;
+layout(location = 1) uniform float delta_time;
+layout(location = 4) uniform float cell_size;
+layout(location = 5) uniform uint table_mask;
+layout(location = 6) uniform vec3 rest_min;
+layout(location = 7) uniform vec3 rest_max;
+
+struct Agent
+{
+	vec4 pos;
+	vec4 vel;
+};
+
+layout(std430, binding = 0) readonly buffer AgentsIn { Agent agents_in[]; };
+layout(std430, binding = 1) writeonly buffer AgentsOut { Agent agents_out[]; };
+layout(std430, binding = 3) readonly buffer CellStart { uint cell_start[]; };
+layout(std430, binding = 4) readonly buffer SortedAgents { uint sorted_agents[]; };
+layout(std430, binding = 6) writeonly buffer ModelMatrices { mat4 model_matrix[]; };  // the instance buffer RenderInstanced reads
+
+uint hashCell(ivec2 cell)
+{
+	return (uint(cell.x) * 73856093u ^ uint(cell.y) * 19349663u) & table_mask;
+}
+
+// every agent resolves its own side of each contact against last state of the others,
+// so the pass needs no atomics, the same axis choice as collisionResponse() on the cpu
+void main(void)
+{
+	int i = int(gl_GlobalInvocationID.x);
+	if (i >= agent_count)
+		return;
+
+	vec3 pos = agents_in[i].pos.xyz;
+	vec3 vel = agents_in[i].vel.xyz;
+	vec3 box_min = pos + rest_min;
+	vec3 box_max = pos + rest_max;
+	ivec2 home = ivec2(floor((pos.xy + 0.5 * (rest_min.xy + rest_max.xy)) / cell_size));
+
+	for (int dy = -1; dy <= 1; dy++)
+	{
+		for (int dx = -1; dx <= 1; dx++)
+		{
+			ivec2 cell = home + ivec2(dx, dy);
+			uint bucket = hashCell(cell);
+
+			for (uint k = cell_start[bucket]; k < cell_start[bucket + 1u]; k++)
+			{
+				uint j = sorted_agents[k];
+				if (j == uint(i))
+					continue;
+
+				vec3 other_pos = agents_in[j].pos.xyz;
+				vec3 other_min = other_pos + rest_min;
+				vec3 other_max = other_pos + rest_max;
+
+				// skip other cells hashed into the same bucket, they are visited through their own cell
+				if (ivec2(floor((other_pos.xy + 0.5 * (rest_min.xy + rest_max.xy)) / cell_size)) != cell)
+					continue;
+
+				if (box_min.x < other_max.x && box_max.x > other_min.x &&
+					box_min.y < other_max.y && box_max.y > other_min.y)
+				{
+					vec2 delta_area = min(box_max.xy - other_min.xy, other_max.xy - box_min.xy);
+					vec2 velocity_delta = vel.xy + agents_in[j].vel.xy;
+					vec2 delta_t = delta_area / velocity_delta;
+
+					if (delta_t.x <= delta_t.y)
+					{
+						// x direction is the hit normal
+						pos.x -= vel.x * delta_time;
+						vel.x = -vel.x;
+					}
+					else
+					{
+						// y direction is the hit normal
+						pos.y -= vel.y * delta_time;
+						vel.y = -vel.y;
+					}
+				}
+			}
+		}
+	}
+
+	agents_out[i].pos = vec4(pos, 1.0);
+	agents_out[i].vel = vec4(vel, 0.0);
+
+	// translation only, like the cpu path
+	model_matrix[i] = mat4(vec4(1.0, 0.0, 0.0, 0.0), vec4(0.0, 1.0, 0.0, 0.0), vec4(0.0, 0.0, 1.0, 0.0), vec4(pos, 1.0));
+}
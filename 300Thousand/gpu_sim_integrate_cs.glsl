@@ -0,0 +1,51 @@
+#version 430
+layout(local_size_x = 256) in;
+
+layout(location = 0) uniform int agent_count;
+layout(location = 1) uniform float delta_time;
+layout(location = 2) uniform vec2 arena_min;
+layout(location = 3) uniform vec2 arena_max;
+layout(location = 4) uniform float cell_size;
+layout(location = 5) uniform uint table_mask;
+layout(location = 6) uniform vec3 rest_min;
+layout(location = 7) uniform vec3 rest_max;
+
+struct Agent
+{
+	vec4 pos;
+	vec4 vel;
+};
+
+layout(std430, binding = 0) buffer AgentsIn { Agent agents_in[]; };
+layout(std430, binding = 2) buffer CellCount { uint cell_count[]; };
+layout(std430, binding = 5) buffer AgentCell { uvec2 agent_cell[]; };  // x = hash bucket, y = slot inside the bucket
+
+uint hashCell(ivec2 cell)
+{
+	return (uint(cell.x) * 73856093u ^ uint(cell.y) * 19349663u) & table_mask;
+}
+
+void main(void)
+{
+	int i = int(gl_GlobalInvocationID.x);
+	if (i >= agent_count)
+		return;
+
+	vec3 pos = agents_in[i].pos.xyz;
+	vec3 vel = agents_in[i].vel.xyz;
+
+	// bounding detection, only xy moving
+	bvec2 outside = bvec2(pos.x < arena_min.x || pos.x > arena_max.x, pos.y < arena_min.y || pos.y > arena_max.y);
+	pos.xy = clamp(pos.xy, arena_min, arena_max);
+	vel.xy = mix(vel.xy, -vel.xy, outside);
+
+	pos += vel * delta_time;
+
+	agents_in[i].pos = vec4(pos, 1.0);
+	agents_in[i].vel = vec4(vel, 0.0);
+
+	// bin by the aabb center, like SpatialHashGrid
+	ivec2 cell = ivec2(floor((pos.xy + 0.5 * (rest_min.xy + rest_max.xy)) / cell_size));
+	uint bucket = hashCell(cell);
+	agent_cell[i] = uvec2(bucket, atomicAdd(cell_count[bucket], 1u));
+}
@@ -0,0 +1,44 @@
+#version 430
+layout(local_size_x = 1024) in;
+
+layout(location = 5) uniform uint table_mask;
+
+layout(std430, binding = 2) buffer CellCount { uint cell_count[]; };
+layout(std430, binding = 3) buffer CellStart { uint cell_start[]; };  // table size + 1 entries
+
+shared uint block_sum[1024];
+
+// exclusive prefix sum of the bucket counts in a single work group,
+// every invocation sums a contiguous block, the block sums are scanned in shared memory
+void main(void)
+{
+	uint table_size = table_mask + 1u;
+	uint block_size = (table_size + 1023u) / 1024u;
+	uint first = gl_LocalInvocationIndex * block_size;
+	uint last = min(first + block_size, table_size);
+
+	uint sum = 0u;
+	for (uint b = first; b < last; b++)
+		sum += cell_count[b];
+	block_sum[gl_LocalInvocationIndex] = sum;
+	barrier();
+
+	// hillis steele scan
+	for (uint offset = 1u; offset < 1024u; offset <<= 1)
+	{
+		uint value = gl_LocalInvocationIndex >= offset ? block_sum[gl_LocalInvocationIndex - offset] : 0u;
+		barrier();
+		block_sum[gl_LocalInvocationIndex] += value;
+		barrier();
+	}
+
+	uint start = block_sum[gl_LocalInvocationIndex] - sum;
+	for (uint b = first; b < last; b++)
+	{
+		cell_start[b] = start;
+		start += cell_count[b];
+	}
+
+	if (gl_LocalInvocationIndex == 1023u)
+		cell_start[table_size] = block_sum[1023];
+}
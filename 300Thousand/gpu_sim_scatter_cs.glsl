@@ -0,0 +1,18 @@
+#version 430
+layout(local_size_x = 256) in;
+
+layout(location = 0) uniform int agent_count;
+
+layout(std430, binding = 3) buffer CellStart { uint cell_start[]; };
+layout(std430, binding = 4) buffer SortedAgents { uint sorted_agents[]; };
+layout(std430, binding = 5) buffer AgentCell { uvec2 agent_cell[]; };
+
+void main(void)
+{
+	int i = int(gl_GlobalInvocationID.x);
+	if (i >= agent_count)
+		return;
+
+	uvec2 cell = agent_cell[i];
+	sorted_agents[cell_start[cell.x] + cell.y] = uint(i);
+}
@@ -0,0 +1,27 @@
+#version 430
+layout(binding = 0) uniform sampler2D impostor_tex;
+
+in ImpostorData
+{
+	vec2 tex_coord;
+	float impostor_fade;
+} inData;
+
+out vec4 fragcolor;
+
+// same dither as instanced_skinning_fs.glsl, the mesh drops what this keeps
+float dither()
+{
+	const float bayer[16] = float[](0.0, 8.0, 2.0, 10.0, 12.0, 4.0, 14.0, 6.0, 3.0, 11.0, 1.0, 9.0, 15.0, 7.0, 13.0, 5.0);
+	ivec2 p = ivec2(gl_FragCoord.xy) & 3;
+	return (bayer[p.y * 4 + p.x] + 0.5) / 16.0;
+}
+
+void main(void)
+{
+	// the atlas was cleared to 0, so its filtered colors come premultiplied by the coverage
+	vec4 color = texture(impostor_tex, inData.tex_coord);
+	if (color.a < 0.5 || inData.impostor_fade <= dither())
+		discard;
+	fragcolor = vec4(color.rgb / color.a, 1.0);
+}
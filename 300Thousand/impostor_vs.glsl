@@ -0,0 +1,61 @@
+#version 430
+layout(location = 5) uniform int frame_number = 0;
+layout(location = 10) uniform float impostor_distance;
+layout(location = 11) uniform float impostor_fade_width = 1.0;
+layout(location = 12) uniform ivec3 impostor_grid;  // azimuths, elevations, frames
+layout(location = 13) uniform vec3 impostor_center;  // of the mesh, model space
+layout(location = 14) uniform float impostor_half_size;
+layout(location = 15) uniform float impostor_max_elevation;
+
+layout(std140, binding = 0) uniform SceneUniforms
+{
+   mat4 PV;	//camera projection * view matrix
+   vec4 eye_w;	//world-space eye position
+};
+
+// one compacted impostor instance, see gpu_cull_scatter_cs.glsl
+layout (location = 0) in vec3 instance_position;
+layout (location = 1) in uint instance_index;
+
+const vec2 quad[4] = vec2[] (vec2(-1.0, -1.0), vec2(1.0, -1.0), vec2(-1.0, 1.0), vec2(1.0, 1.0));
+const float PI = 3.14159265;
+
+out ImpostorData
+{
+	vec2 tex_coord;
+	float impostor_fade;
+} outData;
+
+// a quad facing the eye with the atlas tile of the nearest baked view and the current animation frame.
+// the quad is spanned like the bake camera (lookAt, z up), so the tile lines up with it
+void main(void)
+{
+	vec3 center = instance_position + impostor_center;
+	vec3 to_eye = eye_w.xyz - center;
+	float eye_distance = max(length(to_eye), 1e-4);
+	vec3 f = -to_eye / eye_distance;
+	vec3 s = cross(f, vec3(0.0, 0.0, 1.0));
+	s = length(s) > 1e-4 ? normalize(s) : vec3(1.0, 0.0, 0.0);
+	vec3 u = cross(s, f);
+
+	vec2 corner = quad[gl_VertexID];
+	vec3 pw = center + (corner.x * s + corner.y * u) * impostor_half_size;
+	gl_Position = PV * vec4(pw, 1.0);
+
+	int azimuths = impostor_grid.x;
+	int elevations = impostor_grid.y;
+	int frames = impostor_grid.z;
+	float azimuth = atan(to_eye.y, to_eye.x);
+	float elevation = asin(clamp(to_eye.z / eye_distance, -1.0, 1.0));
+	int a = int(mod(round(azimuth * azimuths / (2.0 * PI)), float(azimuths)));
+	int e = elevations > 1 ? clamp(int(round(elevation * (elevations - 1) / impostor_max_elevation)), 0, elevations - 1) : 0;
+	int view = e * azimuths + a;
+
+	// same phase as getCellIndex in instanced_skinning_vs.glsl
+	int phase = int(mod(frame_number + (int(instance_index) * 70), 150));
+	int frame = phase * frames / 150;
+
+	outData.tex_coord = vec2((frame + corner.x * 0.5 + 0.5) / frames, (view + corner.y * 0.5 + 0.5) / (azimuths * elevations));
+	// from the instance origin like the mesh, the two fades have to agree
+	outData.impostor_fade = clamp((distance(instance_position, eye_w.xyz) - impostor_distance) / impostor_fade_width, 0.0, 1.0);
+}
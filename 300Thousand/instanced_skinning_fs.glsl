@@ -32,12 +32,24 @@ in VertexData
    vec3 pw;       //world-space vertex position
    vec3 nw;   //world-space normal vector
    float w_debug;
+   float impostor_fade;
 } inData;   //block is named 'inData'
 
 out vec4 fragcolor; //the output color for this fragment    
 
+// 4x4 ordered dither, impostor_fs.glsl keeps the fragments this one drops
+float dither()
+{
+    const float bayer[16] = float[](0.0, 8.0, 2.0, 10.0, 12.0, 4.0, 14.0, 6.0, 3.0, 11.0, 1.0, 9.0, 15.0, 7.0, 13.0, 5.0);
+    ivec2 p = ivec2(gl_FragCoord.xy) & 3;
+    return (bayer[p.y * 4 + p.x] + 0.5) / 16.0;
+}
+
 void main(void)
 {   
+    if (inData.impostor_fade > dither())
+        discard;
+
     //Compute per-fragment Phong lighting
     vec4 ktex = texture(color_tex, inData.tex_coord);
 
@@ -62,6 +74,7 @@ void main(void)
 
     vec4 specular_term = atten*ks*Ls*pow(max(0.0, dot(rw, vw)), shininess);
 
-    fragcolor = ambient_term + diffuse_term + specular_term;
+    // opaque, the impostor bake reads the alpha as coverage
+    fragcolor = vec4((ambient_term + diffuse_term + specular_term).rgb, 1.0);
 }
 
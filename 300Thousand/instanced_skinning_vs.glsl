@@ -7,6 +7,8 @@ layout(location = 5) uniform int frame_number = 0;
 layout(location = 6) uniform int animTexHeight = 256;
 layout(location = 7) uniform int animTexWidth = 256;
 layout(location = 8) uniform int animationIndex = 0;
+layout(location = 10) uniform float impostor_distance = 3.0e38;  // see impostor_vs.glsl
+layout(location = 11) uniform float impostor_fade_width = 1.0;
 //layout(location = 9) uniform int type;
 
 
@@ -39,6 +41,7 @@ layout (location = 3) in ivec4 bone_id_attrib;
 layout (location = 4) in vec4 weight_attrib;
 //layout(location = 8) in vec3 modelMatPos;
 layout (location = 8) in mat4 model_matrix;
+layout (location = 12) in uint instance_index;  // gl_InstanceID before culling compacted the instances
 
 out VertexData
 {
@@ -46,10 +49,11 @@ out VertexData
     vec3 pw;       //world-space vertex position
     vec3 nw;   //world-space normal vector
 	float w_debug;
+	float impostor_fade;  // 0 = mesh, 1 = impostor
 } outData;
 
 int getCellIndex(int bone_id, int row) {
-	int frameFinal = int(mod(frame_number + (gl_InstanceID * 70), 150));
+	int frameFinal = int(mod(frame_number + (int(instance_index) * 70), 150));
 	return (frameFinal * num_bones * 4) + (bone_id * 4) + row;
 }
 
@@ -165,5 +169,6 @@ void main(void)
 	}
 	
 	outData.tex_coord = tex_coord_attrib;
+	outData.impostor_fade = clamp((distance(M[3].xyz, eye_w.xyz) - impostor_distance) / impostor_fade_width, 0.0, 1.0);
 
 }
\ No newline at end of file